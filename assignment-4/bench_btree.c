@@ -0,0 +1,190 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "dberror.h"
+#include "btree_mgr.h"
+#include "tables.h"
+
+// B+ tree benchmark: insertKey, bulk load and findKey throughput for node
+// fanouts from 16 to 512 keys, then a read-heavy mix on 1 to 8 threads. Each tree holds a fixed number of keys per unit of fanout so
+// that it stays resident in the tree's buffer pool, which makes the
+// in-node search the cost that changes with the fanout.
+
+#define BENCH_FILE "bench_btree.idx"
+#define BENCH_BULK_FILE "bench_btree_bulk.idx"
+#define BENCH_KEYS_PER_FANOUT 24
+#define BENCH_LOOKUPS 2000000
+// Read-heavy mix run by 1 to BENCH_MAX_THREADS threads on one tree: of
+// every BENCH_MIX_PERIOD operations one is an insert or delete
+#define BENCH_MAX_THREADS 8
+#define BENCH_MIX_FANOUT 64
+#define BENCH_MIX_OPS 1000000
+#define BENCH_MIX_PERIOD 20
+
+static double elapsedNs(struct timespec *start, struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) * 1e9 + (end->tv_nsec - start->tv_nsec);
+}
+
+static void benchFanout(int fanout) {
+    int numKeys = fanout * BENCH_KEYS_PER_FANOUT;
+    BTreeHandle *tree;
+    struct timespec start, end;
+    Value key;
+    RID rid;
+
+    if (createBtree(BENCH_FILE, DT_INT, fanout) != RC_OK) {
+        printf("%8d %10s %14s\n", fanout, "-", "too large");
+        return;
+    }
+    CHECK(openBtree(&tree, BENCH_FILE));
+
+    // Insert in a random order, so leaves are between half and completely full
+    int *keys = malloc(numKeys * sizeof(int));
+    for (int i = 0; i < numKeys; i++) {
+        keys[i] = i * 2;
+    }
+    for (int i = numKeys - 1; i > 0; i--) {
+        int j = rand() % (i + 1);
+        int temp = keys[i];
+        keys[i] = keys[j];
+        keys[j] = temp;
+    }
+    key.dt = DT_INT;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < numKeys; i++) {
+        key.v.intV = keys[i];
+        rid.page = i;
+        rid.slot = 0;
+        CHECK(insertKey(tree, &key, rid));
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double insertNs = elapsedNs(&start, &end) / numKeys;
+
+    // The same keys in order through the bulk loader, into a second tree
+    BTreeHandle *bulkTree;
+    BT_BulkLoadHandle *bulk;
+    CHECK(createBtree(BENCH_BULK_FILE, DT_INT, fanout));
+    CHECK(openBtree(&bulkTree, BENCH_BULK_FILE));
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    CHECK(startBulkLoad(bulkTree, 1.0, &bulk));
+    for (int i = 0; i < numKeys; i++) {
+        key.v.intV = i * 2;
+        rid.page = i;
+        rid.slot = 0;
+        CHECK(bulkLoadEntry(bulk, &key, rid));
+    }
+    CHECK(finishBulkLoad(bulk));
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double bulkNs = elapsedNs(&start, &end) / numKeys;
+    CHECK(closeBtree(bulkTree));
+    CHECK(deleteBtree(BENCH_BULK_FILE));
+
+    int found = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < BENCH_LOOKUPS; i++) {
+        // Half of the lookups miss: odd keys are never inserted
+        key.v.intV = rand() % (numKeys * 2);
+        found += findKey(tree, &key, &rid) == RC_OK;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double ns = elapsedNs(&start, &end) / BENCH_LOOKUPS;
+
+    printf("%8d %10d %14.0f %14.0f %14.0f\n", fanout, numKeys, 1e9 / insertNs, 1e9 / bulkNs, 1e9 / ns);
+
+    free(keys);
+    CHECK(closeBtree(tree));
+    CHECK(deleteBtree(BENCH_FILE));
+    (void)found;
+}
+
+typedef struct MixWorker {
+    BTreeHandle *tree;
+    int id;
+    int numKeys;
+    int ops;
+} MixWorker;
+
+// Lookups of the even keys; every BENCH_MIX_PERIOD-th operation inserts or
+// deletes an odd key of this thread's own, so the writers never collide
+static void *runMix(void *arg) {
+    MixWorker *worker = (MixWorker *)arg;
+    unsigned int seed = worker->id + 1;
+    Value key;
+    RID rid;
+    int writes = 0;
+
+    key.dt = DT_INT;
+    for (int i = 0; i < worker->ops; i++) {
+        if (i % BENCH_MIX_PERIOD == 0) {
+            key.v.intV = 2 * ((writes / 2) * BENCH_MAX_THREADS + worker->id) + 1;
+            rid.page = key.v.intV;
+            rid.slot = 0;
+            if (writes % 2 == 0) {
+                insertKey(worker->tree, &key, rid);
+            } else {
+                deleteKey(worker->tree, &key);
+            }
+            writes++;
+        } else {
+            key.v.intV = 2 * (rand_r(&seed) % worker->numKeys);
+            findKey(worker->tree, &key, &rid);
+        }
+    }
+    return NULL;
+}
+
+static void benchThreads(int numThreads) {
+    int numKeys = BENCH_MIX_FANOUT * BENCH_KEYS_PER_FANOUT;
+    BTreeHandle *tree;
+    BT_BulkLoadHandle *bulk;
+    pthread_t threads[BENCH_MAX_THREADS];
+    MixWorker workers[BENCH_MAX_THREADS];
+    struct timespec start, end;
+    Value key;
+    RID rid;
+
+    CHECK(createBtree(BENCH_FILE, DT_INT, BENCH_MIX_FANOUT));
+    CHECK(openBtree(&tree, BENCH_FILE));
+    CHECK(startBulkLoad(tree, 0.7, &bulk));
+    key.dt = DT_INT;
+    for (int i = 0; i < numKeys; i++) {
+        key.v.intV = i * 2;
+        rid.page = i;
+        rid.slot = 0;
+        CHECK(bulkLoadEntry(bulk, &key, rid));
+    }
+    CHECK(finishBulkLoad(bulk));
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < numThreads; i++) {
+        workers[i].tree = tree;
+        workers[i].id = i;
+        workers[i].numKeys = numKeys;
+        workers[i].ops = BENCH_MIX_OPS / numThreads;
+        pthread_create(&threads[i], NULL, runMix, &workers[i]);
+    }
+    for (int i = 0; i < numThreads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double ns = elapsedNs(&start, &end) / (BENCH_MIX_OPS / numThreads * numThreads);
+
+    printf("%8d %14.0f\n", numThreads, 1e9 / ns);
+    CHECK(closeBtree(tree));
+    CHECK(deleteBtree(BENCH_FILE));
+}
+
+int main(void) {
+    srand(42);
+    printf("%8s %10s %14s %14s %14s\n", "fanout", "keys", "inserts/s", "bulk loads/s", "lookups/s");
+    for (int fanout = 16; fanout <= 512; fanout *= 2) {
+        benchFanout(fanout);
+    }
+    printf("\n%8s %14s\n", "threads", "ops/s (95% lookups)");
+    for (int numThreads = 1; numThreads <= BENCH_MAX_THREADS; numThreads *= 2) {
+        benchThreads(numThreads);
+    }
+    return 0;
+}
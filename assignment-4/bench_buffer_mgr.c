@@ -0,0 +1,72 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "dberror.h"
+#include "buffer_mgr.h"
+#include "storage_mgr.h"
+
+// Pin latency benchmark: the pool grows from 4 to 1M frames while the
+// working set of resident pages stays fixed, so any growth in ns/op comes
+// from the page lookup itself and not from extra I/O.
+
+#define BENCH_FILE "bench_buffer.bin"
+#define BENCH_MAX_POOL (1 << 20)
+#define BENCH_WORKING_SET 1024
+#define BENCH_OPS 2000000
+
+static double elapsedNs(struct timespec *start, struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) * 1e9 + (end->tv_nsec - start->tv_nsec);
+}
+
+static void benchPool(int numPages) {
+    BM_BufferPool *bm = MAKE_POOL();
+    BM_PageHandle *h = MAKE_PAGE_HANDLE();
+    int workingSet = numPages < BENCH_WORKING_SET ? numPages : BENCH_WORKING_SET;
+    struct timespec start, end;
+
+    CHECK(initBufferPool(bm, BENCH_FILE, numPages, RS_LRU, NULL));
+
+    // Load the working set once, the timed loops below only hit it
+    for (int i = 0; i < workingSet; i++) {
+        CHECK(pinPage(bm, h, i));
+        CHECK(unpinPage(bm, h));
+    }
+
+    srand(42);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < BENCH_OPS; i++) {
+        CHECK(pinPage(bm, h, rand() % workingSet));
+        CHECK(unpinPage(bm, h));
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double hitNs = elapsedNs(&start, &end) / BENCH_OPS;
+
+    // Lookups of pages that are not resident follow one hash chain to its
+    // end, so they show the lookup cost most clearly
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < BENCH_OPS; i++) {
+        h->pageNum = BENCH_MAX_POOL + (rand() % BENCH_MAX_POOL);
+        forcePage(bm, h);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double missNs = elapsedNs(&start, &end) / BENCH_OPS;
+
+    printf("%10d %12d %16.1f %16.1f\n", numPages, getNumReadIO(bm), hitNs, missNs);
+
+    CHECK(shutdownBufferPool(bm));
+    free(bm);
+    free(h);
+}
+
+int main(int argc, char **argv) {
+    int maxPool = argc > 1 ? atoi(argv[1]) : BENCH_MAX_POOL;
+
+    CHECK(createPageFile(BENCH_FILE));
+    printf("%10s %12s %16s %16s\n", "numPages", "readIO", "pin+unpin (ns)", "miss lookup (ns)");
+    for (int numPages = 4; numPages <= maxPool; numPages *= 4) {
+        benchPool(numPages);
+    }
+    CHECK(destroyPageFile(BENCH_FILE));
+    return 0;
+}
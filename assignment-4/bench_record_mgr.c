@@ -0,0 +1,150 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "dberror.h"
+#include "record_mgr.h"
+#include "tables.h"
+
+// Record manager benchmark: durable inserts per second on 1 to 8 threads.
+// Every insert commits and waits for its commit to be synced to the log;
+// threads that commit together share one sync, so throughput should grow
+// with the number of threads while the syncs per commit fall. Then the
+// time openTable takes to recover a table whose process died after
+// committing BENCH_RECOVERY_INSERTS inserts, bounded by the checkpoints.
+
+#define BENCH_TABLE "bench_record_mgr.tbl"
+#define BENCH_MAX_THREADS 8
+#define BENCH_INSERTS 4000
+#define BENCH_RECOVERY_INSERTS 50000
+
+static double elapsedNs(struct timespec *start, struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) * 1e9 + (end->tv_nsec - start->tv_nsec);
+}
+
+static Schema *benchSchema(void) {
+    char **names = malloc(2 * sizeof(char *));
+    DataType *types = malloc(2 * sizeof(DataType));
+    int *sizes = malloc(2 * sizeof(int));
+    int *keys = malloc(sizeof(int));
+    names[0] = strdup("id");
+    names[1] = strdup("name");
+    types[0] = DT_INT;
+    types[1] = DT_STRING;
+    sizes[0] = 0;
+    sizes[1] = 16;
+    keys[0] = 0;
+    return createSchema(2, names, types, sizes, 1, keys);
+}
+
+typedef struct InsertWorker {
+    RM_TableData *table;
+    Schema *schema;
+    int id;
+    int inserts;
+} InsertWorker;
+
+static void *runInserts(void *arg) {
+    InsertWorker *worker = (InsertWorker *)arg;
+    Record *record;
+    Value *value;
+
+    CHECK(createRecord(&record, worker->schema));
+    MAKE_STRING_VALUE(value, "benchmark");
+    CHECK(setAttr(record, worker->schema, 1, value));
+    freeVal(value);
+    for (int i = 0; i < worker->inserts; i++) {
+        MAKE_VALUE(value, DT_INT, worker->id * worker->inserts + i);
+        CHECK(setAttr(record, worker->schema, 0, value));
+        freeVal(value);
+        CHECK(insertRecord(worker->table, record));
+    }
+    freeRecord(record);
+    return NULL;
+}
+
+static void benchThreads(int numThreads) {
+    RM_TableData table;
+    Schema *schema = benchSchema();
+    pthread_t threads[BENCH_MAX_THREADS];
+    InsertWorker workers[BENCH_MAX_THREADS];
+    struct timespec start, end;
+
+    CHECK(createTable(BENCH_TABLE, schema));
+    CHECK(openTable(&table, BENCH_TABLE));
+    WAL_Log *log = ((RM_TableMgmtData *)table.mgmtData)->log;
+    int syncs = getNumLogSyncs(log);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < numThreads; i++) {
+        workers[i].table = &table;
+        workers[i].schema = schema;
+        workers[i].id = i;
+        workers[i].inserts = BENCH_INSERTS / numThreads;
+        pthread_create(&threads[i], NULL, runInserts, &workers[i]);
+    }
+    for (int i = 0; i < numThreads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    int commits = BENCH_INSERTS / numThreads * numThreads;
+    double ns = elapsedNs(&start, &end) / commits;
+    syncs = getNumLogSyncs(log) - syncs;
+
+    printf("%8d %14.0f %14.2f\n", numThreads, 1e9 / ns, (double)syncs / commits);
+    CHECK(closeTable(&table));
+    CHECK(deleteTable(BENCH_TABLE));
+    freeSchema(schema);
+}
+
+static void benchRecovery(void) {
+    RM_TableData table;
+    Schema *schema = benchSchema();
+    pthread_t threads[BENCH_MAX_THREADS];
+    InsertWorker workers[BENCH_MAX_THREADS];
+    struct timespec start, end;
+    int status;
+
+    CHECK(createTable(BENCH_TABLE, schema));
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        CHECK(openTable(&table, BENCH_TABLE));
+        for (int i = 0; i < BENCH_MAX_THREADS; i++) {
+            workers[i].table = &table;
+            workers[i].schema = schema;
+            workers[i].id = i;
+            workers[i].inserts = BENCH_RECOVERY_INSERTS / BENCH_MAX_THREADS;
+            pthread_create(&threads[i], NULL, runInserts, &workers[i]);
+        }
+        for (int i = 0; i < BENCH_MAX_THREADS; i++) {
+            pthread_join(threads[i], NULL);
+        }
+        _exit(0); // without closing the table
+    }
+    waitpid(pid, &status, 0);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    CHECK(openTable(&table, BENCH_TABLE));
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("\nrecovery after %d commits: %.1f ms, %d records\n", BENCH_RECOVERY_INSERTS,
+           elapsedNs(&start, &end) / 1e6, getNumTuples(&table));
+    CHECK(closeTable(&table));
+    CHECK(deleteTable(BENCH_TABLE));
+    freeSchema(schema);
+}
+
+int main(void) {
+    CHECK(initRecordManager(NULL));
+    printf("%8s %14s %14s\n", "threads", "commits/s", "syncs/commit");
+    for (int numThreads = 1; numThreads <= BENCH_MAX_THREADS; numThreads *= 2) {
+        benchThreads(numThreads);
+    }
+    benchRecovery();
+    CHECK(shutdownRecordManager());
+    return 0;
+}
@@ -8,46 +8,348 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <sched.h>
+
+// Frames in the buffer pool each open tree reads its nodes through
+#define BTREE_POOL_SIZE 64
+// Most pages the index file grows by at a time. It doubles up to this, so
+// building a large tree does not cost a file extension per node while a
+// small one stays small.
+#define BTREE_EXTEND_PAGES 64
+// Longest string key of a tree created with createBtree
+#define BTREE_STRING_KEY_LENGTH 32
+
+static BTreeMgmtData *treeData(BTreeHandle *tree) {
+    return (BTreeMgmtData *)tree->mgmtData;
+}
+
+// Node page layout, see nodeHeader
+static nodeHeader *header(BM_PageHandle *page) {
+    return (nodeHeader *)page->data;
+}
+
+static char *nodeKeys(BM_PageHandle *page) {
+    return page->data + sizeof(nodeHeader);
+}
+
+static char *nodeKey(metaData *meta, BM_PageHandle *page, int i) {
+    return nodeKeys(page) + i * meta->keySize;
+}
+
+// Room for order + 1 keys, rounded up so that what follows is aligned
+static size_t keysArea(int n, int keySize) {
+    return ((n + 1) * keySize + sizeof(int) - 1) / sizeof(int) * sizeof(int);
+}
+
+static RID *nodeRids(metaData *meta, BM_PageHandle *page) {
+    return (RID *)(page->data + sizeof(nodeHeader) + keysArea(meta->order, meta->keySize));
+}
+
+static PageNumber *nodeChildren(metaData *meta, BM_PageHandle *page) {
+    return (PageNumber *)(page->data + sizeof(nodeHeader) + keysArea(meta->order, meta->keySize));
+}
+
+// Bytes a node of order n needs, with room for one key over the limit
+static size_t nodeSize(int n, int keySize) {
+    return sizeof(nodeHeader) + keysArea(n, keySize) + (n + 2) * sizeof(RID);
+}
+
+// Readers latch nothing: they note the version of each node before reading
+// it and check afterwards that it did not change, starting over from the
+// root if a writer got in between (optimistic lock coupling). Writers latch
+// nodes top-down by setting the lock bit of their version, and release the
+// nodes above as soon as they reach one their change cannot go past.
+#define NODE_OBSOLETE 1u
+#define NODE_LOCKED 2u
+
+// Version of a node for an optimistic read, false if a writer holds the
+// node or it was freed
+static bool readLockNode(BM_PageHandle *page, unsigned int *version) {
+    *version = __atomic_load_n(&header(page)->version, __ATOMIC_ACQUIRE);
+    return (*version & (NODE_LOCKED | NODE_OBSOLETE)) == 0;
+}
+
+// True if the node did not change since readLockNode returned version
+static bool validateNode(BM_PageHandle *page, unsigned int version) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&header(page)->version, __ATOMIC_RELAXED) == version;
+}
+
+static void writeLockNode(BM_PageHandle *page) {
+    unsigned int *word = &header(page)->version;
+    for (;;) {
+        unsigned int version = __atomic_load_n(word, __ATOMIC_RELAXED);
+        if (!(version & NODE_LOCKED)
+            && __atomic_compare_exchange_n(word, &version, version + NODE_LOCKED, false,
+                                           __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            break;
+        }
+        sched_yield();
+    }
+    // Changes to the node must not become visible before the lock bit
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+// Release a node latched by writeLockNode. A changed node gets the next
+// version, which sends readers that saw an older one back to the root.
+static void writeUnlockNode(BM_PageHandle *page, bool changed) {
+    if (changed)
+        __atomic_fetch_add(&header(page)->version, NODE_LOCKED, __ATOMIC_RELEASE);
+    else
+        __atomic_fetch_sub(&header(page)->version, NODE_LOCKED, __ATOMIC_RELEASE);
+}
+
+// num_keys of a node that is read optimistically. A writer may be changing
+// it, so it is kept within the node until the read has been validated.
+static int optimisticNumKeys(metaData *meta, BM_PageHandle *page) {
+    int num = __atomic_load_n(&header(page)->num_keys, __ATOMIC_RELAXED);
+    return num < 0 ? 0 : num > meta->order + 1 ? meta->order + 1 : num;
+}
+
+// Make root the root of the tree; the caller holds rootLatch
+static void setRoot(BTreeMgmtData *mgmt, PageNumber root) {
+    __atomic_store_n(&mgmt->meta.root, root, __ATOMIC_RELEASE);
+    __atomic_fetch_add(&mgmt->rootVersion, 1, __ATOMIC_RELEASE);
+}
+
+// Keys are stored encoded, as byte strings of keySize bytes that memcmp
+// orders like the values they stand for: integers and floats big-endian
+// with the sign bit flipped (every bit for negative floats), booleans as
+// one byte and strings padded with zeros to their longest length. The
+// attributes of a composite key follow each other.
+static void putBigEndian(char *out, unsigned int bits) {
+    out[0] = (char)(bits >> 24);
+    out[1] = (char)(bits >> 16);
+    out[2] = (char)(bits >> 8);
+    out[3] = (char)bits;
+}
+
+static unsigned int getBigEndian(const char *in) {
+    const unsigned char *bytes = (const unsigned char *)in;
+    return ((unsigned int)bytes[0] << 24) | ((unsigned int)bytes[1] << 16)
+           | ((unsigned int)bytes[2] << 8) | bytes[3];
+}
+
+static RC encodeKey(metaData *meta, Value *key, char *out) {
+    for (int i = 0; i < meta->numKeyAttrs; i++) {
+        Value *value = &key[i];
+        int length = meta->keyLengths[i];
+        if (value->dt != meta->keyTypes[i]) {
+            return RC_RM_COMPARE_VALUE_OF_DIFFERENT_DATATYPE;
+        }
+        switch (value->dt) {
+            case DT_INT:
+                putBigEndian(out, (unsigned int)value->v.intV ^ 0x80000000u);
+                break;
+            case DT_FLOAT: {
+                float f = value->v.floatV == 0 ? 0.0f : value->v.floatV; // -0 is 0
+                unsigned int bits;
+                memcpy(&bits, &f, sizeof(bits));
+                putBigEndian(out, (bits & 0x80000000u) ? ~bits : bits | 0x80000000u);
+                break;
+            }
+            case DT_BOOL:
+                out[0] = value->v.boolV ? 1 : 0;
+                break;
+            case DT_STRING: {
+                size_t n = strlen(value->v.stringV);
+                if (n > (size_t)length) {
+                    return RC_IM_KEY_TOO_LONG;
+                }
+                memcpy(out, value->v.stringV, n);
+                memset(out + n, 0, length - n);
+                break;
+            }
+        }
+        out += length;
+    }
+    return RC_OK;
+}
+
+// Values of an encoded key, strings are allocated
+static void decodeKey(metaData *meta, const char *in, Value *key) {
+    for (int i = 0; i < meta->numKeyAttrs; i++) {
+        Value *value = &key[i];
+        int length = meta->keyLengths[i];
+        unsigned int bits;
+        value->dt = meta->keyTypes[i];
+        switch (value->dt) {
+            case DT_INT:
+                value->v.intV = (int)(getBigEndian(in) ^ 0x80000000u);
+                break;
+            case DT_FLOAT:
+                bits = getBigEndian(in);
+                bits = (bits & 0x80000000u) ? bits & ~0x80000000u : ~bits;
+                memcpy(&value->v.floatV, &bits, sizeof(bits));
+                break;
+            case DT_BOOL:
+                value->v.boolV = in[0] != 0;
+                break;
+            case DT_STRING:
+                value->v.stringV = (char *) malloc(length + 1);
+                memcpy(value->v.stringV, in, length);
+                value->v.stringV[length] = '\0';
+                break;
+        }
+        in += length;
+    }
+}
+
+static RC readMetaData(BTreeMgmtData *mgmt) {
+    BM_PageHandle page;
+    RC rc = pinPage(mgmt->pool, &page, 0);
+    if (rc != RC_OK)
+        return rc;
+    memcpy(&mgmt->meta, page.data, sizeof(metaData));
+    return unpinPage(mgmt->pool, &page);
+}
+
+static RC writeMetaData(BTreeMgmtData *mgmt) {
+    BM_PageHandle page;
+    RC rc = pinPage(mgmt->pool, &page, 0);
+    if (rc != RC_OK)
+        return rc;
+    memcpy(page.data, &mgmt->meta, sizeof(metaData));
+    markDirty(mgmt->pool, &page);
+    return unpinPage(mgmt->pool, &page);
+}
+
+// Create an empty node and return it pinned. Nodes freed by merges are
+// reused first, only then is a page appended to the index file.
+static RC createNode(BTreeMgmtData *mgmt, bool is_leaf, BM_PageHandle *page) {
+    metaData *meta_data = &mgmt->meta;
+    unsigned int version = 0;
+    RC rc = RC_OK;
+
+    pthread_mutex_lock(&mgmt->allocLatch);
+    if (meta_data->freePages != NO_PAGE) {
+        rc = pinPage(mgmt->pool, page, meta_data->freePages);
+        if (rc == RC_OK) {
+            meta_data->freePages = header(page)->next_leaf;
+            // A reader still on the page from before it was freed must not
+            // validate against the new node
+            version = (header(page)->version & ~(NODE_LOCKED | NODE_OBSOLETE)) + 2 * NODE_LOCKED;
+        }
+    } else {
+        PageNumber pageNum = meta_data->numPages;
+        BM_MgmtData *bmData = (BM_MgmtData *)mgmt->pool->mgmtData;
+        if (pageNum >= bmData->fileHandle.totalNumPages) {
+            int extend = pageNum < BTREE_EXTEND_PAGES ? pageNum : BTREE_EXTEND_PAGES;
+            rc = ensurePoolCapacity(mgmt->pool, pageNum + extend);
+        }
+        if (rc == RC_OK)
+            rc = pinPage(mgmt->pool, page, pageNum);
+        if (rc == RC_OK)
+            meta_data->numPages++;
+    }
+    if (rc == RC_OK)
+        meta_data->nodes++;
+    pthread_mutex_unlock(&mgmt->allocLatch);
+    if (rc != RC_OK)
+        return rc;
+
+    __atomic_store_n(&header(page)->version, version, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memset(page->data + sizeof(nodeHeader), 0, PAGE_SIZE - sizeof(nodeHeader));
+    header(page)->is_leaf = is_leaf;
+    header(page)->num_keys = 0;
+    header(page)->next_leaf = NO_PAGE;
+    markDirty(mgmt->pool, page);
+    return RC_OK;
+}
+
+// Take a node emptied by a merge out of the tree. The caller holds its
+// latch, and the node goes on the free list once that is released, see
+// unlatchNode; readers that reach it until then find it freed.
+static void freeNode(BTreeMgmtData *mgmt, BM_PageHandle *page) {
+    __atomic_fetch_or(&header(page)->version, NODE_OBSOLETE, __ATOMIC_RELAXED);
+    header(page)->num_keys = 0;
+    markDirty(mgmt->pool, page);
+    pthread_mutex_lock(&mgmt->allocLatch);
+    mgmt->meta.nodes--;
+    pthread_mutex_unlock(&mgmt->allocLatch);
+}
+
+// Release a node latched by a writer together with the pin the latch came
+// with. A node freed while it was latched is put on the free list.
+static RC unlatchNode(BTreeMgmtData *mgmt, BM_PageHandle *page, bool changed) {
+    if (__atomic_load_n(&header(page)->version, __ATOMIC_RELAXED) & NODE_OBSOLETE) {
+        pthread_mutex_lock(&mgmt->allocLatch);
+        header(page)->next_leaf = mgmt->meta.freePages;
+        markDirty(mgmt->pool, page);
+        writeUnlockNode(page, true);
+        mgmt->meta.freePages = page->pageNum;
+        pthread_mutex_unlock(&mgmt->allocLatch);
+    } else {
+        writeUnlockNode(page, changed);
+    }
+    return unpinPage(mgmt->pool, page);
+}
+
+// Print an encoded key, the attributes of a composite key separated by commas
+static void printKey(metaData *meta, const char *key) {
+    Value values[BTREE_MAX_KEY_ATTRS];
+    decodeKey(meta, key, values);
+    for (int i = 0; i < meta->numKeyAttrs; i++) {
+        char *text = serializeValue(&values[i]);
+        printf("%s%s", i > 0 ? "," : "", text);
+        free(text);
+        if (values[i].dt == DT_STRING) {
+            free(values[i].v.stringV);
+        }
+    }
+}
 
 void printTree(BTreeHandle *tree) {
-    metaData *meta_data = (metaData *)tree->mgmtData;
-    node *current_node = meta_data->root;
+    BTreeMgmtData *mgmt = treeData(tree);
+    metaData *meta_data = &mgmt->meta;
+    BM_PageHandle current;
 
-    if (current_node == NULL) {
+    if (meta_data->root == NO_PAGE) {
         printf("Tree is empty\n");
         return;
     }
 
-    // Use a queue to do a level-order traversal (breadth-first traversal)
-    node **queue = (node **)malloc(sizeof(node*) * (meta_data->nodes));
+    // Use a queue of page numbers to do a level-order traversal (breadth-first traversal)
+    PageNumber *queue = (PageNumber *)malloc(sizeof(PageNumber) * (meta_data->nodes));
     int front = 0, rear = 0;
 
     // Enqueue the root node
-    queue[rear++] = current_node;
+    queue[rear++] = meta_data->root;
 
     // Traverse the tree level by level
+    int level = 0;
     while (front < rear) {
         int current_level_size = rear - front;
-        printf("Level %d: ", front);
+        printf("Level %d: ", level++);
 
         // Process each node in the current level
         for (int i = 0; i < current_level_size; i++) {
-            node *current = queue[front++];
+            if (pinPage(mgmt->pool, &current, queue[front++]) != RC_OK) {
+                free(queue);
+                return;
+            }
 
             // Print the keys in the current node
             printf("Node: ");
-            for (int j = 0; j < current->num_keys; j++) {
-                printf("%d ", current->keys[j].v.intV);
-                printf("(Page and Slot: [%d, %d]) ", current->rids[j].page, current->rids[j].slot);
+            for (int j = 0; j < header(&current)->num_keys; j++) {
+                printKey(meta_data, nodeKey(meta_data, &current, j));
+                printf(" ");
+                if (header(&current)->is_leaf) {
+                    RID *rids = nodeRids(meta_data, &current);
+                    printf("(Page and Slot: [%d, %d]) ", rids[j].page, rids[j].slot);
+                }
             }
             printf("| ");
 
             // Enqueue the child nodes (if any)
-            if (!current->is_leaf) {
-                for (int j = 0; j <= current->num_keys; j++) {
-                    queue[rear++] = (node *)current->ptrs[j];
+            if (!header(&current)->is_leaf) {
+                PageNumber *children = nodeChildren(meta_data, &current);
+                for (int j = 0; j <= header(&current)->num_keys; j++) {
+                    queue[rear++] = children[j];
                 }
             }
+            unpinPage(mgmt->pool, &current);
         }
 
         printf("\n");
@@ -69,93 +371,145 @@ RC shutdownIndexManager(void *mgmtData) {
     return RC_OK;
 }
 
-void * createNode(int n, bool is_leaf, bool is_root) {
-    node * newNode = (node *) malloc(sizeof(node));
-    newNode->keys = (Value *) malloc(sizeof(struct Value) * n); // Fixed DT_INT // [(int), (int), .... , n]
-    newNode->ptrs = (void **) malloc(sizeof(void *) * (n + 1)); // No. of pointers will always be +1 than No. of Keys
-    newNode->rids = (RID *) malloc(sizeof(struct RID) * (n + 1));
-    newNode->num_keys = 0;
-    newNode->is_leaf = is_leaf;
-    newNode->next_leaf = NULL;
-    newNode->parent = NULL;
-    newNode->is_root = is_root;
-    newNode->max_keys_per_node = n;
-    newNode->max_ptrs_per_node = n + 1;
-    return newNode;
-}
-
 RC createBtree(char *idxId, DataType keyType, int n) {
-    // Initialize a new pagefile for holding the index
-    createPageFile(idxId); // creates pagefile, writes /0' bytes, closes pagefile
-
-    metaData *meta_data = (metaData *) malloc(sizeof(metaData));
-    meta_data->order = n; // Setting the order
-    meta_data->type = keyType; // Setting the keytype for the key
-    meta_data->entries = 0; // Sum of all entries inside all the nodes
-
-    node *root = createNode(meta_data->order,true, true); // This node is a root, which is by default a leaf as well.
-    meta_data->root = root;
-    meta_data->nodes = 1; // ROOT node
-
-    // Need to write this data to the 1st (0th index) page of the file.
-    // createPageFile already initialized the page by setting '/0' bytes
-    SM_FileHandle file_handle;
-    openPageFile(idxId, &file_handle);
-
-    // How do we store it?
-    // Serialize it, then deserialize it, making use of the struct
-    // OR
-    // Make use of offsets, fixed like PAGE_SIZE to logically partition page
+    int length = BTREE_STRING_KEY_LENGTH;
+    return createBtreeWithKey(idxId, 1, &keyType, &length, n);
+}
 
-    //Serialize -> Deserialize approach
+// Create an index over the key attributes of a table
+RC createBtreeForSchema(char *idxId, Schema *schema, int n) {
+    DataType keyTypes[BTREE_MAX_KEY_ATTRS];
+    int keyLengths[BTREE_MAX_KEY_ATTRS];
 
-    writeBlock(0,&file_handle,meta_data);
+    if (schema->keySize < 1 || schema->keySize > BTREE_MAX_KEY_ATTRS) {
+        return RC_IM_KEY_TOO_LONG;
+    }
+    for (int i = 0; i < schema->keySize; i++) {
+        keyTypes[i] = schema->dataTypes[schema->keyAttrs[i]];
+        keyLengths[i] = schema->typeLength[schema->keyAttrs[i]];
+    }
+    return createBtreeWithKey(idxId, schema->keySize, keyTypes, keyLengths, n);
+}
 
-    // no need to check if the struct size is larger than PAGE_SIZE here,
-    // as the test cases are guaranteed to be small
+RC createBtreeWithKey(char *idxId, int numAttrs, DataType *keyTypes, int *keyLengths, int n) {
+    BTreeMgmtData mgmt;
 
-    // Data has been written to the first page now
-    // Clean up
+    if (numAttrs < 1 || numAttrs > BTREE_MAX_KEY_ATTRS) {
+        return RC_IM_KEY_TOO_LONG;
+    }
+    mgmt.meta.numKeyAttrs = numAttrs;
+    mgmt.meta.keySize = 0;
+    for (int i = 0; i < numAttrs; i++) {
+        int length;
+        switch (keyTypes[i]) {
+            case DT_INT:
+            case DT_FLOAT:
+                length = 4;
+                break;
+            case DT_BOOL:
+                length = 1;
+                break;
+            case DT_STRING:
+                length = keyLengths != NULL ? keyLengths[i] : 0;
+                if (length < 1)
+                    return RC_IM_KEY_TOO_LONG;
+                break;
+            default:
+                return RC_RM_UNKOWN_DATATYPE;
+        }
+        mgmt.meta.keyTypes[i] = keyTypes[i];
+        mgmt.meta.keyLengths[i] = length;
+        mgmt.meta.keySize += length;
+    }
+    if (mgmt.meta.keySize > BTREE_MAX_KEY_SIZE) {
+        return RC_IM_KEY_TOO_LONG;
+    }
+    if (n < 1 || nodeSize(n, mgmt.meta.keySize) > PAGE_SIZE) {
+        return RC_IM_N_TO_LAGE;
+    }
 
-    free(meta_data);
-    closePageFile(&file_handle);
+    // Initialize a new pagefile for holding the index, page 0 is the metadata
+    RC rc = createPageFile(idxId);
+    if (rc != RC_OK)
+        return rc;
 
-    return RC_OK;
+    mgmt.pool = MAKE_POOL();
+    rc = initBufferPool(mgmt.pool, idxId, BTREE_POOL_SIZE, RS_CLOCK, NULL);
+    if (rc != RC_OK) {
+        free(mgmt.pool);
+        return rc;
+    }
+    pthread_mutex_init(&mgmt.allocLatch, NULL);
+
+    mgmt.meta.order = n; // Setting the order
+    mgmt.meta.type = keyTypes[0]; // Setting the keytype for the key
+    mgmt.meta.entries = 0; // Sum of all entries inside all the nodes
+    mgmt.meta.nodes = 0;
+    mgmt.meta.numPages = 1;
+    mgmt.meta.freePages = NO_PAGE;
+
+    // The root is by default a leaf as well
+    BM_PageHandle root;
+    rc = createNode(&mgmt, true, &root);
+    if (rc == RC_OK) {
+        mgmt.meta.root = root.pageNum;
+        unpinPage(mgmt.pool, &root);
+        rc = writeMetaData(&mgmt);
+    }
 
+    RC shutdownRc = shutdownBufferPool(mgmt.pool);
+    free(mgmt.pool);
+    pthread_mutex_destroy(&mgmt.allocLatch);
+    return rc != RC_OK ? rc : shutdownRc;
 }
 
+// The nodes of an open tree are read through a CLOCK pool, which pins
+// resident pages without taking the pool's latch
 RC openBtree(BTreeHandle **tree, char *idxId) {
+    BTreeMgmtData *mgmt = (BTreeMgmtData *) malloc(sizeof(BTreeMgmtData));
+    char *fileName = strdup(idxId); // The pool keeps a pointer to the name
+    mgmt->pool = MAKE_POOL();
+    RC rc = initBufferPool(mgmt->pool, fileName, BTREE_POOL_SIZE, RS_CLOCK, NULL);
+    if (rc == RC_OK) {
+        rc = readMetaData(mgmt);
+        if (rc != RC_OK)
+            shutdownBufferPool(mgmt->pool);
+    }
+    if (rc != RC_OK) {
+        free(mgmt->pool);
+        free(mgmt);
+        free(fileName);
+        return rc;
+    }
 
-    SM_FileHandle file_handle;
-    openPageFile(idxId, &file_handle);
-    metaData *meta_data = (metaData *) malloc(sizeof(metaData));
-    readBlock(0, &file_handle, meta_data);
+    pthread_mutex_init(&mgmt->rootLatch, NULL);
+    pthread_mutex_init(&mgmt->allocLatch, NULL);
+    mgmt->rootVersion = 0;
 
     *tree = (BTreeHandle *) malloc(sizeof(BTreeHandle));
-    (*tree)->idxId = idxId; // Storing filename in BTreeHandle
-    (*tree)->mgmtData = meta_data;
-
-    // Debugging code to check if data is correctly pointed by *tree
-    // metaData *meta = (metaData *) (*tree)->mgmtData;
-    // printf("Metadata: Order = %d, Entries = %d\n", meta->order, meta->entries);
-
-
-    // printf("%d\n",btree->mgmtData);
-
-
-    closePageFile(&file_handle);
+    (*tree)->idxId = fileName; // Storing filename in BTreeHandle
+    (*tree)->keyType = mgmt->meta.type;
+    (*tree)->mgmtData = mgmt;
     return RC_OK;
 }
 
 RC closeBtree(BTreeHandle *tree) {
-    printf("We are closing Btree!!!\n");
+    BTreeMgmtData *mgmt = treeData(tree);
+
+    // Write the metadata back and flush every dirty node
+    RC rc = writeMetaData(mgmt);
+    RC shutdownRc = shutdownBufferPool(mgmt->pool);
+    free(mgmt->pool);
+    pthread_mutex_destroy(&mgmt->rootLatch);
+    pthread_mutex_destroy(&mgmt->allocLatch);
+    free(mgmt);
+    free(tree->idxId);
     free(tree);
-    return RC_OK;
+    return rc != RC_OK ? rc : shutdownRc;
 }
 
 // Delete a B+ Tree index
 RC deleteBtree(char *idxId) {
-    printf("We are deleting Btree!!!\n");
     if(remove(idxId)!=0)        //check whether the name exists
         return RC_FILE_NOT_FOUND;
     return RC_OK;
@@ -163,19 +517,17 @@ RC deleteBtree(char *idxId) {
 
 // Get the number of nodes in the B+ Tree
 RC getNumNodes(BTreeHandle *tree, int *result) {
-    metaData *meta_data = (metaData *)tree->mgmtData;
-    printf("Current numNodes: %d\n", meta_data->nodes);  // Debugging output (only in DEBUG mode)
-
+    metaData *meta_data = &treeData(tree)->meta;
     *result = meta_data->nodes;
     return RC_OK;
 }
 
 // Get the number of entries in the B+ Tree
 RC getNumEntries(BTreeHandle *tree, int *result) {
-    metaData *meta_data = (metaData *)tree->mgmtData;
+    metaData *meta_data = &treeData(tree)->meta;
     // printf("Current Entries: %d\n", meta_data->entries);  // Debugging output (only in DEBUG mode)
 
-    *result = meta_data->entries;
+    *result = __atomic_load_n(&meta_data->entries, __ATOMIC_RELAXED);
     return RC_OK;
 }
 
@@ -187,480 +539,873 @@ RC getKeyType(BTreeHandle *tree, DataType *result) {
     return RC_OK;
 }
 
-int compareKeys(Value *key1, Value *key2) {
-    if (key1->v.intV < key2->v.intV) return -1;
-    if (key1->v.intV > key2->v.intV) return 1;
-    return 0;
+// Binary search over the sorted keys of a node. Both return a position in
+// 0..num: lowerBound the first key >= key, upperBound the first key > key.
+// The loop body is a conditional move rather than a branch, so the cost
+// does not depend on how well the comparisons can be predicted.
+static int lowerBound(const char *keys, int num, const char *key, int keySize) {
+    const char *base = keys;
+    int n = num;
+    if (n == 0)
+        return 0;
+    while (n > 1) {
+        int half = n / 2;
+        base = (memcmp(base + half * keySize, key, keySize) < 0) ? base + half * keySize : base;
+        n -= half;
+    }
+    return (base - keys) / keySize + (memcmp(base, key, keySize) < 0);
 }
 
-// Find a key in the B+ Tree
-RC findKey(BTreeHandle *tree, Value *key, RID *result) {
-    // First get the root, as it the starting point for our search
-    metaData *meta_data = (metaData *)tree->mgmtData;
-    node *current_node = meta_data->root;
-
-    // 1. Traverse the tree to find the appropriate leaf node
-    while (!current_node->is_leaf) {
-        // Traverse internal nodes, find the correct child pointer to follow
-        int i = 0;
-        while (i < current_node->num_keys && compareKeys(key, &current_node->keys[i]) >= 0) { // compareKeys(k1,k2) - k1>k2 -> return 1 || k1 < k2 -> return -1
-            i++;
-        }
-        current_node = (node *)current_node->ptrs[i];
+static int upperBound(const char *keys, int num, const char *key, int keySize) {
+    const char *base = keys;
+    int n = num;
+    if (n == 0)
+        return 0;
+    while (n > 1) {
+        int half = n / 2;
+        base = (memcmp(base + half * keySize, key, keySize) <= 0) ? base + half * keySize : base;
+        n -= half;
     }
-    for(int j = 0; j < current_node->num_keys; j++) {
-        if(compareKeys(key, &current_node->keys[j]) == 0) {
-            *result = current_node->rids[j];
-            return RC_OK;
-        }
-    }
-    return RC_IM_KEY_NOT_FOUND;
+    return (base - keys) / keySize + (memcmp(base, key, keySize) <= 0);
 }
 
-
-void sortKeys(Value *key, void **ptr, RID * rids, int size) {
-    for (int i = 0; i < size - 1; i++) {
-        for (int j = 0; j < size - i - 1; j++) {
-            if (key[j].v.intV > key[j + 1].v.intV) {
-                // Swap the keys
-                Value temp_key = key[j];
-                key[j] = key[j + 1];
-                key[j + 1] = temp_key;
-
-                // Swap the pointers
-                void *temp_ptr = ptr[j];
-                ptr[j] = ptr[j + 1];
-                ptr[j + 1] = temp_ptr;
-
-                // Swap the rid
-                RID temp_rid = rids[j];
-                rids[j] = rids[j + 1];
-                rids[j + 1] = temp_rid;
+// Descend from the root to the leaf that covers key, or to the first leaf
+// if key is NULL, without latching anything. The leaf is returned pinned
+// with the version its contents have to be validated against. Every child
+// pointer is followed only once its node is validated, and the node is
+// validated again after the child's version was read, so a descent that
+// overlaps a writer starts over instead of going astray.
+static RC optimisticLeaf(BTreeMgmtData *mgmt, const char *key, BM_PageHandle *leaf, unsigned int *version) {
+    metaData *meta_data = &mgmt->meta;
+    BM_PageHandle child;
+    unsigned int childVersion;
+
+    for (int attempt = 0;; attempt++) {
+        if (attempt > 0) {
+            sched_yield();
+        }
+        unsigned int rootVersion = __atomic_load_n(&mgmt->rootVersion, __ATOMIC_ACQUIRE);
+        RC rc = pinPage(mgmt->pool, leaf, __atomic_load_n(&meta_data->root, __ATOMIC_ACQUIRE));
+        if (rc != RC_OK)
+            return rc;
+        bool valid = readLockNode(leaf, version)
+                     && __atomic_load_n(&mgmt->rootVersion, __ATOMIC_ACQUIRE) == rootVersion;
+        while (valid && !header(leaf)->is_leaf) {
+            // Traverse internal nodes, child i holds the keys in [keys[i-1], keys[i])
+            int i = key == NULL ? 0 : upperBound(nodeKeys(leaf), optimisticNumKeys(meta_data, leaf), key, meta_data->keySize);
+            PageNumber childPage = nodeChildren(meta_data, leaf)[i];
+            if (!validateNode(leaf, *version)) {
+                valid = false;
+                break;
             }
+            rc = pinPage(mgmt->pool, &child, childPage);
+            if (rc != RC_OK) {
+                unpinPage(mgmt->pool, leaf);
+                return rc;
+            }
+            valid = readLockNode(&child, &childVersion) && validateNode(leaf, *version);
+            unpinPage(mgmt->pool, leaf);
+            *leaf = child;
+            *version = childVersion;
         }
+        if (valid)
+            return RC_OK;
+        unpinPage(mgmt->pool, leaf);
     }
 }
 
-void sortParent(Value *key, void **ptr, int size) {
-    for (int i = 0; i < size - 1; i++) {
-        for (int j = 0; j < size - i - 1; j++) {
-            if (key[j].v.intV > key[j + 1].v.intV) {
-
-                Value temp_key = key[j];
-                key[j] = key[j + 1];
-                key[j + 1] = temp_key;
+// Position of key in a leaf, -1 if it is not there
+static int findInLeaf(metaData *meta, BM_PageHandle *leaf, const char *key) {
+    int num = optimisticNumKeys(meta, leaf);
+    int pos = lowerBound(nodeKeys(leaf), num, key, meta->keySize);
+    return (pos < num && memcmp(nodeKey(meta, leaf, pos), key, meta->keySize) == 0) ? pos : -1;
+}
 
-                // ptr swap is a bit different for parent than for leaf nodes
-                void *temp_ptr = ptr[j + 1];
-                ptr[j + 1] = ptr[j + 2];
-                ptr[j + 2] = temp_ptr;
-            }
+// Find a key in the B+ Tree
+RC findKey(BTreeHandle *tree, Value *key, RID *result) {
+    BTreeMgmtData *mgmt = treeData(tree);
+    char encoded[BTREE_MAX_KEY_SIZE];
+    BM_PageHandle leaf;
+    unsigned int version;
+    RID rid;
+
+    RC rc = encodeKey(&mgmt->meta, key, encoded);
+    if (rc != RC_OK)
+        return rc;
+    for (;;) {
+        rc = optimisticLeaf(mgmt, encoded, &leaf, &version);
+        if (rc != RC_OK)
+            return rc;
+        int pos = findInLeaf(&mgmt->meta, &leaf, encoded);
+        if (pos >= 0) {
+            rid = nodeRids(&mgmt->meta, &leaf)[pos];
+        }
+        bool valid = validateNode(&leaf, version);
+        unpinPage(mgmt->pool, &leaf);
+        if (valid) {
+            if (pos >= 0)
+                *result = rid;
+            return pos >= 0 ? RC_OK : RC_IM_KEY_NOT_FOUND;
         }
     }
 }
 
-void sortParentWhenSpace(Value *key, void **ptr, int size) {
-    for (int i = 0; i < size - 1; i++) {
-        for (int j = 0; j < size - i - 1; j++) {
-            if (key[j].v.intV > key[j + 1].v.intV) {
+// Release every latch a writer holds, see latchLeaf
+static RC releaseLatches(BTreeMgmtData *mgmt, WriteLatches *latches, bool changed) {
+    RC rc = RC_OK;
+    for (int i = 0; i < latches->count; i++) {
+        RC unlatchRc = unlatchNode(mgmt, &latches->node[i], changed);
+        if (rc == RC_OK)
+            rc = unlatchRc;
+    }
+    latches->count = 0;
+    if (latches->rootLatched) {
+        pthread_mutex_unlock(&mgmt->rootLatch);
+        latches->rootLatched = false;
+    }
+    return rc;
+}
 
-                Value temp_key = key[j];
-                key[j] = key[j + 1];
-                key[j + 1] = temp_key;
+// Whether a change in a child of node stops at node: an insert splits it
+// only when it is full, a delete takes a key out of it only when it is at
+// the minimum. The root is at its minimum with one key left.
+static bool nodeIsSafe(metaData *meta, BM_PageHandle *node, bool inserting, bool isRoot) {
+    int num = header(node)->num_keys;
+    if (inserting)
+        return num < meta->order;
+    if (header(node)->is_leaf)
+        return isRoot || num > (meta->order + 1) / 2;
+    return num > (isRoot ? 1 : meta->order / 2);
+}
 
-                // ptr swap is a bit different for parent than for leaf nodes
-                void *temp_ptr = ptr[j + 1];
-                ptr[j + 1] = ptr[j + 2];
-                ptr[j + 2] = temp_ptr;
-            }
+// Descend to the leaf that covers key as a writer, latching every node on
+// the way before reading it. Once a node is safe for the change, the
+// latches above it are released unchanged, so a writer ends up holding the
+// leaf and only the ancestors a split or merge can reach; rootLatch is kept
+// while the root itself may be replaced. Latched nodes are always taken
+// parent first, which keeps writers from deadlocking. The internal nodes
+// passed are stored in path, root first, for the way back up.
+static RC latchLeaf(BTreeMgmtData *mgmt, const char *key, bool inserting, WriteLatches *latches,
+                    PageNumber *path, int *depth) {
+    metaData *meta_data = &mgmt->meta;
+    BM_PageHandle node;
+
+    pthread_mutex_lock(&mgmt->rootLatch);
+    latches->rootLatched = true;
+    latches->count = 0;
+    *depth = 0;
+    RC rc = pinPage(mgmt->pool, &node, meta_data->root);
+    while (rc == RC_OK) {
+        writeLockNode(&node);
+        if (nodeIsSafe(meta_data, &node, inserting, *depth == 0)) {
+            releaseLatches(mgmt, latches, false);
+        }
+        latches->node[latches->count++] = node;
+        if (header(&node)->is_leaf)
+            return RC_OK;
+        if (*depth >= BTREE_MAX_HEIGHT) {
+            rc = RC_IM_N_TO_LAGE;
+            break;
         }
+        int i = upperBound(nodeKeys(&node), header(&node)->num_keys, key, meta_data->keySize);
+        path[(*depth)++] = node.pageNum;
+        rc = pinPage(mgmt->pool, &node, nodeChildren(meta_data, &node)[i]);
     }
+    releaseLatches(mgmt, latches, false);
+    return rc;
 }
 
-void insertIntoParent(node *parent,node *self, node *current_node, Value *key, RID rid, metaData *meta_data) {
-
-    // When parent has space available
-    if(parent->num_keys < parent->max_keys_per_node) {
-
-        int numKeys = parent->num_keys;
-        parent->keys[numKeys] = self->keys[numKeys-1];
-        // parent->ptrs[numKeys+1] = (void *)(&rid);
-        parent->ptrs[numKeys+1] = self;
-        parent->rids[numKeys] = rid;
-        parent->num_keys++;
-        sortParentWhenSpace(parent->keys, parent->ptrs, numKeys + 1);
-        // meta_data->root->ptrs[current_node->num_keys] = self;
-    }
-    else {
-        if(parent->max_keys_per_node % 2 == 0) {
-            // If order (n) is even, take the mid as your new root
-            // We need to sort first, then swap the values, then create new root with mid
-            Value *temp_key = (Value *) malloc(sizeof(struct Value) * parent->max_keys_per_node + 1);
-            void ** temp_ptr = (void **) malloc(sizeof(void *) * (parent->max_keys_per_node + 2));
-            int local_num_keys = 0;
-
-            // ---------- DEBUGGING ------------- //
-            // printf("\nSelf Node before insertion 1\n");
-            // for(int k = 0; k < self->num_keys; k++) {
-            //     printf("%d\n", self->keys[k].v.intV);
-            // }
-            // ---------- DEBUGGING ------------- //
-
-            // ---------- DEBUGGING ------------- //
-            // printf("\nParent Node before insertion of 1\n");
-            // for(int k = 0; k < parent->num_keys; k++) {
-            //     printf("%d\n", parent->keys[k].v.intV);
-            // }
-            // ---------- DEBUGGING ------------- //
-            // temp[0], temp[1] <-- parent[0], parent[1]
-            for (int i = 0; i < parent->num_keys; i++) {
-                temp_key[i] = parent->keys[i];
-                temp_ptr[i] = parent->ptrs[i];
-                local_num_keys += 1;
-            }
-            temp_ptr[parent->num_keys] = parent->ptrs[parent->num_keys];
-
-            temp_key[local_num_keys] = self->keys[0];
-            temp_ptr[local_num_keys + 1] = self;
-            local_num_keys += 1;
-
-            // ---------- DEBUGGING ------------- //
-            // printf("\ntemp_key:\n");
-            // for(int k = 0; k < local_num_keys; k++) {
-            //     printf("%d\n", temp_key[k].v.intV);
-            // }
-            // ---------- DEBUGGING ------------- //
-
-            // Incorrect key is being sent to the parent here. Need to fix this.
-
-            sortParent(temp_key, temp_ptr, parent->num_keys+1);
-
-            // ---------- DEBUGGING ------------- //
-            // printf("\ntemp_key after sorting:\n");
-            // for(int k = 0; k < local_num_keys; k++) {
-            //     printf("%d\n", temp_key[k].v.intV);
-            // }
-            // ---------- DEBUGGING ------------- //
-
-            int mid = parent->num_keys / 2;
-            for (int i = 0; i < mid + 1; i++) {
-                parent->keys[i] = temp_key[i];
-                parent->ptrs[i] = temp_ptr[i];
-            }
-            // self->keys[0] = temp_key[mid + 1];
-            // self->ptrs[0] = temp_ptr[mid + 1];
-
-            // [Parent] [Self]
-            // [13, 17] [23]
+// Add separator key with right as the child after it to the internal node
+// at path[level], splitting upwards while nodes overflow. left is the node
+// that was split; a split of the root (level < 0) grows a new root. The
+// writer holds the latches of every node this reaches.
+static RC insertIntoParent(BTreeMgmtData *mgmt, PageNumber *path, int level, const char *key,
+                           PageNumber left, PageNumber right) {
+    metaData *meta_data = &mgmt->meta;
+    int keySize = meta_data->keySize;
+    BM_PageHandle parent, sibling;
+    RC rc;
+
+    if (level < 0) {
+        rc = createNode(mgmt, false, &parent);
+        if (rc != RC_OK)
+            return rc;
+        memcpy(nodeKey(meta_data, &parent, 0), key, keySize);
+        nodeChildren(meta_data, &parent)[0] = left;
+        nodeChildren(meta_data, &parent)[1] = right;
+        header(&parent)->num_keys = 1;
+        setRoot(mgmt, parent.pageNum);
+        return unpinPage(mgmt->pool, &parent);
+    }
 
-            node *parent_sibling = createNode(parent->max_keys_per_node, false, false);
-            for(int i=mid+1;i < local_num_keys; i++) {
-                parent_sibling->keys[parent_sibling->num_keys] = temp_key[i + parent_sibling->num_keys];
-                parent_sibling->ptrs[parent_sibling->num_keys] = temp_ptr[i + parent_sibling->num_keys];
-                parent_sibling->num_keys++;
-            }
-            parent_sibling->ptrs[parent_sibling->num_keys] = temp_ptr[mid + 1 + parent_sibling->num_keys];
-            if (parent->is_root == true) {
-                node *new_root = createNode(meta_data->order,false, true);
-                meta_data->nodes++;
-                new_root->keys[0] = parent->keys[parent->num_keys - 1];
-                new_root->num_keys++;
-                new_root->ptrs[0] = parent;
-                new_root->ptrs[1] = parent_sibling;
-
-                parent->parent = new_root;
-                parent->ptrs[parent->num_keys] = NULL;
-                parent->num_keys -= 1;
-
-                parent_sibling->parent = new_root;
-                parent->is_root = false;
-
-                meta_data->root = new_root;
-            }
+    rc = pinPage(mgmt->pool, &parent, path[level]);
+    if (rc != RC_OK)
+        return rc;
+    // Shift the larger keys and the children after them up by one slot;
+    // a node has room for one key over the order until it is split
+    char *keys = nodeKeys(&parent);
+    PageNumber *children = nodeChildren(meta_data, &parent);
+    int numKeys = header(&parent)->num_keys;
+    int pos = upperBound(keys, numKeys, key, keySize);
+    memmove(keys + (pos + 1) * keySize, keys + pos * keySize, (numKeys - pos) * keySize);
+    memmove(&children[pos + 2], &children[pos + 1], (numKeys - pos) * sizeof(PageNumber));
+    memcpy(keys + pos * keySize, key, keySize);
+    children[pos + 1] = right;
+    header(&parent)->num_keys = ++numKeys;
+    markDirty(mgmt->pool, &parent);
+
+    if (numKeys <= meta_data->order) {
+        return unpinPage(mgmt->pool, &parent);
+    }
 
-        }
-        else if(parent->max_keys_per_node % 2 == 1) {
-            // If order (n) is even, take mid+1 as your new root
-        }
+    // Overflow: the middle key moves up, the keys after it go to a new node
+    rc = createNode(mgmt, false, &sibling);
+    if (rc != RC_OK) {
+        unpinPage(mgmt->pool, &parent);
+        return rc;
     }
+    int leftKeys = numKeys / 2;
+    char upKey[BTREE_MAX_KEY_SIZE];
+    memcpy(upKey, keys + leftKeys * keySize, keySize);
+    int moved = numKeys - (leftKeys + 1);
+    memcpy(nodeKeys(&sibling), keys + (leftKeys + 1) * keySize, moved * keySize);
+    memcpy(nodeChildren(meta_data, &sibling), &children[leftKeys + 1], (moved + 1) * sizeof(PageNumber));
+    header(&sibling)->num_keys = moved;
+    header(&parent)->num_keys = leftKeys;
+
+    PageNumber siblingPage = sibling.pageNum;
+    unpinPage(mgmt->pool, &sibling);
+    unpinPage(mgmt->pool, &parent);
+    return insertIntoParent(mgmt, path, level - 1, upKey, path[level], siblingPage);
 }
 
 // Insert key into the B+ Tree
 RC insertKey(BTreeHandle *tree, Value *key, RID rid) {
-    // printf("Inserting Key: %d\n", key->v.intV);
-
-    metaData *meta_data = (metaData *)tree->mgmtData;
-    node *current_node = meta_data->root;
+    BTreeMgmtData *mgmt = treeData(tree);
+    metaData *meta_data = &mgmt->meta;
+    int keySize = meta_data->keySize;
+    char encoded[BTREE_MAX_KEY_SIZE];
+    PageNumber path[BTREE_MAX_HEIGHT];
+    WriteLatches latches;
+    BM_PageHandle leaf, new_leaf;
+    int depth;
 
-    current_node->parent = current_node;
     // 1. Traverse the tree to find the appropriate leaf node where the key should be inserted
-    while (!current_node->is_leaf) {
-        // Traverse internal nodes, find the correct child pointer to follow
-        int i = 0;
-        while (i < current_node->num_keys && compareKeys(key, &current_node->keys[i]) >= 0) { // compareKeys(k1,k2) - k1>k2 -> return 1 || k1 < k2 -> return -1
-            i++;
-        }
-        current_node = (node *)current_node->ptrs[i];
+    RC rc = encodeKey(meta_data, key, encoded);
+    if (rc != RC_OK)
+        return rc;
+    rc = latchLeaf(mgmt, encoded, true, &latches, path, &depth);
+    if (rc != RC_OK)
+        return rc;
+    leaf = latches.node[latches.count - 1];
+    char *keys = nodeKeys(&leaf);
+    RID *rids = nodeRids(meta_data, &leaf);
+    int numKeys = header(&leaf)->num_keys;
+    int pos = lowerBound(keys, numKeys, encoded, keySize);
+    if (pos < numKeys && memcmp(keys + pos * keySize, encoded, keySize) == 0) {
+        releaseLatches(mgmt, &latches, false);
+        return RC_IM_KEY_ALREADY_EXISTS;
     }
 
-    // -------------------------------------------------------------------------------
-
-    // 2. Inserting
-    if (current_node->num_keys < current_node->max_keys_per_node) {
-        // Insert the new key and the corresponding pointer (RID)
-        int numKeys = current_node->num_keys;
-        current_node->keys[numKeys] = *key;
-        current_node->ptrs[numKeys] = (void *)(&rid);
-        current_node->rids[numKeys] = (rid);
-        current_node->num_keys++;
-        meta_data->entries++;
-
-        sortKeys(current_node->keys, current_node->ptrs, current_node->rids, current_node->num_keys);
-
-        // printTree(tree);
-        // for (int i = 0; i < current_node->num_keys; i++) {
-        //     printf("Page and Slot: %d and %d\n", current_node->rids[i].page, current_node->rids[i].slot);
-        // }
-        // printf("-=-=-=-=-=-=-=-=-=-=-=-=-\n");
-        return RC_OK;
+    // 2. Inserting the new key and the corresponding RID into its slot
+    memmove(keys + (pos + 1) * keySize, keys + pos * keySize, (numKeys - pos) * keySize);
+    memmove(&rids[pos + 1], &rids[pos], (numKeys - pos) * sizeof(RID));
+    memcpy(keys + pos * keySize, encoded, keySize);
+    rids[pos] = rid;
+    header(&leaf)->num_keys = ++numKeys;
+    __atomic_fetch_add(&meta_data->entries, 1, __ATOMIC_RELAXED);
+    markDirty(mgmt->pool, &leaf);
+
+    if (numKeys <= meta_data->order) {
+        return releaseLatches(mgmt, &latches, true);
     }
 
-    // -------------------------------------------------------------------------------
-
     // 3. If node is overflowed, creating new node (Splitting)
-    node *new_node = createNode(meta_data->order,true, false);
-    meta_data->nodes++;
-    new_node->parent = current_node->parent; // Fails if we have one leaf node and another root node // Fixed this by setting the parent of root as the parent itself, may cause recursion related errors??
-    // current_node->next_leaf = new_node;
-    // ----------------------------------------------------------------
-    // Add the new key in existing keys array, then sort, then split
-    // meta_data->Entries++ karna hai
-    // ----------------------------------------------------------------
-
-    int mid = current_node->max_keys_per_node / 2;
-    for (int i = mid + 1; i < current_node->num_keys; i++) {
-        new_node->keys[i - (mid + 1)] = current_node->keys[i];
-        new_node->ptrs[i - (mid + 1)] = current_node->ptrs[i];
-        new_node->rids[i - (mid + 1)] = current_node->rids[i];
-        new_node->num_keys++;
-        meta_data->entries++;
-
-        sortKeys(current_node->keys, current_node->ptrs, current_node->rids, current_node->num_keys);
-    }
-
-    if (compareKeys(key, &current_node->keys[mid]) >= 0) {
-        // Insert new key after copying
-        int insert_pos = new_node->num_keys;
-        new_node->keys[insert_pos] = *key;
-        new_node->ptrs[insert_pos] = (void *)(&rid);
-        new_node->rids[insert_pos] = (rid);
-        new_node->num_keys++;
-        meta_data->entries++;
-        sortKeys(new_node->keys, new_node->ptrs, new_node->rids, new_node->num_keys);
-    }
-    else { // This is when key < current_node key
-        Value *temp_key = (Value *) malloc(sizeof(struct Value) * current_node->max_keys_per_node + 1);
-        void ** temp_ptr = (void **) malloc(sizeof(void *) * (current_node->max_keys_per_node + 2));
-        RID *temp_rid = (RID *) malloc(sizeof(struct RID) * (current_node->max_keys_per_node + 2));
-        for (int i = 0; i < current_node->num_keys; i++) {
-            temp_key[i] = current_node->keys[i];
-            temp_ptr[i] = current_node->ptrs[i];
-            temp_rid[i] = current_node->rids[i];
-        }
-        temp_key[current_node->num_keys] = *key;
-        temp_ptr[current_node->num_keys] = (void *)(&rid);
-        temp_rid[current_node->num_keys] = (rid);
-
-        sortKeys(temp_key, temp_ptr, temp_rid, current_node->num_keys+1);
+    rc = createNode(mgmt, true, &new_leaf);
+    if (rc != RC_OK) {
+        releaseLatches(mgmt, &latches, true);
+        return rc;
+    }
+    int mid = meta_data->order / 2;
+    char *newKeys = nodeKeys(&new_leaf);
+    int moved = numKeys - (mid + 1);
+    memcpy(newKeys, keys + (mid + 1) * keySize, moved * keySize);
+    memcpy(nodeRids(meta_data, &new_leaf), &rids[mid + 1], moved * sizeof(RID));
+    header(&new_leaf)->num_keys = moved;
+    header(&leaf)->num_keys = mid + 1;
+
+    // Link the new leaf in after the old one
+    header(&new_leaf)->next_leaf = header(&leaf)->next_leaf;
+    header(&leaf)->next_leaf = new_leaf.pageNum;
+
+    char separator[BTREE_MAX_KEY_SIZE];
+    memcpy(separator, newKeys, keySize);
+    PageNumber leftPage = leaf.pageNum;
+    PageNumber rightPage = new_leaf.pageNum;
+    unpinPage(mgmt->pool, &new_leaf);
+    rc = insertIntoParent(mgmt, path, depth - 1, separator, leftPage, rightPage);
+    RC releaseRc = releaseLatches(mgmt, &latches, true);
+    return rc != RC_OK ? rc : releaseRc;
+}
 
-        for (int i = 0; i < mid + 1; i++) {
-            current_node->keys[i] = temp_key[i];
-            current_node->ptrs[i] = temp_ptr[i];
-            current_node->rids[i] = temp_rid[i];
+// Restore the minimum fill of node, pinned, after an entry was removed from
+// it. It borrows the nearest entry of a sibling that can spare one, or else
+// is merged with the sibling, which takes a separator out of the parent
+// that may then be short itself. path[depth - 1] is the parent of node. A
+// root left without keys is replaced by its only child. The writer holds
+// the latches of node and of the parents this reaches, the sibling is
+// latched here.
+static RC rebalance(BTreeMgmtData *mgmt, PageNumber *path, int depth, BM_PageHandle *node) {
+    metaData *meta_data = &mgmt->meta;
+    int keySize = meta_data->keySize;
+    bool isLeaf = header(node)->is_leaf;
+    int minKeys = isLeaf ? (meta_data->order + 1) / 2 : meta_data->order / 2;
+    BM_PageHandle parent, sibling;
+    RC rc;
+
+    if (depth == 0) {
+        if (!isLeaf && header(node)->num_keys == 0) {
+            setRoot(mgmt, nodeChildren(meta_data, node)[0]);
+            freeNode(mgmt, node);
         }
+        return unpinPage(mgmt->pool, node);
+    }
+    if (header(node)->num_keys >= minKeys) {
+        return unpinPage(mgmt->pool, node);
+    }
 
-        // for (int i = 0; i < current_node->num_keys; i++) {
-        //     printf("Current: %d\n",current_node->keys[i].v.intV);
-        // }
-
-        int insert_pos = new_node->num_keys;
-        new_node->keys[insert_pos] = temp_key[mid + 1];
-        new_node->ptrs[insert_pos] = (void *)(&rid);
-        new_node->rids[insert_pos] = temp_rid[mid + 1];
-        new_node->num_keys++;
-        meta_data->entries++;
-
-        // for (int i = 0; i < new_node->num_keys; i++) {
-        //     printf("New_node: %d\n",new_node->keys[i].v.intV);
-        // }
-    }
-
-    // We are not deleting entries from current_node->keys, hence limiting num_keys
-    current_node->num_keys = mid + 1;
-
-    // Current node after managing overflow
-    // ---------- DEBUGGING ------------- //
-    // printf("\nCurrent node after handling overflow insertion %d\n", key->v.intV);
-    // for(int k = 0; k < current_node->num_keys; k++) {
-    //     printf("%d\n", current_node->keys[k].v.intV);
-    // }
-    // ---------- DEBUGGING ------------- //
-    // if(new_node->keys[new_node->num_keys-1].v.intV < current_node->keys[0].v.intV) {
-    //     new_node->next_leaf = current_node;
-    // }
-    node *temp_ptr = current_node->next_leaf;
-    current_node->next_leaf = new_node;
-    new_node->next_leaf = temp_ptr;
-
-    if (current_node->is_root == true) {
-        node *new_root = createNode(meta_data->order,false, true);
-        meta_data->nodes++;
-        new_root->keys[0] = new_node->keys[0];
-        new_root->num_keys++;
-        new_root->ptrs[0] = current_node;
-        new_root->ptrs[1] = new_node;
+    rc = pinPage(mgmt->pool, &parent, path[depth - 1]);
+    if (rc != RC_OK) {
+        unpinPage(mgmt->pool, node);
+        return rc;
+    }
+    char *parentKeys = nodeKeys(&parent);
+    PageNumber *parentChildren = nodeChildren(meta_data, &parent);
+    int parentNum = header(&parent)->num_keys;
+    int idx = 0;
+    while (idx < parentNum && parentChildren[idx] != node->pageNum) {
+        idx++;
+    }
 
-        current_node->parent = new_root;
-        new_node->parent = new_root;
-        current_node->is_root = false;
+    // The left sibling if there is one, the first child only has a right one
+    bool fromLeft = idx > 0;
+    int sepIdx = fromLeft ? idx - 1 : idx;
+    rc = pinPage(mgmt->pool, &sibling, parentChildren[fromLeft ? idx - 1 : idx + 1]);
+    if (rc != RC_OK) {
+        unpinPage(mgmt->pool, &parent);
+        unpinPage(mgmt->pool, node);
+        return rc;
+    }
+    writeLockNode(&sibling);
+    char *separator = parentKeys + sepIdx * keySize;
+    char *keys = nodeKeys(node);
+    char *siblingKeys = nodeKeys(&sibling);
+    int num = header(node)->num_keys;
+    int siblingNum = header(&sibling)->num_keys;
+
+    if (siblingNum > minKeys) {
+        if (isLeaf) {
+            RID *rids = nodeRids(meta_data, node);
+            RID *siblingRids = nodeRids(meta_data, &sibling);
+            if (fromLeft) {
+                memmove(keys + keySize, keys, num * keySize);
+                memmove(&rids[1], rids, num * sizeof(RID));
+                memcpy(keys, siblingKeys + (siblingNum - 1) * keySize, keySize);
+                rids[0] = siblingRids[siblingNum - 1];
+                memcpy(separator, keys, keySize);
+            } else {
+                memcpy(keys + num * keySize, siblingKeys, keySize);
+                rids[num] = siblingRids[0];
+                memmove(siblingKeys, siblingKeys + keySize, (siblingNum - 1) * keySize);
+                memmove(siblingRids, &siblingRids[1], (siblingNum - 1) * sizeof(RID));
+                memcpy(separator, siblingKeys, keySize);
+            }
+        } else {
+            // Rotate: the separator moves down into node and the nearest
+            // key of the sibling takes its place, with the child between
+            PageNumber *children = nodeChildren(meta_data, node);
+            PageNumber *siblingChildren = nodeChildren(meta_data, &sibling);
+            if (fromLeft) {
+                memmove(keys + keySize, keys, num * keySize);
+                memmove(&children[1], children, (num + 1) * sizeof(PageNumber));
+                memcpy(keys, separator, keySize);
+                children[0] = siblingChildren[siblingNum];
+                memcpy(separator, siblingKeys + (siblingNum - 1) * keySize, keySize);
+            } else {
+                memcpy(keys + num * keySize, separator, keySize);
+                children[num + 1] = siblingChildren[0];
+                memcpy(separator, siblingKeys, keySize);
+                memmove(siblingKeys, siblingKeys + keySize, (siblingNum - 1) * keySize);
+                memmove(siblingChildren, &siblingChildren[1], siblingNum * sizeof(PageNumber));
+            }
+        }
+        header(node)->num_keys = num + 1;
+        header(&sibling)->num_keys = siblingNum - 1;
+        markDirty(mgmt->pool, node);
+        markDirty(mgmt->pool, &sibling);
+        markDirty(mgmt->pool, &parent);
+        unlatchNode(mgmt, &sibling, true);
+        unpinPage(mgmt->pool, &parent);
+        return unpinPage(mgmt->pool, node);
+    }
 
-        meta_data->root = new_root;
+    // Neither can spare an entry, together they fit into one node: merge
+    // the right one of the two into the left one
+    BM_PageHandle *left = fromLeft ? &sibling : node;
+    BM_PageHandle *right = fromLeft ? node : &sibling;
+    char *leftKeys = nodeKeys(left);
+    int leftNum = header(left)->num_keys;
+    int rightNum = header(right)->num_keys;
+    if (isLeaf) {
+        memcpy(leftKeys + leftNum * keySize, nodeKeys(right), rightNum * keySize);
+        memcpy(&nodeRids(meta_data, left)[leftNum], nodeRids(meta_data, right), rightNum * sizeof(RID));
+        header(left)->next_leaf = header(right)->next_leaf;
+        header(left)->num_keys = leftNum + rightNum;
+    } else {
+        memcpy(leftKeys + leftNum * keySize, separator, keySize);
+        memcpy(leftKeys + (leftNum + 1) * keySize, nodeKeys(right), rightNum * keySize);
+        memcpy(&nodeChildren(meta_data, left)[leftNum + 1], nodeChildren(meta_data, right),
+               (rightNum + 1) * sizeof(PageNumber));
+        header(left)->num_keys = leftNum + 1 + rightNum;
     }
+    markDirty(mgmt->pool, left);
+    freeNode(mgmt, right);
+    unlatchNode(mgmt, &sibling, true);
+    unpinPage(mgmt->pool, node);
+
+    // Drop the separator and the right node from the parent
+    memmove(separator, separator + keySize, (parentNum - sepIdx - 1) * keySize);
+    memmove(&parentChildren[sepIdx + 1], &parentChildren[sepIdx + 2], (parentNum - sepIdx - 1) * sizeof(PageNumber));
+    header(&parent)->num_keys = parentNum - 1;
+    markDirty(mgmt->pool, &parent);
+    return rebalance(mgmt, path, depth - 1, &parent);
+}
 
-    else {
-        insertIntoParent(new_node->parent,new_node,current_node, key, rid, meta_data);
-        // meta_data->root->ptrs[current_node->num_keys - 1] = new_node;
+RC deleteKey(BTreeHandle *tree, Value *key) {
+    BTreeMgmtData *mgmt = treeData(tree);
+    metaData *meta_data = &mgmt->meta;
+    int keySize = meta_data->keySize;
+    char encoded[BTREE_MAX_KEY_SIZE];
+    PageNumber path[BTREE_MAX_HEIGHT];
+    WriteLatches latches;
+    BM_PageHandle leaf;
+    int depth;
+
+    // 1. Traverse the tree to find the leaf node that holds the key
+    RC rc = encodeKey(meta_data, key, encoded);
+    if (rc != RC_OK)
+        return rc;
+    rc = latchLeaf(mgmt, encoded, false, &latches, path, &depth);
+    if (rc != RC_OK)
+        return rc;
+    leaf = latches.node[latches.count - 1];
+    int indexToRemove = findInLeaf(meta_data, &leaf, encoded);
+    if (indexToRemove < 0) {
+        releaseLatches(mgmt, &latches, false);
+        return RC_IM_KEY_NOT_FOUND;
     }
 
-    // printTree(tree);
-    return RC_OK;
+    // 2. Close the gap left by the key
+    char *keys = nodeKeys(&leaf);
+    RID *rids = nodeRids(meta_data, &leaf);
+    int following = header(&leaf)->num_keys - indexToRemove - 1;
+    memmove(keys + indexToRemove * keySize, keys + (indexToRemove + 1) * keySize, following * keySize);
+    memmove(&rids[indexToRemove], &rids[indexToRemove + 1], following * sizeof(RID));
+    header(&leaf)->num_keys--;
+    __atomic_fetch_sub(&meta_data->entries, 1, __ATOMIC_RELAXED);
+    markDirty(mgmt->pool, &leaf);
+
+    // 3. Borrow or merge if the leaf is less than half full now; rebalance
+    // releases a pin of its own, the latch keeps the one it came with
+    rc = pinPage(mgmt->pool, &leaf, leaf.pageNum);
+    if (rc == RC_OK)
+        rc = rebalance(mgmt, path, depth, &leaf);
+    RC releaseRc = releaseLatches(mgmt, &latches, true);
+    return rc != RC_OK ? rc : releaseRc;
 }
 
-void deleteKeyValue(node *node, Value *key) {
-    int key_value = key->v.intV;
-    int size = node->num_keys;
-    // Identify the element to be removed (1) and its index
-    int indexToRemove = -1;
-    for (int i = 0; i < size; i++) {
-        if (node->keys[i].v.intV == key_value) {
-            indexToRemove = i;
-            break;
+// Open a scan on the B+ Tree
+RC openTreeScan(BTreeHandle *tree, BT_ScanHandle **handle) {
+    return openTreeRangeScan(tree, NULL, false, NULL, false, handle);
+}
+
+// Pin the leaf the scan goes on in and find its position there: after the
+// key returned last, or at the lower bound before anything was returned.
+// Used when the scan is opened and whenever a writer changed the leaf
+// under it, which makes the scan look its position up again from the root.
+static RC positionScan(BTreeMgmtData *mgmt, ScanMetaData *scan_meta_data) {
+    metaData *meta_data = &mgmt->meta;
+    BM_PageHandle *leaf = &scan_meta_data->leaf;
+    const char *key = scan_meta_data->hasLast ? scan_meta_data->last
+                      : scan_meta_data->hasLow ? scan_meta_data->low : NULL;
+    bool inclusive = !scan_meta_data->hasLast && scan_meta_data->lowInclusive;
+
+    for (;;) {
+        RC rc = optimisticLeaf(mgmt, key, leaf, &scan_meta_data->leafVersion);
+        if (rc != RC_OK)
+            return rc;
+        int numKeys = optimisticNumKeys(meta_data, leaf);
+        int keyIndex = 0;
+        if (key != NULL) {
+            keyIndex = inclusive ? lowerBound(nodeKeys(leaf), numKeys, key, meta_data->keySize)
+                                 : upperBound(nodeKeys(leaf), numKeys, key, meta_data->keySize);
         }
+        if (validateNode(leaf, scan_meta_data->leafVersion)) {
+            scan_meta_data->leafPinned = true;
+            scan_meta_data->keyIndex = keyIndex;
+            return RC_OK;
+        }
+        unpinPage(mgmt->pool, leaf);
     }
+}
 
-    // If the element was found, swap it with the last element
-    if (indexToRemove != -1) {
-        // Swap the keys (values)
-        int temp_key = node->keys[indexToRemove].v.intV;
-        node->keys[indexToRemove].v.intV = node->keys[size - 1].v.intV;
-        node->keys[size - 1].v.intV = temp_key;
-
-        // Swap the pointers
-        void *temp_ptr = node->ptrs[indexToRemove];
-        node->ptrs[indexToRemove] = node->ptrs[size - 1];
-        node->ptrs[size - 1] = temp_ptr;
+// Open a scan over the keys between low and high. The scan descends
+// straight to the leaf holding the first key in range and stops at the
+// first key past high, so only the leaves of the range are read.
+RC openTreeRangeScan(BTreeHandle *tree, Value *low, bool lowInclusive,
+                     Value *high, bool highInclusive, BT_ScanHandle **handle) {
+    BTreeMgmtData *mgmt = treeData(tree);
+    RC rc;
+
+    ScanMetaData *scan_meta_data = (ScanMetaData *) malloc(sizeof(ScanMetaData));
+    scan_meta_data->leafPinned = false;
+    scan_meta_data->hasLast = false;
+    scan_meta_data->hasLow = low != NULL;
+    scan_meta_data->lowInclusive = lowInclusive;
+    scan_meta_data->hasHigh = high != NULL;
+    scan_meta_data->highInclusive = highInclusive;
+    if ((low != NULL && (rc = encodeKey(&mgmt->meta, low, scan_meta_data->low)) != RC_OK)
+        || (high != NULL && (rc = encodeKey(&mgmt->meta, high, scan_meta_data->high)) != RC_OK)
+        || (rc = positionScan(mgmt, scan_meta_data)) != RC_OK) {
+        free(scan_meta_data);
+        return rc;
+    }
 
-        // Swap the RIDs (if needed)
-        RID temp_rid = node->rids[indexToRemove];
-        node->rids[indexToRemove] = node->rids[size - 1];
-        node->rids[size - 1] = temp_rid;
+    *handle = (BT_ScanHandle *) malloc(sizeof(BT_ScanHandle));
+    (*handle)->tree = tree;
+    (*handle)->mgmtData = scan_meta_data;
 
-        // node->num_keys--;
-    }
+    return RC_OK;
 }
 
-RC deleteKey(BTreeHandle *tree, Value *key) {
-    // printf("-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=\nDeleting Key: %d\n", key->v.intV);
-
-    metaData *meta_data = (metaData *)tree->mgmtData;
-    node *current_node = meta_data->root;
+// Get the next entry in the scan
+RC nextEntry(BT_ScanHandle *handle, RID *result) {
+    return nextEntryWithKey(handle, NULL, result);
+}
 
-    // 1. Traverse the tree to find the appropriate leaf node where the key should be inserted
-    while (!current_node->is_leaf) {
-        // Traverse internal nodes, find the correct child pointer to follow
-        int i = 0;
-        while (i < current_node->num_keys && compareKeys(key, &current_node->keys[i]) >= 0) { // compareKeys(k1,k2) - k1>k2 -> return 1 || k1 < k2 -> return -1
-            i++;
+// Get the next entry in the scan together with its key, key may be NULL.
+// The leaf is read optimistically like in findKey; when a writer changed it
+// in the meantime the scan resumes after the last key it returned.
+RC nextEntryWithKey(BT_ScanHandle *handle, Value *key, RID *result) {
+    ScanMetaData *scan_meta_data = (ScanMetaData *) handle->mgmtData;
+    BTreeMgmtData *mgmt = treeData(handle->tree);
+    metaData *meta_data = &mgmt->meta;
+    int keySize = meta_data->keySize;
+    BM_PageHandle *leaf = &scan_meta_data->leaf;
+    char k[BTREE_MAX_KEY_SIZE];
+    RID rid;
+
+    for (;;) {
+        // When past the last element of the last node
+        if (!scan_meta_data->leafPinned) {
+            return RC_IM_NO_MORE_ENTRIES;
         }
-        current_node = (node *)current_node->ptrs[i];
+        unsigned int version = scan_meta_data->leafVersion;
+        if (scan_meta_data->keyIndex < optimisticNumKeys(meta_data, leaf)) {
+            memcpy(k, nodeKey(meta_data, leaf, scan_meta_data->keyIndex), keySize);
+            rid = nodeRids(meta_data, leaf)[scan_meta_data->keyIndex];
+            if (validateNode(leaf, version))
+                break;
+        } else {
+            // Move on along the leaf chain, skipping leaves without entries
+            PageNumber next = __atomic_load_n(&header(leaf)->next_leaf, __ATOMIC_RELAXED);
+            if (validateNode(leaf, version)) {
+                if (next == NO_PAGE) {
+                    unpinPage(mgmt->pool, leaf);
+                    scan_meta_data->leafPinned = false;
+                    return RC_IM_NO_MORE_ENTRIES;
+                }
+                BM_PageHandle nextLeaf;
+                unsigned int nextVersion;
+                RC rc = pinPage(mgmt->pool, &nextLeaf, next);
+                if (rc != RC_OK)
+                    return rc;
+                bool valid = readLockNode(&nextLeaf, &nextVersion) && validateNode(leaf, version);
+                unpinPage(mgmt->pool, leaf);
+                *leaf = nextLeaf;
+                scan_meta_data->leafVersion = nextVersion;
+                scan_meta_data->keyIndex = 0;
+                if (valid)
+                    continue;
+            }
+        }
+        // A writer changed the leaf since the scan read it
+        unpinPage(mgmt->pool, leaf);
+        scan_meta_data->leafPinned = false;
+        RC rc = positionScan(mgmt, scan_meta_data);
+        if (rc != RC_OK)
+            return rc;
     }
 
-    if (current_node->num_keys - 1 >= (int)(floor(current_node->max_keys_per_node+1)/2)) {
-        // printf("num_keys: %d\n", current_node->num_keys);
-        deleteKeyValue(current_node, key);
-        current_node->num_keys--;
-        meta_data->entries--;
-        sortKeys(current_node->keys, current_node->ptrs, current_node->rids, current_node->num_keys);
+    // Or past the upper bound; the leaf is released right away
+    if (scan_meta_data->hasHigh) {
+        int cmp = memcmp(k, scan_meta_data->high, keySize);
+        if (cmp > 0 || (cmp == 0 && !scan_meta_data->highInclusive)) {
+            unpinPage(mgmt->pool, leaf);
+            scan_meta_data->leafPinned = false;
+            return RC_IM_NO_MORE_ENTRIES;
+        }
     }
-    else if (current_node->num_keys -1 < (int)(floor(current_node->max_keys_per_node+1)/2)) {
-        // printf("num_keys: %d\n", current_node->num_keys);
-        deleteKeyValue(current_node, key);
-        current_node->num_keys--;
-        meta_data->entries--;
+
+    if (key != NULL) {
+        decodeKey(meta_data, k, key);
     }
-    // printf("num_keys: %d\n", current_node->num_keys);
-    // printTree(tree);
+    memcpy(scan_meta_data->last, k, keySize);
+    scan_meta_data->hasLast = true;
+    scan_meta_data->keyIndex++;
+    *result = rid;
+    return RC_OK;
+}
 
+// Close the scan on the B+ Tree
+RC closeTreeScan(BT_ScanHandle *handle) {
+    ScanMetaData *scan_meta_data = (ScanMetaData *) handle->mgmtData;
+    if (scan_meta_data->leafPinned) {
+        unpinPage(treeData(handle->tree)->pool, &scan_meta_data->leaf);
+    }
+    free(scan_meta_data);
+    free(handle);
     return RC_OK;
- }
+}
 
-// Open a scan on the B+ Tree
-RC openTreeScan(BTreeHandle *tree, BT_ScanHandle **handle) {
-    *handle = (BT_ScanHandle *) malloc(sizeof(BT_ScanHandle));
-    metaData *meta_data = (metaData *)tree->mgmtData;
-    ScanMetaData *scan_meta_data = (void *) malloc(sizeof(ScanMetaData));
+static RC bulkLoadSeparator(BTreeMgmtData *mgmt, BulkLoadMetaData *bulk, int level, const char *key,
+                            PageNumber left, PageNumber right);
 
-    node *current_node = meta_data->root;
-    while(!current_node->is_leaf) {
-        current_node = current_node->ptrs[0];
+// Start the next node of a bulk-loaded level once the current one is full.
+// key is the lowest key that will be under the new node, it separates the
+// two nodes in the level above.
+static RC bulkLoadNextNode(BTreeMgmtData *mgmt, BulkLoadMetaData *bulk, int level, const char *key) {
+    BM_PageHandle *full = &bulk->node[level];
+    BM_PageHandle next;
+
+    if (level + 1 >= BTREE_MAX_HEIGHT) {
+        return RC_IM_N_TO_LAGE;
+    }
+    RC rc = createNode(mgmt, level == 0, &next);
+    if (rc != RC_OK)
+        return rc;
+    if (level == 0) {
+        header(full)->next_leaf = next.pageNum;
+        markDirty(mgmt->pool, full);
     }
+    PageNumber left = full->pageNum;
+    bulk->prev[level] = left;
+    unpinPage(mgmt->pool, full);
+    bulk->node[level] = next;
+    return bulkLoadSeparator(mgmt, bulk, level + 1, key, left, next.pageNum);
+}
 
-    scan_meta_data->current_node = current_node;
-    scan_meta_data->keyIndex = 0;
-    (*handle)->mgmtData = scan_meta_data;
+// Append key and the child right after it to the rightmost node of level.
+// left is the child before right, it becomes the first child when the
+// level does not exist yet and a new root is started above the old one.
+static RC bulkLoadSeparator(BTreeMgmtData *mgmt, BulkLoadMetaData *bulk, int level, const char *key,
+                            PageNumber left, PageNumber right) {
+    metaData *meta_data = &mgmt->meta;
+    BM_PageHandle *node = &bulk->node[level];
+    RC rc;
+
+    if (level == bulk->levels) {
+        rc = createNode(mgmt, false, node);
+        if (rc != RC_OK)
+            return rc;
+        nodeChildren(meta_data, node)[0] = left;
+        bulk->prev[level] = NO_PAGE;
+        bulk->levels++;
+        meta_data->root = node->pageNum;
+    } else if (header(node)->num_keys == bulk->internalFill) {
+        // Full: right is the first child of the next node and key moves up
+        rc = bulkLoadNextNode(mgmt, bulk, level, key);
+        if (rc != RC_OK)
+            return rc;
+        nodeChildren(meta_data, node)[0] = right;
+        markDirty(mgmt->pool, node);
+        return RC_OK;
+    }
 
+    int numKeys = header(node)->num_keys;
+    memcpy(nodeKey(meta_data, node, numKeys), key, meta_data->keySize);
+    nodeChildren(meta_data, node)[numKeys + 1] = right;
+    header(node)->num_keys = numKeys + 1;
+    markDirty(mgmt->pool, node);
     return RC_OK;
 }
 
-// Get the next entry in the scan
-RC nextEntry(BT_ScanHandle *handle, RID *result) {
-    ScanMetaData *scan_meta_data = (ScanMetaData *) handle->mgmtData;
-    node *current_node = scan_meta_data->current_node;
+// Every node of a level but the rightmost one is packed to the fill factor,
+// the rightmost one holds what was left over. If that is less than the
+// minimum of a node, even it out with its left neighbour.
+static RC bulkLoadBalance(BTreeMgmtData *mgmt, BulkLoadMetaData *bulk, int level) {
+    metaData *meta_data = &mgmt->meta;
+    int keySize = meta_data->keySize;
+    BM_PageHandle *node = &bulk->node[level];
+    BM_PageHandle prev;
+    int minKeys = level == 0 ? (meta_data->order + 1) / 2 : meta_data->order / 2;
+
+    if (header(node)->num_keys >= minKeys || bulk->prev[level] == NO_PAGE) {
+        return RC_OK;
+    }
 
-    // When on last element of last node
-    if(current_node == NULL) {
-        return RC_IM_NO_MORE_ENTRIES;
+    // The separator in front of node is the last key of the lowest node
+    // above it that node is not the leftmost descendant of
+    int up = level + 1;
+    while (up < bulk->levels && nodeChildren(meta_data, &bulk->node[up])[0] == bulk->node[up - 1].pageNum) {
+        up++;
+    }
+    if (up == bulk->levels) {
+        return RC_OK;
     }
+    char *separator = nodeKey(meta_data, &bulk->node[up], header(&bulk->node[up])->num_keys - 1);
+
+    RC rc = pinPage(mgmt->pool, &prev, bulk->prev[level]);
+    if (rc != RC_OK)
+        return rc;
+    char *prevKeys = nodeKeys(&prev);
+    char *keys = nodeKeys(node);
+    int prevNum = header(&prev)->num_keys;
+    int num = header(node)->num_keys;
+
+    if (level == 0) {
+        // Move the last entries of prev to the front of the leaf
+        RID *prevRids = nodeRids(meta_data, &prev);
+        RID *rids = nodeRids(meta_data, node);
+        int moved = (prevNum + num) / 2 - num;
+        if (moved > 0) {
+            memmove(keys + moved * keySize, keys, num * keySize);
+            memmove(&rids[moved], rids, num * sizeof(RID));
+            memcpy(keys, prevKeys + (prevNum - moved) * keySize, moved * keySize);
+            memcpy(rids, &prevRids[prevNum - moved], moved * sizeof(RID));
+            header(&prev)->num_keys = prevNum - moved;
+            header(node)->num_keys = num + moved;
+            memcpy(separator, keys, keySize);
+        }
+    } else {
+        // Move the last children of prev over, rotating the keys through
+        // the separator
+        PageNumber *prevChildren = nodeChildren(meta_data, &prev);
+        PageNumber *children = nodeChildren(meta_data, node);
+        int moved = (prevNum + num + 2) / 2 - (num + 1);
+        if (moved > 0) {
+            memmove(keys + moved * keySize, keys, num * keySize);
+            memmove(&children[moved], children, (num + 1) * sizeof(PageNumber));
+            memcpy(keys + (moved - 1) * keySize, separator, keySize);
+            memcpy(keys, prevKeys + (prevNum - moved + 1) * keySize, (moved - 1) * keySize);
+            memcpy(children, &prevChildren[prevNum - moved + 1], moved * sizeof(PageNumber));
+            memcpy(separator, prevKeys + (prevNum - moved) * keySize, keySize);
+            header(&prev)->num_keys = prevNum - moved;
+            header(node)->num_keys = num + moved;
+        }
+    }
+    markDirty(mgmt->pool, &prev);
+    markDirty(mgmt->pool, node);
+    markDirty(mgmt->pool, &bulk->node[up]);
+    return unpinPage(mgmt->pool, &prev);
+}
 
-    // printf("++++++++++++++++++++++++++++++++++++++++++\n");
-    // for(int i=0; i < current_node->num_keys; i++) {
-    //     printf("%d\n", current_node->keys[i].v.intV);
-    // }
-    // printf("++++++++++++++++++++++++++++++++++++++++++\n");
-    // printf("KeyIndex: %d\n", scan_meta_data->keyIndex);
-    // printf("NumKeys: %d\n", current_node->num_keys);
+// Start building an empty tree from entries that arrive in ascending key
+// order. Leaves are filled one after the other and the internal levels grow
+// above them, so every node is written once and the pages of the index file
+// are appended in order; no node is ever split.
+RC startBulkLoad(BTreeHandle *tree, float fillFactor, BT_BulkLoadHandle **handle) {
+    BTreeMgmtData *mgmt = treeData(tree);
+    metaData *meta_data = &mgmt->meta;
+    BM_PageHandle root;
+
+    if (meta_data->entries != 0) {
+        return RC_IM_TREE_NOT_EMPTY;
+    }
+    RC rc = pinPage(mgmt->pool, &root, meta_data->root);
+    if (rc != RC_OK)
+        return rc;
+    if (!header(&root)->is_leaf) {
+        unpinPage(mgmt->pool, &root);
+        return RC_IM_TREE_NOT_EMPTY;
+    }
 
-    // When on last element of node
-    if(scan_meta_data->keyIndex == current_node->num_keys - 1) {
-        result->page = current_node->rids[scan_meta_data->keyIndex].page;
-        result->slot = current_node->rids[scan_meta_data->keyIndex].slot;
-        // printf("Page and Slot: %d and %d\n", result->page, result->slot);
+    if (!(fillFactor > 0 && fillFactor <= 1)) {
+        fillFactor = 1;
+    }
+    int fill = (int)(meta_data->order * fillFactor + 0.5f);
+    if (fill > meta_data->order)
+        fill = meta_data->order;
+    if (fill < 1)
+        fill = 1;
+
+    BulkLoadMetaData *bulk = (BulkLoadMetaData *) malloc(sizeof(BulkLoadMetaData));
+    bulk->leafFill = fill;
+    // An internal node with a single key could be left without any once
+    // the last node of its level is evened out
+    bulk->internalFill = (fill < 2 && meta_data->order >= 2) ? 2 : fill;
+    bulk->levels = 1;
+    bulk->node[0] = root; // The empty root leaf is the first leaf
+    bulk->prev[0] = NO_PAGE;
+    bulk->hasKey = false;
+
+    *handle = (BT_BulkLoadHandle *) malloc(sizeof(BT_BulkLoadHandle));
+    (*handle)->tree = tree;
+    (*handle)->mgmtData = bulk;
+    return RC_OK;
+}
 
-        scan_meta_data->current_node = current_node->next_leaf;
-        scan_meta_data->keyIndex = 0;
+// Append the next entry; its key has to be larger than all before it
+RC bulkLoadEntry(BT_BulkLoadHandle *handle, Value *key, RID rid) {
+    BulkLoadMetaData *bulk = (BulkLoadMetaData *) handle->mgmtData;
+    BTreeMgmtData *mgmt = treeData(handle->tree);
+    metaData *meta_data = &mgmt->meta;
+    int keySize = meta_data->keySize;
+    char encoded[BTREE_MAX_KEY_SIZE];
+
+    RC rc = encodeKey(meta_data, key, encoded);
+    if (rc != RC_OK)
+        return rc;
+    if (bulk->hasKey) {
+        int cmp = memcmp(encoded, bulk->lastKey, keySize);
+        if (cmp <= 0)
+            return cmp == 0 ? RC_IM_KEY_ALREADY_EXISTS : RC_IM_KEYS_NOT_SORTED;
     }
-    else if (scan_meta_data->keyIndex < current_node->num_keys - 1) {
-        result->page = current_node->rids[scan_meta_data->keyIndex].page;
-        result->slot = current_node->rids[scan_meta_data->keyIndex].slot;
-        // printf("Page and Slot: %d and %d\n", result->page, result->slot);
-        scan_meta_data->keyIndex++;
+    if (header(&bulk->node[0])->num_keys == bulk->leafFill) {
+        rc = bulkLoadNextNode(mgmt, bulk, 0, encoded);
+        if (rc != RC_OK)
+            return rc;
     }
+
+    BM_PageHandle *leaf = &bulk->node[0];
+    int numKeys = header(leaf)->num_keys;
+    memcpy(nodeKey(meta_data, leaf, numKeys), encoded, keySize);
+    nodeRids(meta_data, leaf)[numKeys] = rid;
+    header(leaf)->num_keys = numKeys + 1;
+    markDirty(mgmt->pool, leaf);
+    meta_data->entries++;
+    bulk->hasKey = true;
+    memcpy(bulk->lastKey, encoded, keySize);
     return RC_OK;
 }
 
-// Close the scan on the B+ Tree
-RC closeTreeScan(BT_ScanHandle *handle) {
+// Complete the tree: even out the rightmost node of every level, release
+// the nodes still pinned and write the metadata
+RC finishBulkLoad(BT_BulkLoadHandle *handle) {
+    BulkLoadMetaData *bulk = (BulkLoadMetaData *) handle->mgmtData;
+    BTreeMgmtData *mgmt = treeData(handle->tree);
+    RC rc = RC_OK;
+
+    for (int level = 0; level < bulk->levels - 1 && rc == RC_OK; level++) {
+        rc = bulkLoadBalance(mgmt, bulk, level);
+    }
+    for (int level = 0; level < bulk->levels; level++) {
+        unpinPage(mgmt->pool, &bulk->node[level]);
+    }
+    if (rc == RC_OK) {
+        rc = writeMetaData(mgmt);
+    }
+    free(bulk);
     free(handle);
-    return RC_OK;
+    return rc;
 }
-
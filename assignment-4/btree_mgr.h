@@ -1,8 +1,10 @@
 #ifndef BTREE_MGR_H
 #define BTREE_MGR_H
 
+#include <pthread.h>
 #include "dberror.h"
 #include "tables.h"
+#include "buffer_mgr.h"
 
 // structure for accessing btrees
 typedef struct BTreeHandle {
@@ -16,40 +18,93 @@ typedef struct BT_ScanHandle {
   void *mgmtData;
 } BT_ScanHandle;
 
+typedef struct BT_BulkLoadHandle {
+  BTreeHandle *tree;
+  void *mgmtData;
+} BT_BulkLoadHandle;
 
 
-typedef struct node {
-  Value * keys; // Array of keys
-  RID * rids;
-  void ** ptrs; // Array of pointers. Corresponding to keys with same index
-  int num_keys; // Number of keys currently present in the node
-  bool is_leaf; // Is the node an internal node or a leaf node?
-  struct node *next_leaf; // Pointer to the next leaf node, if this node is indeed a leaf node
-  struct node *parent; // Parent node for this node, NULL if no parent (Root)
-  bool is_root;
-  int max_keys_per_node;
-  int max_ptrs_per_node;
-} node;
 
+// Most attributes a key can be made of
+#define BTREE_MAX_KEY_ATTRS 8
+// Largest encoded key, in bytes
+#define BTREE_MAX_KEY_SIZE 256
+
+// Page 0 of an index file. Nodes live on the following pages and refer to
+// each other by page number, so the tree can be reopened and may grow
+// beyond memory; it is only accessed through its buffer pool.
 typedef struct metadata {
   int order; // Maximum number of keys allowed for a node
   int nodes; // Count for total existing nodes in the tree
   int entries; // Total number of entries in the index / tree
-  DataType type; // Datatype of the key, Default is DT_INT, extra implementation?
-  node *root; // Root of the tree
+  DataType type; // Datatype of the key, of its first attribute for a composite key
+  PageNumber root; // Page of the root node
+  int numPages; // Pages in the index file, metadata page included
+  int numKeyAttrs; // Attributes the key is made of
+  DataType keyTypes[BTREE_MAX_KEY_ATTRS];
+  int keyLengths[BTREE_MAX_KEY_ATTRS]; // Bytes of each attribute in an encoded key
+  int keySize; // Bytes of an encoded key, the sum of keyLengths
+  PageNumber freePages; // First node freed by a merge, NO_PAGE if none
 } metaData;
 
+// Header at the start of every node page. It is followed by room for
+// order + 1 encoded keys of keySize bytes, and then by one RID per key in
+// a leaf, or by num_keys + 1 child page numbers in an internal node.
+typedef struct nodeHeader {
+  int is_leaf; // Is the node an internal node or a leaf node?
+  int num_keys; // Number of keys currently present in the node
+  PageNumber next_leaf; // Page of the next leaf, NO_PAGE for the last leaf; of the next free node on the free list
+  unsigned int version; // Lock word: bit 0 freed, bit 1 held by a writer, changes counted above
+} nodeHeader;
+
+// State of an open tree: the cached metadata page and the pool of frames
+// the nodes are read through
+typedef struct BTreeMgmtData {
+  metaData meta;
+  BM_BufferPool *pool;
+  pthread_mutex_t rootLatch; // Held by writers that may replace the root
+  unsigned int rootVersion; // Bumped whenever meta.root changes
+  pthread_mutex_t allocLatch; // Guards meta.nodes, numPages and freePages
+} BTreeMgmtData;
+
 typedef struct ScanMetaData {
-  node *current_node;
+  BM_PageHandle leaf; // Leaf the scan is in, pinned while leafPinned
+  bool leafPinned;
+  unsigned int leafVersion; // Version of the leaf keyIndex was found in
   int keyIndex;
+  bool hasLow; // Scan starts at low, otherwise at the first leaf
+  bool lowInclusive;
+  char low[BTREE_MAX_KEY_SIZE]; // Encoded lower bound
+  bool hasHigh; // Scan ends at high, otherwise at the last leaf
+  bool highInclusive;
+  char high[BTREE_MAX_KEY_SIZE]; // Encoded upper bound
+  bool hasLast;
+  char last[BTREE_MAX_KEY_SIZE]; // Key returned last, the scan resumes after it when its leaf changed
 } ScanMetaData;
 
-// typedef struct scanMetaData {
-//   int key;
-//   int num_keys;
-//   int order;
-//   node * root;
-// } scanMetaData;
+// Deepest tree a descent can record; far beyond any reachable height
+#define BTREE_MAX_HEIGHT 64
+
+// Nodes a writer holds latched, root side first. Each is pinned for as
+// long as it is latched, so its version word stays in the pool.
+typedef struct WriteLatches {
+  bool rootLatched; // The writer holds rootLatch as well
+  int count;
+  BM_PageHandle node[BTREE_MAX_HEIGHT + 1];
+} WriteLatches;
+
+// State of a bulk load. The tree is built left to right, one level per
+// entry of the arrays: only the rightmost node of every level is being
+// filled, and it stays pinned until the next node of its level starts.
+typedef struct BulkLoadMetaData {
+  int leafFill; // Keys packed into a leaf before the next one is started
+  int internalFill; // Keys packed into an internal node
+  int levels; // Levels built so far, leaves are level 0
+  BM_PageHandle node[BTREE_MAX_HEIGHT]; // Rightmost node of each level, pinned
+  PageNumber prev[BTREE_MAX_HEIGHT]; // Its left neighbour, NO_PAGE if none
+  bool hasKey;
+  char lastKey[BTREE_MAX_KEY_SIZE]; // Last key loaded, entries have to ascend strictly
+} BulkLoadMetaData;
 
 // init and shutdown index manager
 extern RC initIndexManager (void *mgmtData);
@@ -57,6 +112,11 @@ extern RC shutdownIndexManager ();
 
 // create, destroy, open, and close an btree index
 extern RC createBtree (char *idxId, DataType keyType, int n);
+// keys made of several attributes are passed to the functions below as an
+// array of one Value per attribute. keyLengths holds the longest value of
+// each DT_STRING attribute and may be NULL otherwise.
+extern RC createBtreeWithKey (char *idxId, int numAttrs, DataType *keyTypes, int *keyLengths, int n);
+extern RC createBtreeForSchema (char *idxId, Schema *schema, int n);
 extern RC openBtree (BTreeHandle **tree, char *idxId);
 extern RC closeBtree (BTreeHandle *tree);
 extern RC deleteBtree (char *idxId);
@@ -74,6 +134,18 @@ extern RC openTreeScan (BTreeHandle *tree, BT_ScanHandle **handle);
 extern RC nextEntry (BT_ScanHandle *handle, RID *result);
 extern RC closeTreeScan (BT_ScanHandle *handle);
 
+// scan the keys between low and high, a NULL bound leaves that end open
+extern RC openTreeRangeScan (BTreeHandle *tree, Value *low, bool lowInclusive,
+                             Value *high, bool highInclusive, BT_ScanHandle **handle);
+// string keys returned by nextEntryWithKey are allocated, the caller frees them
+extern RC nextEntryWithKey (BT_ScanHandle *handle, Value *key, RID *result);
+
+// build an empty tree from entries sorted by key, packing each node to
+// fillFactor (0 < fillFactor <= 1) of the order
+extern RC startBulkLoad (BTreeHandle *tree, float fillFactor, BT_BulkLoadHandle **handle);
+extern RC bulkLoadEntry (BT_BulkLoadHandle *handle, Value *key, RID rid);
+extern RC finishBulkLoad (BT_BulkLoadHandle *handle);
+
 // debug and test functions
 // extern char *printTree (BTreeHandle *tree);
 
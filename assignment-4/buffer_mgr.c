@@ -1,11 +1,262 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include "dberror.h"
 #include "buffer_mgr.h"
 #include "buffer_mgr_stat.h"
 #include "storage_mgr.h"
 
+// Page table: chained hash index from page number to the frame holding it.
+// Chains are threaded through pageTableNext, so no allocation happens on pin.
+// It is changed under the latch only, with atomic stores, so that the
+// unlatched CLOCK paths can read it. The bucket is taken from the high bits
+// of the product (Fibonacci hashing): its low bits only depend on the low
+// bits of the page number, so pages a power of two apart would share one.
+static int hashPage(BM_MgmtData *mgmt, PageNumber pageNum) {
+    return (int)(((unsigned int)pageNum * 2654435761u) >> mgmt->pageTableShift);
+}
+
+static int lookupFrame(BM_MgmtData *mgmt, PageNumber pageNum) {
+    int frameIndex = mgmt->pageTable[hashPage(mgmt, pageNum)];
+    while (frameIndex != NO_PAGE && mgmt->frames[frameIndex].pageNum != pageNum) {
+        frameIndex = mgmt->pageTableNext[frameIndex];
+    }
+    return frameIndex;
+}
+
+// lookupFrame for the paths that do not hold the latch. A chain may change
+// while it is followed, so this can miss a resident page; callers then take
+// the latch and look again.
+static int lookupFrameUnlatched(BM_MgmtData *mgmt, PageNumber pageNum) {
+    int frameIndex = __atomic_load_n(&mgmt->pageTable[hashPage(mgmt, pageNum)], __ATOMIC_RELAXED);
+    for (int steps = 0; frameIndex != NO_PAGE && steps <= mgmt->pageTableMask; steps++) {
+        if (__atomic_load_n(&mgmt->frames[frameIndex].pageNum, __ATOMIC_RELAXED) == pageNum)
+            return frameIndex;
+        frameIndex = __atomic_load_n(&mgmt->pageTableNext[frameIndex], __ATOMIC_RELAXED);
+    }
+    return NO_PAGE;
+}
+
+static void insertPageEntry(BM_MgmtData *mgmt, int frameIndex) {
+    int bucket = hashPage(mgmt, mgmt->frames[frameIndex].pageNum);
+    __atomic_store_n(&mgmt->pageTableNext[frameIndex], mgmt->pageTable[bucket], __ATOMIC_RELAXED);
+    __atomic_store_n(&mgmt->pageTable[bucket], frameIndex, __ATOMIC_RELEASE);
+}
+
+static void removePageEntry(BM_MgmtData *mgmt, int frameIndex) {
+    int *link = &mgmt->pageTable[hashPage(mgmt, mgmt->frames[frameIndex].pageNum)];
+    while (*link != NO_PAGE) {
+        if (*link == frameIndex) {
+            __atomic_store_n(link, mgmt->pageTableNext[frameIndex], __ATOMIC_RELAXED);
+            break;
+        }
+        link = &mgmt->pageTableNext[*link];
+    }
+    __atomic_store_n(&mgmt->pageTableNext[frameIndex], NO_PAGE, __ATOMIC_RELAXED);
+}
+
+// Fix counts change atomically, as CLOCK pins and unpins of resident pages
+// do not take the latch. A frame that is being evicted or loaded is
+// claimed with a count of -1, which the unlatched paths never pin.
+static bool claimFix(BM_MgmtData *mgmt, int frameIndex) {
+    int unpinned = 0;
+    return __atomic_compare_exchange_n(&mgmt->fixCounts[frameIndex], &unpinned, -1, false,
+                                       __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+// Write-ahead rule: make the log durable up to the last change of a page
+// before the page may be written
+static RC flushLogFor(BM_MgmtData *mgmt, int frameIndex) {
+    if (mgmt->log == NULL)
+        return RC_OK;
+    LSN lsn = __atomic_load_n(&mgmt->pageLSNs[frameIndex], __ATOMIC_ACQUIRE);
+    return lsn != 0 ? flushLog(mgmt->log, lsn) : RC_OK;
+}
+
+// Write the page in frameIndex back if it is dirty. The flag is cleared
+// before the write, so a markDirty racing with it marks the page again.
+static RC writeFrame(BM_MgmtData *mgmt, int frameIndex) {
+    if (!__atomic_exchange_n(&mgmt->dirtyFlags[frameIndex], false, __ATOMIC_ACQ_REL))
+        return RC_OK;
+    RC rc = flushLogFor(mgmt, frameIndex);
+    if (rc == RC_OK)
+        rc = writeBlock(mgmt->frames[frameIndex].pageNum, &(mgmt->fileHandle), mgmt->frames[frameIndex].data);
+    if (rc != RC_OK) {
+        __atomic_store_n(&mgmt->dirtyFlags[frameIndex], true, __ATOMIC_RELAXED);
+        return rc;
+    }
+    mgmt->writeIO++;
+    mgmt->recLSNs[frameIndex] = 0;
+    return RC_OK;
+}
+
+// Victim priority for LFU and LRU-K: the frame that compares smaller is
+// evicted first. Ties (and pages seen fewer than K times) fall back to LRU.
+static bool frameBefore(BM_BufferPool *const bm, int a, int b) {
+    BM_MgmtData *mgmt = (BM_MgmtData *)bm->mgmtData;
+    if (bm->strategy == RS_LFU) {
+        if (mgmt->refCounts[a] != mgmt->refCounts[b])
+            return mgmt->refCounts[a] < mgmt->refCounts[b];
+    } else {
+        int kthA = mgmt->history[a * mgmt->lruK + mgmt->lruK - 1];
+        int kthB = mgmt->history[b * mgmt->lruK + mgmt->lruK - 1];
+        if (kthA != kthB)
+            return kthA < kthB;
+    }
+    return mgmt->timestamps[a] < mgmt->timestamps[b];
+}
+
+static void heapSwap(BM_MgmtData *mgmt, int i, int j) {
+    int frameI = mgmt->heap[i];
+    mgmt->heap[i] = mgmt->heap[j];
+    mgmt->heap[j] = frameI;
+    mgmt->heapPos[mgmt->heap[i]] = i;
+    mgmt->heapPos[mgmt->heap[j]] = j;
+}
+
+static void heapSiftUp(BM_BufferPool *const bm, int i) {
+    BM_MgmtData *mgmt = (BM_MgmtData *)bm->mgmtData;
+    while (i > 0 && frameBefore(bm, mgmt->heap[i], mgmt->heap[(i - 1) / 2])) {
+        heapSwap(mgmt, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+static void heapSiftDown(BM_BufferPool *const bm, int i) {
+    BM_MgmtData *mgmt = (BM_MgmtData *)bm->mgmtData;
+    while (true) {
+        int smallest = i;
+        int left = 2 * i + 1;
+        int right = 2 * i + 2;
+        if (left < mgmt->heapSize && frameBefore(bm, mgmt->heap[left], mgmt->heap[smallest]))
+            smallest = left;
+        if (right < mgmt->heapSize && frameBefore(bm, mgmt->heap[right], mgmt->heap[smallest]))
+            smallest = right;
+        if (smallest == i)
+            return;
+        heapSwap(mgmt, i, smallest);
+        i = smallest;
+    }
+}
+
+static void heapInsert(BM_BufferPool *const bm, int frameIndex) {
+    BM_MgmtData *mgmt = (BM_MgmtData *)bm->mgmtData;
+    mgmt->heap[mgmt->heapSize] = frameIndex;
+    mgmt->heapPos[frameIndex] = mgmt->heapSize++;
+    heapSiftUp(bm, mgmt->heapSize - 1);
+}
+
+static void heapRemove(BM_BufferPool *const bm, int frameIndex) {
+    BM_MgmtData *mgmt = (BM_MgmtData *)bm->mgmtData;
+    int pos = mgmt->heapPos[frameIndex];
+    if (pos < 0)
+        return;
+    mgmt->heapSize--;
+    if (pos != mgmt->heapSize) {
+        heapSwap(mgmt, pos, mgmt->heapSize);
+        heapSiftUp(bm, pos);
+        heapSiftDown(bm, mgmt->heapPos[mgmt->heap[pos]]);
+    }
+    mgmt->heapPos[frameIndex] = -1;
+}
+
+static bool usesHeap(BM_BufferPool *const bm) {
+    return bm->strategy == RS_LFU || bm->strategy == RS_LRU_K;
+}
+
+// Replacement list for FIFO and LRU. FIFO keeps every resident frame in
+// load order; LRU keeps only unpinned frames, least recently used first.
+static bool listContains(BM_MgmtData *mgmt, int frameIndex) {
+    return mgmt->listPrev[frameIndex] != NO_PAGE || mgmt->listHead == frameIndex;
+}
+
+static void listUnlink(BM_MgmtData *mgmt, int frameIndex) {
+    int prev = mgmt->listPrev[frameIndex];
+    int next = mgmt->listNext[frameIndex];
+    if (prev != NO_PAGE)
+        mgmt->listNext[prev] = next;
+    else
+        mgmt->listHead = next;
+    if (next != NO_PAGE)
+        mgmt->listPrev[next] = prev;
+    else
+        mgmt->listTail = prev;
+    mgmt->listPrev[frameIndex] = NO_PAGE;
+    mgmt->listNext[frameIndex] = NO_PAGE;
+}
+
+static void listAppend(BM_MgmtData *mgmt, int frameIndex) {
+    mgmt->listPrev[frameIndex] = mgmt->listTail;
+    mgmt->listNext[frameIndex] = NO_PAGE;
+    if (mgmt->listTail != NO_PAGE)
+        mgmt->listNext[mgmt->listTail] = frameIndex;
+    else
+        mgmt->listHead = frameIndex;
+    mgmt->listTail = frameIndex;
+}
+
+// Frame memory is one contiguous, page-aligned arena allocated when the pool
+// is created. Pools of 2MB or more are rounded up to whole huge pages and
+// the kernel is asked to back them with transparent huge pages.
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+static bool allocArena(BM_MgmtData *mgmt, int numPages) {
+    size_t size = (size_t)numPages * PAGE_SIZE;
+    if (size >= HUGE_PAGE_SIZE) {
+        size = (size + HUGE_PAGE_SIZE - 1) & ~((size_t)HUGE_PAGE_SIZE - 1);
+    }
+    mgmt->arenaSize = size;
+    mgmt->arena = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mgmt->arena != MAP_FAILED) {
+        mgmt->arenaMapped = true;
+#ifdef MADV_HUGEPAGE
+        if (size >= HUGE_PAGE_SIZE) {
+            madvise(mgmt->arena, size, MADV_HUGEPAGE);
+        }
+#endif
+        return true;
+    }
+    mgmt->arenaMapped = false;
+    void *memory = NULL;
+    if (posix_memalign(&memory, PAGE_SIZE, size) != 0) {
+        mgmt->arena = NULL;
+        return false;
+    }
+    mgmt->arena = memory;
+    return true;
+}
+
+static void freeArena(BM_MgmtData *mgmt) {
+    if (mgmt->arenaMapped) {
+        munmap(mgmt->arena, mgmt->arenaSize);
+    } else {
+        free(mgmt->arena);
+    }
+    mgmt->arena = NULL;
+}
+
+// Free the frame arena and the management arrays
+static void freePoolMemory(BM_MgmtData *mgmt) {
+    freeArena(mgmt);
+    free(mgmt->frames);
+    free(mgmt->dirtyFlags);
+    free(mgmt->pageLSNs);
+    free(mgmt->recLSNs);
+    free(mgmt->fixCounts);
+    free(mgmt->listPrev);
+    free(mgmt->listNext);
+    free(mgmt->timestamps);
+    free(mgmt->pageTable);
+    free(mgmt->pageTableNext);
+    free(mgmt->freeFrames);
+    free(mgmt->referenceFlags);
+    free(mgmt->refCounts);
+    free(mgmt->history);
+    free(mgmt->heap);
+    free(mgmt->heapPos);
+}
+
 RC initBufferPool(BM_BufferPool *const bm, const char *const pageFileName,
                   const int numPages, ReplacementStrategy strategy,
                   void *stratData) {
@@ -15,31 +266,85 @@ RC initBufferPool(BM_BufferPool *const bm, const char *const pageFileName,
     bm->mgmtData = malloc(sizeof(BM_MgmtData));
     BM_MgmtData *mgmt = (BM_MgmtData *)bm->mgmtData;
     mgmt->frames = (BM_PageHandle *)malloc(numPages * sizeof(BM_PageHandle));
-    mgmt->fifoQueue = (int *)malloc(numPages * sizeof(int));
+    if (!allocArena(mgmt, numPages)) {
+        free(mgmt->frames);
+        free(mgmt);
+        bm->mgmtData = NULL;
+        return RC_BUFFER_POOL_ALLOC_FAILED;
+    }
+    mgmt->listPrev = (int *)malloc(numPages * sizeof(int));
+    mgmt->listNext = (int *)malloc(numPages * sizeof(int));
     for (int i = 0; i < numPages; i++) {
         mgmt->frames[i].pageNum = NO_PAGE;
-        mgmt->frames[i].data = NULL;
-        mgmt->fifoQueue[i] = i;
+        mgmt->frames[i].data = mgmt->arena + (size_t)i * PAGE_SIZE;
+        mgmt->listPrev[i] = NO_PAGE;
+        mgmt->listNext[i] = NO_PAGE;
     }
+    mgmt->listHead = NO_PAGE;
+    mgmt->listTail = NO_PAGE;
 
-    mgmt->fifoQueue = (int *)malloc(numPages * sizeof(int));
+    // Size the page table to the next power of two >= numPages, at least 2
+    // so that the hash shift stays below 32
+    int numBuckets = 2;
+    mgmt->pageTableShift = 31;
+    while (numBuckets < numPages) {
+        numBuckets <<= 1;
+        mgmt->pageTableShift--;
+    }
+    mgmt->pageTableMask = numBuckets - 1;
+    mgmt->pageTable = (int *)malloc(numBuckets * sizeof(int));
+    mgmt->pageTableNext = (int *)malloc(numPages * sizeof(int));
+    for (int i = 0; i < numBuckets; i++) {
+        mgmt->pageTable[i] = NO_PAGE;
+    }
     for (int i = 0; i < numPages; i++) {
-        mgmt->fifoQueue[i] = i;
+        mgmt->pageTableNext[i] = NO_PAGE;
     }
 
     mgmt->readIO = 0;
     mgmt->writeIO = 0;
     mgmt->dirtyFlags = (bool *)calloc(numPages, sizeof(bool));
+    mgmt->log = NULL;
+    mgmt->pageLSNs = (LSN *)calloc(numPages, sizeof(LSN));
+    mgmt->recLSNs = (LSN *)calloc(numPages, sizeof(LSN));
     mgmt->fixCounts = (int *)calloc(numPages, sizeof(int));
     mgmt->timestamps = (int *)calloc(numPages, sizeof(int));
     mgmt->currentTimestamp = 0;
+
+    // Frames without a page are handed out lowest index first
+    mgmt->freeFrames = (int *)malloc(numPages * sizeof(int));
+    for (int i = 0; i < numPages; i++) {
+        mgmt->freeFrames[i] = numPages - 1 - i;
+    }
+    mgmt->numFreeFrames = numPages;
+
+    // Replacement strategy state
+    mgmt->clockHand = 0;
+    mgmt->referenceFlags = (bool *)calloc(numPages, sizeof(bool));
+    mgmt->refCounts = (int *)calloc(numPages, sizeof(int));
+    mgmt->lruK = DEFAULT_LRU_K;
+    if (strategy == RS_LRU_K && stratData != NULL && *(int *)stratData > 0) {
+        mgmt->lruK = *(int *)stratData;
+    }
+    mgmt->history = (int *)calloc((size_t)numPages * mgmt->lruK, sizeof(int));
+    mgmt->heap = (int *)malloc(numPages * sizeof(int));
+    mgmt->heapPos = (int *)malloc(numPages * sizeof(int));
+    for (int i = 0; i < numPages; i++) {
+        mgmt->heapPos[i] = -1;
+    }
+    mgmt->heapSize = 0;
+
     SM_FileHandle fileHandle;
     RC rc = openPageFile((char *)pageFileName, &fileHandle);
     if (rc != RC_OK) {
+        freePoolMemory(mgmt);
+        free(mgmt);
+        bm->mgmtData = NULL;
         return rc;
     }
 
     mgmt->fileHandle = fileHandle;
+    pthread_mutex_init(&mgmt->latch, NULL);
     return RC_OK;
 }
 
@@ -54,20 +359,13 @@ RC shutdownBufferPool(BM_BufferPool *const bm) {
                 if (mgmt->fixCounts[i] > 0) {
                     return -2; // Cannot shutdown if there are pinned pages
                 }
-                forcePage(bm, &mgmt->frames[i]);
+                writeFrame(mgmt, i);
             }
-            // Free the data in the frame to avoid memory leaks
-            free(mgmt->frames[i].data);
-            mgmt->frames[i].data = NULL; // Set to NULL to avoid dangling pointer
         }
     }
 
-    // Free management arrays
-    free(mgmt->frames);
-    free(mgmt->dirtyFlags);
-    free(mgmt->fixCounts);
-    free(mgmt->fifoQueue);
-    free(mgmt->timestamps);
+    freePoolMemory(mgmt);
+    pthread_mutex_destroy(&mgmt->latch);
     // Close the page file
     RC rc = closePageFile(&(mgmt->fileHandle));
     if (rc != RC_OK) {
@@ -79,69 +377,153 @@ RC shutdownBufferPool(BM_BufferPool *const bm) {
     return RC_OK;
 }
 
+// Dirty frames sorted by page number, so forceFlushPool can write runs of
+// adjacent pages with one writeBlocks call
+typedef struct FlushEntry {
+    PageNumber pageNum;
+    int frameIndex;
+} FlushEntry;
+
+static int compareFlushEntries(const void *a, const void *b) {
+    PageNumber pa = ((const FlushEntry *)a)->pageNum;
+    PageNumber pb = ((const FlushEntry *)b)->pageNum;
+    return (pa > pb) - (pa < pb);
+}
+
 RC forceFlushPool(BM_BufferPool *const bm) {
     BM_MgmtData *mgmt = (BM_MgmtData *)bm->mgmtData;
+    pthread_mutex_lock(&mgmt->latch);
+    FlushEntry *entries = malloc(bm->numPages * sizeof(FlushEntry));
+    SM_PageHandle *buffers = malloc(bm->numPages * sizeof(SM_PageHandle));
+    int numEntries = 0;
     for (int i = 0; i < bm->numPages; i++) {
-        if (mgmt->frames[i].pageNum != NO_PAGE && mgmt->dirtyFlags[i] == true
-            && mgmt->fixCounts[i] == 0) {
-            forcePage(bm, &mgmt->frames[i]);
-            mgmt->dirtyFlags[i] = false;
+        // The flag is cleared before the write, see writeFrame
+        if (mgmt->frames[i].pageNum != NO_PAGE && mgmt->fixCounts[i] == 0
+            && __atomic_exchange_n(&mgmt->dirtyFlags[i], false, __ATOMIC_ACQ_REL)) {
+            entries[numEntries].pageNum = mgmt->frames[i].pageNum;
+            entries[numEntries].frameIndex = i;
+            numEntries++;
         }
     }
-    return RC_OK;
+    qsort(entries, numEntries, sizeof(FlushEntry), compareFlushEntries);
+
+    // One log flush covers every page: the one with the latest change
+    RC rc = RC_OK;
+    int latest = NO_PAGE;
+    for (int i = 0; i < numEntries; i++) {
+        int frameIndex = entries[i].frameIndex;
+        if (latest == NO_PAGE || mgmt->pageLSNs[frameIndex] > mgmt->pageLSNs[latest])
+            latest = frameIndex;
+    }
+    if (latest != NO_PAGE)
+        rc = flushLogFor(mgmt, latest);
+    int start = 0;
+    while (start < numEntries && rc == RC_OK) {
+        int end = start + 1;
+        while (end < numEntries && entries[end].pageNum == entries[end - 1].pageNum + 1) {
+            end++;
+        }
+        for (int i = start; i < end; i++) {
+            buffers[i - start] = mgmt->frames[entries[i].frameIndex].data;
+        }
+        rc = writeBlocks(entries[start].pageNum, end - start, &(mgmt->fileHandle), buffers);
+        if (rc == RC_OK) {
+            mgmt->writeIO += end - start;
+            for (int i = start; i < end; i++) {
+                mgmt->recLSNs[entries[i].frameIndex] = 0;
+            }
+            start = end;
+        }
+    }
+    // Pages that were not written stay dirty
+    for (int i = start; i < numEntries; i++) {
+        __atomic_store_n(&mgmt->dirtyFlags[entries[i].frameIndex], true, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&mgmt->latch);
+    free(entries);
+    free(buffers);
+    return rc;
 }
 
 RC markDirty(BM_BufferPool *const bm, BM_PageHandle *const page) {
     BM_MgmtData *mgmt = (BM_MgmtData *)bm->mgmtData;
-    for (int i = 0; i < bm->numPages; i++) {
-        if (mgmt->frames[i].pageNum == page->pageNum) {
-            mgmt->dirtyFlags[i] = true;
-            return RC_OK;
-        }
+    // The page is pinned, so it cannot leave its frame while the flag is set
+    int frameIndex = lookupFrameUnlatched(mgmt, page->pageNum);
+    if (frameIndex != NO_PAGE) {
+        __atomic_store_n(&mgmt->dirtyFlags[frameIndex], true, __ATOMIC_RELEASE);
+        return RC_OK;
+    }
+    pthread_mutex_lock(&mgmt->latch);
+    frameIndex = lookupFrame(mgmt, page->pageNum);
+    if (frameIndex != NO_PAGE) {
+        __atomic_store_n(&mgmt->dirtyFlags[frameIndex], true, __ATOMIC_RELEASE);
     }
-    return -1;
+    pthread_mutex_unlock(&mgmt->latch);
+    return frameIndex != NO_PAGE ? RC_OK : -1;
 }
 
 RC forcePage(BM_BufferPool *const bm, BM_PageHandle *const page) {
     BM_MgmtData *mgmt = (BM_MgmtData *)bm->mgmtData;
-    for (int i = 0; i < bm->numPages; i++) {
-        if (mgmt->frames[i].pageNum == page->pageNum) {
-            if (mgmt->dirtyFlags[i] == true) {
-                writeBlock(page->pageNum, &(mgmt->fileHandle), mgmt->frames[i].data);
-                mgmt->dirtyFlags[i] = false;
-                mgmt->writeIO++;
-            }
-            return RC_OK;
-        }
-    }
-    return RC_PAGE_NOT_FOUND;
+    pthread_mutex_lock(&mgmt->latch);
+    int frameIndex = lookupFrame(mgmt, page->pageNum);
+    RC rc = frameIndex != NO_PAGE ? writeFrame(mgmt, frameIndex) : RC_PAGE_NOT_FOUND;
+    pthread_mutex_unlock(&mgmt->latch);
+    return rc;
 }
 
 static int findFrameToReplace(BM_BufferPool *const bm) {
     BM_MgmtData *mgmt = (BM_MgmtData *)bm->mgmtData;
+    // Fill empty frames before evicting anything. The victim is returned
+    // claimed; an unlatched CLOCK pin may hold a free frame for a moment
+    // before it sees that the frame has no page.
+    if (mgmt->numFreeFrames > 0) {
+        int frameIndex = mgmt->freeFrames[--mgmt->numFreeFrames];
+        while (!claimFix(mgmt, frameIndex)) {
+        }
+        return frameIndex;
+    }
     if (bm->strategy == RS_FIFO) {
-        // Implement FIFO strategy
-        for (int i = 0; i < bm->numPages; i++) {
-            int frameIndex = mgmt->fifoQueue[i];
-            if (mgmt->fixCounts[frameIndex] == 0) {
-                // Move this frame to the end of the queue
-                for (int j = i; j < bm->numPages - 1; j++) {
-                    mgmt->fifoQueue[j] = mgmt->fifoQueue[j + 1];
-                }
-                mgmt->fifoQueue[bm->numPages - 1] = frameIndex;
+        // Oldest unpinned page first; pinned frames keep their position
+        for (int frameIndex = mgmt->listHead; frameIndex != NO_PAGE;
+             frameIndex = mgmt->listNext[frameIndex]) {
+            if (claimFix(mgmt, frameIndex)) {
+                listUnlink(mgmt, frameIndex);
                 return frameIndex;
             }
         }
     } else if (bm->strategy == RS_LRU) {
-        int leastUsed = mgmt->timestamps[0];
-        int leastUsedIndex = 0;
-        for (int i = 1; i < bm->numPages; i++) {
-            if (mgmt->fixCounts[i] == 0 && mgmt->timestamps[i] < leastUsed) {
-                leastUsed = mgmt->timestamps[i];
-                leastUsedIndex = i;
+        // Pinned frames are not in the list, so the head is the victim
+        if (mgmt->listHead != NO_PAGE) {
+            int frameIndex = mgmt->listHead;
+            listUnlink(mgmt, frameIndex);
+            claimFix(mgmt, frameIndex);
+            return frameIndex;
+        }
+    } else if (bm->strategy == RS_CLOCK) {
+        // Sweep the hand, giving referenced frames a second chance. Every
+        // cleared bit was set by a pin, so the sweep is O(1) amortized.
+        for (int step = 0; step < 2 * bm->numPages; step++) {
+            int frameIndex = mgmt->clockHand;
+            mgmt->clockHand = (mgmt->clockHand + 1) % bm->numPages;
+            if (__atomic_load_n(&mgmt->fixCounts[frameIndex], __ATOMIC_RELAXED) != 0)
+                continue;
+            if (__atomic_load_n(&mgmt->referenceFlags[frameIndex], __ATOMIC_RELAXED)) {
+                __atomic_store_n(&mgmt->referenceFlags[frameIndex], false, __ATOMIC_RELAXED);
+                continue;
             }
+            // Lost to an unlatched pin since the count was read
+            if (!claimFix(mgmt, frameIndex))
+                continue;
+            return frameIndex;
+        }
+    } else if (usesHeap(bm)) {
+        // Only unpinned frames are kept in the heap
+        if (mgmt->heapSize > 0) {
+            int frameIndex = mgmt->heap[0];
+            heapRemove(bm, frameIndex);
+            claimFix(mgmt, frameIndex);
+            return frameIndex;
         }
-        return leastUsedIndex;
     }
     return NO_PAGE;
 }
@@ -151,36 +533,168 @@ static void updateLRUOrder(BM_BufferPool *const bm, int frameIndex) {
     mgmt->timestamps[frameIndex] = ++(mgmt->currentTimestamp);
 }
 
-RC pinPage(BM_BufferPool *const bm, BM_PageHandle *const page, const PageNumber pageNum) {
+// Record a pin of the page in frameIndex for the CLOCK, LFU and LRU-K
+// bookkeeping. loaded is true when the page was just read into the frame.
+static void recordReference(BM_BufferPool *const bm, int frameIndex, bool loaded) {
     BM_MgmtData *mgmt = (BM_MgmtData *)bm->mgmtData;
-    // Check if the page is already in the buffer pool
-    for (int i = 0; i < bm->numPages; i++) {
-        if (mgmt->frames[i].pageNum == pageNum) {
-            page->pageNum = pageNum;
-            page->data = mgmt->frames[i].data;
-            mgmt->fixCounts[i]++;
-            if (bm->strategy == RS_LRU) {
-                updateLRUOrder(bm, i);
+    switch (bm->strategy) {
+        case RS_CLOCK:
+            __atomic_store_n(&mgmt->referenceFlags[frameIndex], true, __ATOMIC_RELAXED);
+            break;
+        case RS_LFU:
+            heapRemove(bm, frameIndex);
+            mgmt->refCounts[frameIndex] = loaded ? 1 : mgmt->refCounts[frameIndex] + 1;
+            updateLRUOrder(bm, frameIndex);
+            break;
+        case RS_LRU_K: {
+            int *history = &mgmt->history[frameIndex * mgmt->lruK];
+            heapRemove(bm, frameIndex);
+            updateLRUOrder(bm, frameIndex);
+            if (loaded) {
+                memset(history, 0, mgmt->lruK * sizeof(int));
+            } else {
+                memmove(history + 1, history, (mgmt->lruK - 1) * sizeof(int));
             }
-            return RC_OK;
+            history[0] = mgmt->timestamps[frameIndex];
+            break;
         }
+        default:
+            break;
     }
+}
 
-    // If the page is not in the buffer pool, we need to load it
-    int frameIndex = findFrameToReplace(bm);
+// Make the page just read into frameIndex resident with a fix count of 1.
+// The count is set last: it publishes the page to the unlatched pins.
+static void installPage(BM_BufferPool *const bm, int frameIndex, PageNumber pageNum) {
+    BM_MgmtData *mgmt = (BM_MgmtData *)bm->mgmtData;
+    __atomic_store_n(&mgmt->frames[frameIndex].pageNum, pageNum, __ATOMIC_RELAXED);
+    insertPageEntry(mgmt, frameIndex);
+    __atomic_store_n(&mgmt->dirtyFlags[frameIndex], false, __ATOMIC_RELAXED);
+    __atomic_store_n(&mgmt->pageLSNs[frameIndex], 0, __ATOMIC_RELAXED);
+    mgmt->recLSNs[frameIndex] = 0;
+    mgmt->readIO++;
+    if (bm->strategy == RS_FIFO) {
+        listAppend(mgmt, frameIndex);
+    }
+    recordReference(bm, frameIndex, true);
+    __atomic_store_n(&mgmt->fixCounts[frameIndex], 1, __ATOMIC_RELEASE);
+}
+
+// Drop one fix of frameIndex, making it a replacement candidate at 0
+static void releaseFrame(BM_BufferPool *const bm, int frameIndex) {
+    BM_MgmtData *mgmt = (BM_MgmtData *)bm->mgmtData;
+    int fixCount = __atomic_sub_fetch(&mgmt->fixCounts[frameIndex], 1, __ATOMIC_RELEASE);
+    if (bm->strategy == RS_LRU && fixCount == 0) {
+        listAppend(mgmt, frameIndex);
+    }
+    if (usesHeap(bm) && fixCount == 0) {
+        heapInsert(bm, frameIndex);
+    }
+}
+
+// Give a claimed frame back: to the free frames if it has no page, else to
+// the strategy as a replacement candidate, e.g. a victim whose page could
+// not be written back
+static void unclaimFrame(BM_BufferPool *const bm, int frameIndex) {
+    BM_MgmtData *mgmt = (BM_MgmtData *)bm->mgmtData;
+    if (mgmt->frames[frameIndex].pageNum == NO_PAGE) {
+        __atomic_store_n(&mgmt->fixCounts[frameIndex], 0, __ATOMIC_RELEASE);
+        mgmt->freeFrames[mgmt->numFreeFrames++] = frameIndex;
+        return;
+    }
+    if (bm->strategy == RS_FIFO) {
+        listAppend(mgmt, frameIndex);
+    }
+    __atomic_store_n(&mgmt->fixCounts[frameIndex], 1, __ATOMIC_RELAXED);
+    releaseFrame(bm, frameIndex);
+}
+
+// Take a frame for a new page: a free frame or a victim of the strategy,
+// claimed with a fix count of -1. A dirty victim is written back and its
+// page table entry dropped; if the write fails, the victim keeps its page
+// and the error is returned. RC_BUFFER_POOL_FULL when every frame is pinned.
+static RC claimFrame(BM_BufferPool *const bm, int *frameIndex) {
+    BM_MgmtData *mgmt = (BM_MgmtData *)bm->mgmtData;
+    *frameIndex = findFrameToReplace(bm);
+    if (*frameIndex == NO_PAGE)
+        return RC_BUFFER_POOL_FULL;
+    if (mgmt->dirtyFlags[*frameIndex]) {
+        RC rc = writeFrame(mgmt, *frameIndex);
+        if (rc != RC_OK) {
+            unclaimFrame(bm, *frameIndex);
+            *frameIndex = NO_PAGE;
+            return rc;
+        }
+    }
+    if (mgmt->frames[*frameIndex].pageNum != NO_PAGE) {
+        removePageEntry(mgmt, *frameIndex);
+        __atomic_store_n(&mgmt->frames[*frameIndex].pageNum, NO_PAGE, __ATOMIC_RELAXED);
+    }
+    return RC_OK;
+}
+
+// CLOCK hit without the latch: fix the frame the page table points to
+// unless it is claimed, then check that it still holds the page. The
+// reference bit is all the bookkeeping CLOCK needs, so lookups of resident
+// pages from many threads do not serialize on the latch.
+static bool pinResident(BM_MgmtData *mgmt, BM_PageHandle *const page, PageNumber pageNum) {
+    int frameIndex = lookupFrameUnlatched(mgmt, pageNum);
     if (frameIndex == NO_PAGE)
-        return -1;
-    // If the chosen frame is dirty, write it back to disk
-    if (mgmt->dirtyFlags[frameIndex]) {
-        forcePage(bm, &mgmt->frames[frameIndex]);
+        return false;
+    int *fixCount = &mgmt->fixCounts[frameIndex];
+    int count = __atomic_load_n(fixCount, __ATOMIC_RELAXED);
+    do {
+        if (count < 0)
+            return false;
+    } while (!__atomic_compare_exchange_n(fixCount, &count, count + 1, true, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+    if (__atomic_load_n(&mgmt->frames[frameIndex].pageNum, __ATOMIC_RELAXED) != pageNum) {
+        // Evicted and reused since the lookup
+        __atomic_fetch_sub(fixCount, 1, __ATOMIC_RELEASE);
+        return false;
     }
+    __atomic_store_n(&mgmt->referenceFlags[frameIndex], true, __ATOMIC_RELAXED);
+    page->pageNum = pageNum;
+    page->data = mgmt->frames[frameIndex].data;
+    return true;
+}
+
+// CLOCK unpin without the latch; the caller's fix keeps the page in place
+static bool unpinResident(BM_MgmtData *mgmt, PageNumber pageNum) {
+    int frameIndex = lookupFrameUnlatched(mgmt, pageNum);
+    if (frameIndex == NO_PAGE)
+        return false;
+    int *fixCount = &mgmt->fixCounts[frameIndex];
+    int count = __atomic_load_n(fixCount, __ATOMIC_RELAXED);
+    do {
+        if (count <= 0)
+            return false;
+    } while (!__atomic_compare_exchange_n(fixCount, &count, count - 1, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    return true;
+}
 
-    // Load the new page from disk
-    if (mgmt->frames[frameIndex].data != NULL) {
-        free(mgmt->frames[frameIndex].data);
+static RC pinPageLatched(BM_BufferPool *const bm, BM_PageHandle *const page, const PageNumber pageNum) {
+    BM_MgmtData *mgmt = (BM_MgmtData *)bm->mgmtData;
+    // Check if the page is already in the buffer pool
+    int hitIndex = lookupFrame(mgmt, pageNum);
+    if (hitIndex != NO_PAGE) {
+        page->pageNum = pageNum;
+        page->data = mgmt->frames[hitIndex].data;
+        __atomic_fetch_add(&mgmt->fixCounts[hitIndex], 1, __ATOMIC_ACQUIRE);
+        if (bm->strategy == RS_LRU && listContains(mgmt, hitIndex)) {
+            listUnlink(mgmt, hitIndex);
+        }
+        recordReference(bm, hitIndex, false);
+        return RC_OK;
     }
-    mgmt->frames[frameIndex].data = malloc(PAGE_SIZE);
-    RC rc = readBlock(pageNum, &(mgmt->fileHandle), mgmt->frames[frameIndex].data);
+
+    // If the page is not in the buffer pool, we need to load it
+    int frameIndex;
+    RC rc = claimFrame(bm, &frameIndex);
+    if (rc != RC_OK)
+        return rc;
+
+    // Load the new page from disk into the frame's slot of the arena
+    rc = readBlock(pageNum, &(mgmt->fileHandle), mgmt->frames[frameIndex].data);
     if (rc != RC_OK) {
         if (rc == RC_READ_NON_EXISTING_PAGE) {
             // Initialize new page
@@ -189,37 +703,171 @@ RC pinPage(BM_BufferPool *const bm, BM_PageHandle *const page, const PageNumber
             snprintf(pageContent, PAGE_SIZE, "Page-%i", pageNum);
             strncpy(mgmt->frames[frameIndex].data, pageContent, strlen(pageContent));
         } else {
+            unclaimFrame(bm, frameIndex);
             return rc;
         }
     }
-
-    mgmt->frames[frameIndex].pageNum = pageNum;
-    mgmt->fixCounts[frameIndex] = 1;
-    mgmt->dirtyFlags[frameIndex] = false;
-    mgmt->readIO++;
-    if (bm->strategy == RS_LRU) {
-        updateLRUOrder(bm, frameIndex);
-    }
+    installPage(bm, frameIndex, pageNum);
 
     page->pageNum = pageNum;
     page->data = mgmt->frames[frameIndex].data;
     return RC_OK;
 }
 
+RC pinPage(BM_BufferPool *const bm, BM_PageHandle *const page, const PageNumber pageNum) {
+    BM_MgmtData *mgmt = (BM_MgmtData *)bm->mgmtData;
+    if (bm->strategy == RS_CLOCK && pinResident(mgmt, page, pageNum))
+        return RC_OK;
+    pthread_mutex_lock(&mgmt->latch);
+    RC rc = pinPageLatched(bm, page, pageNum);
+    pthread_mutex_unlock(&mgmt->latch);
+    return rc;
+}
+
 RC unpinPage(BM_BufferPool *const bm, BM_PageHandle *const page) {
     BM_MgmtData *mgmt = (BM_MgmtData *)bm->mgmtData;
-    for (int i = 0; i < bm->numPages; i++) {
-        if (mgmt->frames[i].pageNum == page->pageNum) {
-            if (mgmt->fixCounts[i] == 0)
-                return -3;
-            mgmt->fixCounts[i]--;
-            if (bm->strategy == RS_LRU) {
-                updateLRUOrder(bm, i);
+    if (bm->strategy == RS_CLOCK && unpinResident(mgmt, page->pageNum))
+        return RC_OK;
+    pthread_mutex_lock(&mgmt->latch);
+    RC rc = RC_OK;
+    int frameIndex = lookupFrame(mgmt, page->pageNum);
+    if (frameIndex == NO_PAGE)
+        rc = -1;
+    else if (__atomic_load_n(&mgmt->fixCounts[frameIndex], __ATOMIC_RELAXED) <= 0)
+        rc = -3;
+    else
+        releaseFrame(bm, frameIndex);
+    pthread_mutex_unlock(&mgmt->latch);
+    return rc;
+}
+
+// Read pages firstPage .. firstPage + numPages - 1 into the pool without
+// pinning them. Runs of pages that are not resident are fetched with one
+// readBlocks call each; pages past the end of the file are skipped, and
+// prefetching stops early when every frame is pinned. It fails when a
+// victim cannot be written back.
+RC prefetchPages(BM_BufferPool *const bm, const PageNumber firstPage, const int numPages) {
+    BM_MgmtData *mgmt = (BM_MgmtData *)bm->mgmtData;
+    pthread_mutex_lock(&mgmt->latch);
+    int lastPage = firstPage + numPages;
+    if (lastPage > mgmt->fileHandle.totalNumPages) {
+        lastPage = mgmt->fileHandle.totalNumPages;
+    }
+    int *runFrames = malloc(bm->numPages * sizeof(int));
+    SM_PageHandle *buffers = malloc(bm->numPages * sizeof(SM_PageHandle));
+    RC rc = RC_OK;
+
+    PageNumber pageNum = firstPage < 0 ? 0 : firstPage;
+    while (pageNum < lastPage && rc == RC_OK) {
+        if (lookupFrame(mgmt, pageNum) != NO_PAGE) {
+            pageNum++;
+            continue;
+        }
+        // Claim frames for the run; a claimed frame is not handed out again
+        // until its page is installed
+        int runLength = 0;
+        while (pageNum + runLength < lastPage && runLength < bm->numPages
+               && lookupFrame(mgmt, pageNum + runLength) == NO_PAGE) {
+            int frameIndex;
+            rc = claimFrame(bm, &frameIndex);
+            if (rc != RC_OK)
+                break;
+            runFrames[runLength] = frameIndex;
+            buffers[runLength] = mgmt->frames[frameIndex].data;
+            runLength++;
+        }
+        if (rc == RC_BUFFER_POOL_FULL)
+            rc = RC_OK; // every frame is pinned, read the run claimed so far
+        if (runLength == 0)
+            break;
+
+        if (rc == RC_OK)
+            rc = readBlocks(pageNum, runLength, &(mgmt->fileHandle), buffers);
+        for (int i = 0; i < runLength; i++) {
+            if (rc == RC_OK) {
+                installPage(bm, runFrames[i], pageNum + i);
+                releaseFrame(bm, runFrames[i]);
+            } else {
+                unclaimFrame(bm, runFrames[i]);
             }
-            return RC_OK;
+        }
+        pageNum += runLength;
+    }
+    pthread_mutex_unlock(&mgmt->latch);
+    free(runFrames);
+    free(buffers);
+    return rc;
+}
+
+// Grow the pool's page file to at least numPages pages
+RC ensurePoolCapacity(BM_BufferPool *const bm, const int numPages) {
+    BM_MgmtData *mgmt = (BM_MgmtData *)bm->mgmtData;
+    pthread_mutex_lock(&mgmt->latch);
+    RC rc = ensureCapacity(numPages, &(mgmt->fileHandle));
+    pthread_mutex_unlock(&mgmt->latch);
+    return rc;
+}
+
+// Wait until the pages written back so far are on disk
+RC syncPool(BM_BufferPool *const bm) {
+    BM_MgmtData *mgmt = (BM_MgmtData *)bm->mgmtData;
+    pthread_mutex_lock(&mgmt->latch);
+    RC rc = syncPageFile(&(mgmt->fileHandle));
+    pthread_mutex_unlock(&mgmt->latch);
+    return rc;
+}
+
+RC setPoolLog(BM_BufferPool *const bm, WAL_Log *log) {
+    BM_MgmtData *mgmt = (BM_MgmtData *)bm->mgmtData;
+    pthread_mutex_lock(&mgmt->latch);
+    mgmt->log = log;
+    pthread_mutex_unlock(&mgmt->latch);
+    return RC_OK;
+}
+
+// markDirty for a page changed by the log record at lsn. The LSN is set
+// before the flag, so a write that sees the flag flushes the log far enough.
+// The first change since the page was written sets its recLSN.
+RC markDirtyLSN(BM_BufferPool *const bm, BM_PageHandle *const page, LSN lsn) {
+    BM_MgmtData *mgmt = (BM_MgmtData *)bm->mgmtData;
+    pthread_mutex_lock(&mgmt->latch);
+    int frameIndex = lookupFrame(mgmt, page->pageNum);
+    if (frameIndex != NO_PAGE) {
+        __atomic_store_n(&mgmt->pageLSNs[frameIndex], lsn, __ATOMIC_RELEASE);
+        if (mgmt->recLSNs[frameIndex] == 0)
+            mgmt->recLSNs[frameIndex] = lsn;
+        __atomic_store_n(&mgmt->dirtyFlags[frameIndex], true, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&mgmt->latch);
+    return frameIndex != NO_PAGE ? RC_OK : RC_PAGE_NOT_FOUND;
+}
+
+RC getDirtyPageTable(BM_BufferPool *const bm, PageNumber *pages, LSN *recLSNs, int *numPages) {
+    BM_MgmtData *mgmt = (BM_MgmtData *)bm->mgmtData;
+    pthread_mutex_lock(&mgmt->latch);
+    *numPages = 0;
+    for (int i = 0; i < bm->numPages; i++) {
+        if (mgmt->frames[i].pageNum != NO_PAGE && mgmt->recLSNs[i] != 0) {
+            pages[*numPages] = mgmt->frames[i].pageNum;
+            recLSNs[*numPages] = mgmt->recLSNs[i];
+            (*numPages)++;
+        }
+    }
+    pthread_mutex_unlock(&mgmt->latch);
+    return RC_OK;
+}
+
+RC flushPagesBefore(BM_BufferPool *const bm, LSN lsn) {
+    BM_MgmtData *mgmt = (BM_MgmtData *)bm->mgmtData;
+    RC rc = RC_OK;
+    pthread_mutex_lock(&mgmt->latch);
+    for (int i = 0; i < bm->numPages && rc == RC_OK; i++) {
+        if (mgmt->frames[i].pageNum != NO_PAGE && mgmt->recLSNs[i] != 0 && mgmt->recLSNs[i] < lsn) {
+            rc = writeFrame(mgmt, i);
         }
     }
-    return -1;
+    pthread_mutex_unlock(&mgmt->latch);
+    return rc;
 }
 
 PageNumber *getFrameContents(BM_BufferPool *const bm) {
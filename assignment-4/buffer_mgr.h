@@ -1,12 +1,15 @@
 #ifndef BUFFER_MANAGER_H
 #define BUFFER_MANAGER_H
 
+#include <pthread.h>
+
 // Include return codes and methods for logging errors
 #include "dberror.h"
 
 // Include bool DT
 #include "dt.h"
 #include "storage_mgr.h"
+#include "wal.h"
 
 
 // Replacement Strategies
@@ -22,6 +25,9 @@ typedef enum ReplacementStrategy {
 typedef int PageNumber;
 #define NO_PAGE -1
 
+// K used by RS_LRU_K when no stratData is given
+#define DEFAULT_LRU_K 2
+
 typedef struct BM_BufferPool {
 	char *pageFile;
 	int numPages;
@@ -37,16 +43,39 @@ typedef struct BM_PageHandle {
 
 typedef struct BM_MgmtData {
 	BM_PageHandle *frames;
+	char *arena; // page-aligned memory of all frames, frame i at i * PAGE_SIZE
+	size_t arenaSize;
+	bool arenaMapped; // arena comes from mmap rather than posix_memalign
 	bool *dirtyFlags;
 	int *fixCounts;
 	int readIO;
 	int writeIO;
 	SM_FileHandle fileHandle;
-	int *fifoQueue;
+	int *listPrev; // FIFO, LRU: intrusive doubly-linked replacement list
+	int *listNext; //   over frame indices, next victim at the head
+	int listHead;
+	int listTail;
 	int *timestamps;
 	int currentTimestamp;
 	int accessCounter; // for LRU
 	bool *referenceFlags; // Add this line for CLOCK
+	int *pageTable; // hash buckets: page number -> first frame of the chain
+	int *pageTableNext; // per frame link to the next frame in the same bucket
+	int pageTableMask; // number of buckets - 1 (power of two)
+	int pageTableShift; // 32 - log2(number of buckets), see hashPage
+	int *freeFrames; // stack of frames that hold no page, lowest index on top
+	int numFreeFrames;
+	int clockHand; // CLOCK: next frame the hand inspects
+	int *refCounts; // LFU: pins since the page was loaded
+	int lruK; // LRU-K: number of pin times remembered per frame
+	int *history; // LRU-K: last lruK pin times of each frame, newest first
+	int *heap; // LFU, LRU-K: min-heap of unpinned frames, next victim on top
+	int *heapPos; // position of each frame in heap, -1 when it is not in it
+	int heapSize;
+	pthread_mutex_t latch; // held by every call but CLOCK pin/unpin hits and markDirty
+	WAL_Log *log; // with a log, a page is written once the log is durable up to pageLSNs
+	LSN *pageLSNs; // LSN of the last logged change of each frame's page, 0 if none
+	LSN *recLSNs; // LSN of the first logged change since the page was last written, 0 if none
 } BM_MgmtData;
 
 
@@ -70,6 +99,23 @@ RC unpinPage (BM_BufferPool *const bm, BM_PageHandle *const page);
 RC forcePage (BM_BufferPool *const bm, BM_PageHandle *const page);
 RC pinPage (BM_BufferPool *const bm, BM_PageHandle *const page, 
 		const PageNumber pageNum);
+RC prefetchPages (BM_BufferPool *const bm, const PageNumber firstPage,
+		const int numPages);
+RC ensurePoolCapacity (BM_BufferPool *const bm, const int numPages);
+RC syncPool (BM_BufferPool *const bm);
+
+// Write-ahead logging: markDirtyLSN marks a page changed by the log record
+// at lsn, and no page of a pool with a log is written back before the log
+// is durable up to the last record that changed it
+RC setPoolLog (BM_BufferPool *const bm, WAL_Log *log);
+RC markDirtyLSN (BM_BufferPool *const bm, BM_PageHandle *const page, LSN lsn);
+
+// Dirty page table for checkpoints: the pages with logged changes that are
+// not written back yet, each with the LSN of its first such change. pages
+// and recLSNs hold bm->numPages entries.
+RC getDirtyPageTable (BM_BufferPool *const bm, PageNumber *pages, LSN *recLSNs, int *numPages);
+// Write back the pages whose first unwritten change is older than lsn
+RC flushPagesBefore (BM_BufferPool *const bm, LSN lsn);
 
 // Statistics Interface
 PageNumber *getFrameContents (BM_BufferPool *const bm);
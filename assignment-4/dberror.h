@@ -26,6 +26,7 @@ typedef int RC;
 #define RC_PAGE_NOT_PINNED              107
 #define RC_BUFFER_POOL_FULL             108
 #define RC_REPLACEMENT_STRATEGY_NOT_IMPLEMENTED 109
+#define RC_BUFFER_POOL_ALLOC_FAILED     110
 
 #define RC_RM_COMPARE_VALUE_OF_DIFFERENT_DATATYPE 200
 #define RC_RM_EXPR_RESULT_IS_NOT_BOOLEAN 201
@@ -33,11 +34,23 @@ typedef int RC;
 #define RC_RM_NO_MORE_TUPLES 203
 #define RC_RM_NO_PRINT_FOR_DATATYPE 204
 #define RC_RM_UNKOWN_DATATYPE 205
+#define RC_RM_INDEX_EXISTS 206
+#define RC_RM_INDEX_NOT_FOUND 207
+#define RC_RM_TOO_MANY_INDEXES 208
+#define RC_RM_RECORD_TOO_LARGE 209
+#define RC_RM_TRANSACTION_OPEN 210
+#define RC_RM_NOT_IN_TRANSACTION 211
+#define RC_RM_INVALID_ATTRIBUTE 212
 
 #define RC_IM_KEY_NOT_FOUND 300
 #define RC_IM_KEY_ALREADY_EXISTS 301
 #define RC_IM_N_TO_LAGE 302
 #define RC_IM_NO_MORE_ENTRIES 303
+#define RC_IM_KEYS_NOT_SORTED 304
+#define RC_IM_TREE_NOT_EMPTY 305
+#define RC_IM_KEY_TOO_LONG 306
+
+#define RC_LOG_CORRUPT 400
 
 #define RC_IM_SCAN_NOT_OPEN 601
 #define RC_IM_TREE_NOT_INITIALIZED 602
@@ -48,6 +61,7 @@ typedef int RC;
 #define RC_INVALID_HANDLE 607
 #define RC_MEMORY_ALLOCATION_FAILED 608
 #define RC_IM_TREE_EMPTY 609
+#define RC_FILE_NOT_MAPPED 610
 
 /* holder for error messages */
 extern char *RC_message;
@@ -4,13 +4,547 @@
 #include "record_mgr.h"
 
 #include <limits.h>
+#include <stdint.h>
 
 #include "buffer_mgr.h"
+#include "btree_mgr.h"
 #include "storage_mgr.h"
 #include "tables.h"
 #include "dberror.h"
 #include "expr.h"
 
+// Frames in the buffer pool each open table keeps for its pages
+#define TABLE_POOL_SIZE 64
+// Leaves of an index built over existing records are left this full, so
+// the inserts that follow do not split every one of them
+#define INDEX_BUILD_FILL 0.7f
+// Bytes of log between two checkpoints of an open table
+#define CHECKPOINT_INTERVAL (1 << 20)
+
+// The metadata page (page 1) of a table: the number of records, the
+// attributes the table has indexes on and the data pages, from page 2 on
+typedef struct TableMetaPage {
+    LSN pageLSN; // Last logged change, see unpinUpdated
+    int numTuples;
+    int numIndexes;
+    int indexAttrs[RM_MAX_INDEXES];
+    PageNumber firstFreePage; // First data page on the free list, 0 if none
+    int numPages; // Data pages in use
+} TableMetaPage;
+
+int attrOffset(Schema *schema, int attrNum);
+
+// The state openTable stores for the table
+static RM_TableMgmtData *tableData(RM_TableData *rel) {
+    return (RM_TableMgmtData *)rel->mgmtData;
+}
+
+static BM_BufferPool *tablePool(RM_TableData *rel) {
+    return &tableData(rel)->pool;
+}
+
+// The write-ahead log of table t is the file t.log
+static void logFileName(char *table, char *out) {
+    snprintf(out, 64, "%s.log", table);
+}
+
+// Write-ahead logging. The metadata page and the data pages of a table
+// start with the LSN of the last change they got. A change pins the pages
+// it may alter with pinForUpdate, which keeps a copy of each, and unpins
+// them with unpinUpdated: the runs of bytes that differ from the copy are
+// logged in one WAL_UPDATE before the pool may write the page, and the
+// page is stamped with the record's LSN.
+//
+// Runs of changed bytes fewer than this many bytes apart are logged as one
+#define LOG_RUN_GAP 8
+// Largest WAL_UPDATE: its runs are LOG_RUN_GAP bytes apart at least, so
+// their headers take less room than a page
+#define LOG_BUFFER_SIZE (sizeof(WAL_Record) + sizeof(WAL_PageUpdate) + 3 * PAGE_SIZE)
+
+// Append a record of the running change, after its previous one
+static RC logRecord(RM_TableData *rel, WAL_Record *record, LSN *lsn) {
+    RM_TableMgmtData *table = tableData(rel);
+    record->txId = table->txId;
+    record->prevLSN = table->lastLSN;
+    RC rc = appendLogRecord(table->log, record, lsn);
+    if (rc == RC_OK) {
+        table->lastLSN = *lsn;
+    }
+    return rc;
+}
+
+// Log how a page changed from before; *lsn is 0 when nothing changed
+static RC logPageUpdate(RM_TableData *rel, BM_PageHandle *page, const char *before, LSN *lsn) {
+    RM_TableMgmtData *table = tableData(rel);
+    WAL_Record *record = (WAL_Record *)table->logBuffer;
+    WAL_PageUpdate *update = (WAL_PageUpdate *)(record + 1);
+    char *out = (char *)(update + 1);
+    const char *after = page->data;
+    int offset = sizeof(LSN);
+
+    update->pageNum = page->pageNum;
+    update->numRuns = 0;
+    while (true) {
+        // Skip the bytes that stayed, a block at a time where it can
+        while (offset + 64 <= PAGE_SIZE && memcmp(before + offset, after + offset, 64) == 0) {
+            offset += 64;
+        }
+        while (offset < PAGE_SIZE && before[offset] == after[offset]) {
+            offset++;
+        }
+        if (offset == PAGE_SIZE) {
+            break;
+        }
+        int end, equal = 0;
+        for (end = offset; end < PAGE_SIZE && equal < LOG_RUN_GAP; end++) {
+            equal = before[end] == after[end] ? equal + 1 : 0;
+        }
+        WAL_Run run = {offset, end - equal - offset};
+        memcpy(out, &run, sizeof(run));
+        memcpy(out + sizeof(run), before + offset, run.length);
+        memcpy(out + sizeof(run) + run.length, after + offset, run.length);
+        out += sizeof(run) + 2 * run.length;
+        update->numRuns++;
+        offset = end;
+    }
+
+    *lsn = 0;
+    if (update->numRuns == 0) {
+        return RC_OK;
+    }
+    record->length = out - table->logBuffer;
+    record->type = WAL_UPDATE;
+    return logRecord(rel, record, lsn);
+}
+
+static RM_PageImage *findImage(RM_TableMgmtData *table, PageNumber pageNum) {
+    for (int i = 0; i < RM_MAX_PAGE_IMAGES; i++) {
+        if (table->images[i].pageNum == pageNum) {
+            return &table->images[i];
+        }
+    }
+    return NULL;
+}
+
+// Pin a page the running change may alter. A page pinned for update twice
+// keeps the copy from its first pin.
+static RC pinForUpdate(RM_TableData *rel, BM_PageHandle *page, PageNumber pageNum) {
+    RM_TableMgmtData *table = tableData(rel);
+    RC rc = pinPage(&table->pool, page, pageNum);
+    if (rc != RC_OK) return rc;
+    RM_PageImage *image = findImage(table, pageNum);
+    if (image == NULL) {
+        image = findImage(table, NO_PAGE);
+        if (image == NULL) {
+            unpinPage(&table->pool, page);
+            return RC_BUFFER_POOL_FULL;
+        }
+        image->pageNum = pageNum;
+        image->pins = 0;
+        memcpy(image->data, page->data, PAGE_SIZE);
+    }
+    image->pins++;
+    return RC_OK;
+}
+
+// Unpin a page pinned for update; with its last pin gone, its changes are
+// logged and it is marked dirty
+static RC unpinUpdated(RM_TableData *rel, BM_PageHandle *page) {
+    RM_TableMgmtData *table = tableData(rel);
+    RM_PageImage *image = findImage(table, page->pageNum);
+    RC rc = RC_OK;
+    if (image != NULL && --image->pins == 0) {
+        LSN lsn;
+        rc = logPageUpdate(rel, page, image->data, &lsn);
+        if (rc == RC_OK && lsn != 0) {
+            memcpy(page->data, &lsn, sizeof(LSN));
+            rc = markDirtyLSN(&table->pool, page, lsn);
+        }
+        image->pageNum = NO_PAGE;
+    }
+    RC unpinRc = unpinPage(&table->pool, page);
+    return rc != RC_OK ? rc : unpinRc;
+}
+
+// A change to a table runs with its latch held, as a transaction of its
+// own or as part of the open transaction of its thread. A change that
+// fails is rolled back to where it began. On its own, endChange then logs
+// its commit, lets the next call in and returns once the commit is
+// durable; threads that commit meanwhile share the log flush.
+static void beginChange(RM_TableData *rel) {
+    RM_TableMgmtData *table = tableData(rel);
+    pthread_mutex_lock(&table->latch);
+    if (table->tx == NULL) {
+        table->txId = newTransactionId(table->log);
+        table->lastLSN = 0;
+    }
+    table->savepointLSN = table->lastLSN;
+    table->savepointIndexChanges = table->numIndexChanges;
+}
+
+static RC writeCheckpoint(RM_TableData *rel, LSN *lsn);
+static RC rollBack(RM_TableData *rel);
+static void clearIndexChanges(RM_TableMgmtData *table);
+
+// End the running transaction with a WAL_COMMIT or WAL_ABORT record and
+// release the latch; a commit returns once it is durable. With type 0 no
+// record is logged, leaving a transaction that could not be rolled back
+// to recovery.
+static RC finishChange(RM_TableData *rel, WAL_RecordType type) {
+    RM_TableMgmtData *table = tableData(rel);
+    WAL_Record record = {.length = sizeof(WAL_Record), .type = type};
+    LSN lsn = 0, checkpointLSN = 0;
+    RC rc = RC_OK;
+    if (table->lastLSN != 0 && type != 0) {
+        rc = logRecord(rel, &record, &lsn);
+    }
+    if (rc == RC_OK && lsn != 0 && lsn - table->checkpointLSN >= CHECKPOINT_INTERVAL) {
+        rc = writeCheckpoint(rel, &checkpointLSN);
+    }
+    clearIndexChanges(table);
+    pthread_mutex_unlock(&table->latch);
+    if (rc == RC_OK && lsn != 0 && type == WAL_COMMIT) {
+        rc = flushLog(table->log, lsn);
+    }
+    if (rc == RC_OK && checkpointLSN != 0) {
+        rc = setCheckpoint(table->log, checkpointLSN);
+    }
+    return rc;
+}
+
+static RC endChange(RM_TableData *rel, RC rc) {
+    RM_TableMgmtData *table = tableData(rel);
+    RC rollBackRc = rc != RC_OK ? rollBack(rel) : RC_OK;
+    if (table->tx != NULL) {
+        pthread_mutex_unlock(&table->latch);
+        return rc;
+    }
+    RC endRc = finishChange(rel, rc == RC_OK ? WAL_COMMIT : rollBackRc == RC_OK ? WAL_ABORT : 0);
+    return rc != RC_OK ? rc : endRc;
+}
+
+// Copy of the metadata page, read with the latch held
+static RC readMeta(RM_TableData *rel, TableMetaPage *meta) {
+    BM_PageHandle page;
+    RC rc = pinPage(tablePool(rel), &page, 1);
+    if (rc != RC_OK) return rc;
+    memcpy(meta, page.data, sizeof(*meta));
+    return unpinPage(tablePool(rel), &page);
+}
+
+// Recovery. A table closed cleanly leaves its log empty, so records found
+// in it by openTable are those of a crash. They are replayed in the three
+// passes of ARIES: analysis reads the log from the last checkpoint on and
+// finds the pages that may have missed changes, each with the oldest change
+// it may have missed, and the transactions that did not finish; redo
+// repeats the changes from the oldest of those on, skipping the ones a
+// page's LSN shows it has; undo rolls the unfinished transactions back,
+// newest change first. Each undone update is logged as a compensation
+// record, which redo repeats and undo skips, so a crash during recovery
+// never undoes an update twice.
+//
+// Checkpoints are fuzzy: they log the buffer pool's dirty pages without
+// writing them. Only the pages dirty since before the previous checkpoint
+// are written first, so redo never starts more than two checkpoints back.
+static RC writeCheckpoint(RM_TableData *rel, LSN *lsn) {
+    RM_TableMgmtData *table = tableData(rel);
+    RC rc = flushPagesBefore(&table->pool, table->checkpointLSN);
+    if (rc == RC_OK) rc = syncPool(&table->pool);
+    if (rc != RC_OK) return rc;
+
+    PageNumber pages[TABLE_POOL_SIZE];
+    LSN recLSNs[TABLE_POOL_SIZE];
+    int numPages;
+    getDirtyPageTable(&table->pool, pages, recLSNs, &numPages);
+    WAL_Record *record = (WAL_Record *)table->logBuffer;
+    WAL_Checkpoint *checkpoint = (WAL_Checkpoint *)(record + 1);
+    WAL_DirtyPage *dirty = (WAL_DirtyPage *)(checkpoint + 1);
+    for (int i = 0; i < numPages; i++) {
+        dirty[i].pageNum = pages[i];
+        dirty[i].recLSN = recLSNs[i];
+    }
+    checkpoint->numDirtyPages = numPages;
+    checkpoint->padding = 0;
+    memset(record, 0, sizeof(*record));
+    record->length = (char *)(dirty + numPages) - table->logBuffer;
+    record->type = WAL_CHECKPOINT;
+    rc = appendLogRecord(table->log, record, lsn);
+    if (rc == RC_OK) {
+        table->checkpointLSN = *lsn;
+    }
+    return rc;
+}
+
+// The page update an update or compensation record carries
+static WAL_PageUpdate *pageUpdate(WAL_Record *record) {
+    if (record->type == WAL_COMPENSATION) {
+        return (WAL_PageUpdate *)((WAL_Compensation *)(record + 1) + 1);
+    }
+    return (WAL_PageUpdate *)(record + 1);
+}
+
+// Copy the runs of an update into a page: their bytes after the update,
+// or before it to undo it
+static void applyRuns(WAL_PageUpdate *update, char *data, bool undo) {
+    char *in = (char *)(update + 1);
+    for (int i = 0; i < update->numRuns; i++) {
+        WAL_Run run;
+        memcpy(&run, in, sizeof(run));
+        memcpy(data + run.offset, in + sizeof(run) + (undo ? 0 : run.length), run.length);
+        in += sizeof(run) + 2 * run.length;
+    }
+}
+
+// Undo an update of the running transaction and log a compensation record
+// that undoes it again when repeated, its runs going from the bytes after
+// the update back to the ones before
+static RC undoUpdate(RM_TableData *rel, WAL_Record *update) {
+    RM_TableMgmtData *table = tableData(rel);
+    WAL_PageUpdate *from = pageUpdate(update);
+    WAL_Record *record = (WAL_Record *)table->logBuffer;
+    WAL_Compensation *compensation = (WAL_Compensation *)(record + 1);
+    WAL_PageUpdate *to = (WAL_PageUpdate *)(compensation + 1);
+    BM_PageHandle page;
+    LSN lsn;
+
+    RC rc = pinPage(&table->pool, &page, from->pageNum);
+    if (rc != RC_OK) return rc;
+    applyRuns(from, page.data, true);
+
+    compensation->undoNextLSN = update->prevLSN;
+    *to = *from;
+    char *in = (char *)(from + 1);
+    char *out = (char *)(to + 1);
+    for (int i = 0; i < from->numRuns; i++) {
+        WAL_Run run;
+        memcpy(&run, in, sizeof(run));
+        memcpy(out, &run, sizeof(run));
+        memcpy(out + sizeof(run), in + sizeof(run) + run.length, run.length);
+        memcpy(out + sizeof(run) + run.length, in + sizeof(run), run.length);
+        in += sizeof(run) + 2 * run.length;
+        out += sizeof(run) + 2 * run.length;
+    }
+    record->length = out - table->logBuffer;
+    record->type = WAL_COMPENSATION;
+    rc = logRecord(rel, record, &lsn);
+    if (rc == RC_OK) {
+        memcpy(page.data, &lsn, sizeof(LSN));
+        rc = markDirtyLSN(&table->pool, &page, lsn);
+    }
+    RC unpinRc = unpinPage(&table->pool, &page);
+    return rc != RC_OK ? rc : unpinRc;
+}
+
+// Undo a record of the running transaction; *undoNextLSN is set to its
+// record to undo next. Only updates change pages: a compensation record
+// names the record before the update it undid, so undo goes on from there.
+static RC undoRecord(RM_TableData *rel, WAL_Record *record, LSN *undoNextLSN) {
+    switch (record->type) {
+        case WAL_UPDATE:
+            *undoNextLSN = record->prevLSN;
+            return undoUpdate(rel, record);
+        case WAL_COMPENSATION:
+            *undoNextLSN = ((WAL_Compensation *)(record + 1))->undoNextLSN;
+            return RC_OK;
+        default:
+            *undoNextLSN = record->prevLSN;
+            return RC_OK;
+    }
+}
+
+// What analysis finds. Page numbers and transaction ids are small and
+// dense, so both tables are arrays indexed by them, 0 meaning no entry.
+typedef struct Recovery {
+    LSN *recLSNs; // oldest change each page may have missed
+    int numPages;
+    LSN *lastLSNs; // last record of each transaction that did not finish
+    int numTransactions;
+    char *buffer; // the record read last
+    int bufferSize;
+} Recovery;
+
+// Grow an array of LSNs to hold index i, the new entries 0
+static RC growLSNs(LSN **lsns, int *size, int i) {
+    if (i < *size) return RC_OK;
+    int newSize = *size > 0 ? *size : 64;
+    while (newSize <= i) {
+        newSize *= 2;
+    }
+    LSN *grown = (LSN *)realloc(*lsns, newSize * sizeof(LSN));
+    if (grown == NULL) return RC_MEMORY_ALLOCATION_FAIL;
+    memset(grown + *size, 0, (newSize - *size) * sizeof(LSN));
+    *lsns = grown;
+    *size = newSize;
+    return RC_OK;
+}
+
+static RC notePageChange(Recovery *recovery, int pageNum, LSN lsn) {
+    RC rc = growLSNs(&recovery->recLSNs, &recovery->numPages, pageNum);
+    if (rc == RC_OK && recovery->recLSNs[pageNum] == 0) {
+        recovery->recLSNs[pageNum] = lsn;
+    }
+    return rc;
+}
+
+static RC analyze(RM_TableData *rel, Recovery *recovery) {
+    WAL_Log *log = tableData(rel)->log;
+    LSN lsn = getCheckpointLSN(log) != 0 ? getCheckpointLSN(log) : getStartLSN(log);
+    LSN end = getDurableLSN(log);
+    while (lsn < end) {
+        RC rc = readLogRecord(log, lsn, &recovery->buffer, &recovery->bufferSize);
+        if (rc != RC_OK) return rc;
+        WAL_Record *record = (WAL_Record *)recovery->buffer;
+        switch (record->type) {
+            case WAL_UPDATE:
+            case WAL_COMPENSATION:
+                rc = notePageChange(recovery, pageUpdate(record)->pageNum, lsn);
+                if (rc == RC_OK) rc = growLSNs(&recovery->lastLSNs, &recovery->numTransactions, record->txId);
+                if (rc == RC_OK) recovery->lastLSNs[record->txId] = lsn;
+                break;
+            case WAL_COMMIT:
+            case WAL_ABORT:
+                if (record->txId < recovery->numTransactions) {
+                    recovery->lastLSNs[record->txId] = 0;
+                }
+                break;
+            case WAL_CHECKPOINT: {
+                WAL_Checkpoint *checkpoint = (WAL_Checkpoint *)(record + 1);
+                WAL_DirtyPage *dirty = (WAL_DirtyPage *)(checkpoint + 1);
+                for (int i = 0; rc == RC_OK && i < checkpoint->numDirtyPages; i++) {
+                    rc = notePageChange(recovery, dirty[i].pageNum, dirty[i].recLSN);
+                }
+                break;
+            }
+        }
+        if (rc != RC_OK) return rc;
+        lsn += record->length;
+    }
+    return RC_OK;
+}
+
+// Repeat an update on its page unless the page has it already
+static RC redoUpdate(RM_TableData *rel, WAL_PageUpdate *update, LSN lsn) {
+    BM_PageHandle page;
+    LSN pageLSN;
+    RC rc = pinPage(tablePool(rel), &page, update->pageNum);
+    if (rc != RC_OK) return rc;
+    memcpy(&pageLSN, page.data, sizeof(LSN));
+    if (pageLSN < lsn) {
+        applyRuns(update, page.data, false);
+        memcpy(page.data, &lsn, sizeof(LSN));
+        rc = markDirtyLSN(tablePool(rel), &page, lsn);
+    }
+    RC unpinRc = unpinPage(tablePool(rel), &page);
+    return rc != RC_OK ? rc : unpinRc;
+}
+
+static RC redo(RM_TableData *rel, Recovery *recovery) {
+    WAL_Log *log = tableData(rel)->log;
+    LSN lsn = 0;
+    int lastPage = -1;
+    for (int i = 0; i < recovery->numPages; i++) {
+        if (recovery->recLSNs[i] != 0) {
+            if (lsn == 0 || recovery->recLSNs[i] < lsn) lsn = recovery->recLSNs[i];
+            lastPage = i;
+        }
+    }
+    if (lastPage < 0) return RC_OK;
+
+    // Pages the table grew by may be missing from the file; the pool would
+    // make up contents for them rather than the zeros they were logged from
+    RC rc = ensurePoolCapacity(tablePool(rel), lastPage + 1);
+    LSN end = getDurableLSN(log);
+    while (rc == RC_OK && lsn < end) {
+        rc = readLogRecord(log, lsn, &recovery->buffer, &recovery->bufferSize);
+        if (rc != RC_OK) return rc;
+        WAL_Record *record = (WAL_Record *)recovery->buffer;
+        if (record->type == WAL_UPDATE || record->type == WAL_COMPENSATION) {
+            WAL_PageUpdate *update = pageUpdate(record);
+            LSN recLSN = update->pageNum < recovery->numPages ? recovery->recLSNs[update->pageNum] : 0;
+            if (recLSN != 0 && lsn >= recLSN) {
+                rc = redoUpdate(rel, update, lsn);
+            }
+        }
+        lsn += record->length;
+    }
+    return rc;
+}
+
+// A transaction undo rolls back
+typedef struct Loser {
+    int txId;
+    LSN lastLSN; // its last record, compensations included
+    LSN undoNextLSN; // its next record to undo, 0 when done
+} Loser;
+
+static RC undo(RM_TableData *rel, Recovery *recovery) {
+    RM_TableMgmtData *table = tableData(rel);
+    Loser *losers = NULL;
+    int numLosers = 0;
+    RC rc = RC_OK;
+
+    for (int i = 0; i < recovery->numTransactions; i++) {
+        if (recovery->lastLSNs[i] != 0) {
+            Loser *grown = (Loser *)realloc(losers, (numLosers + 1) * sizeof(Loser));
+            if (grown == NULL) {
+                free(losers);
+                return RC_MEMORY_ALLOCATION_FAIL;
+            }
+            losers = grown;
+            losers[numLosers].txId = i;
+            losers[numLosers].lastLSN = losers[numLosers].undoNextLSN = recovery->lastLSNs[i];
+            numLosers++;
+        }
+    }
+
+    // The newest record of all losers first, until every one is done
+    while (rc == RC_OK) {
+        Loser *loser = NULL;
+        for (int i = 0; i < numLosers; i++) {
+            if (losers[i].undoNextLSN != 0 && (loser == NULL || losers[i].undoNextLSN > loser->undoNextLSN)) {
+                loser = &losers[i];
+            }
+        }
+        if (loser == NULL) break;
+        rc = readLogRecord(table->log, loser->undoNextLSN, &recovery->buffer, &recovery->bufferSize);
+        if (rc != RC_OK) break;
+
+        table->txId = loser->txId;
+        table->lastLSN = loser->lastLSN;
+        rc = undoRecord(rel, (WAL_Record *)recovery->buffer, &loser->undoNextLSN);
+        if (rc == RC_OK && loser->undoNextLSN == 0) {
+            WAL_Record abort = {.length = sizeof(WAL_Record), .type = WAL_ABORT};
+            LSN lsn;
+            rc = logRecord(rel, &abort, &lsn);
+        }
+        loser->lastLSN = table->lastLSN;
+    }
+    free(losers);
+    return rc;
+}
+
+// Bring the table back to its committed changes after a crash. The pages
+// are then written and the log emptied, so a crash right after needs no
+// recovery again. *recovered tells whether there was a crash.
+static RC recoverTable(RM_TableData *rel, bool *recovered) {
+    RM_TableMgmtData *table = tableData(rel);
+    Recovery recovery;
+    memset(&recovery, 0, sizeof(recovery));
+
+    *recovered = getDurableLSN(table->log) > getStartLSN(table->log);
+    if (!*recovered) return RC_OK;
+    RC rc = analyze(rel, &recovery);
+    if (rc == RC_OK) rc = redo(rel, &recovery);
+    if (rc == RC_OK) rc = undo(rel, &recovery);
+    if (rc == RC_OK) rc = forceFlushPool(&table->pool);
+    if (rc == RC_OK) rc = syncPool(&table->pool);
+    if (rc == RC_OK) rc = truncateLog(table->log);
+    free(recovery.recLSNs);
+    free(recovery.lastLSNs);
+    free(recovery.buffer);
+    return rc;
+}
+
 // table and manager
 RC initRecordManager (void *mgmtData) {
     initStorageManager();
@@ -31,6 +565,11 @@ RC createTable(char *name, Schema *schema) {
         return rc;  // Return error if page file creation fails
     }
 
+    // A log left by an earlier table of the same name does not apply to this one
+    char logName[64];
+    logFileName(name, logName);
+    remove(logName);
+
     // Initialize buffer pool for managing pages
     BM_BufferPool *buffer_pool = MAKE_POOL();
     rc = initBufferPool(buffer_pool, local_fname, 4, RS_FIFO, NULL);  // 4 pages, FIFO replacement
@@ -75,13 +614,12 @@ RC createTable(char *name, Schema *schema) {
     }
     free(serializedSchema);
 
-    int numTuples = 0;
     rc = pinPage(buffer_pool, page, 1);
     if (rc != RC_OK) {
         shutdownBufferPool(buffer_pool);
         return rc;  // Handle pinning error
     }
-    memcpy(page->data, &numTuples, sizeof(int));
+    memset(page->data, 0, PAGE_SIZE);  // No tuples and no indexes yet
     markDirty(buffer_pool, page);
     unpinPage(buffer_pool, page);
     forcePage(buffer_pool, page);
@@ -133,7 +671,7 @@ Schema *deserializeSchema(char *data) {
     sscanf(pos, "%d", &schema->numAttr);
 
     // Allocate memory for schema fields based on the number of attributes
-    schema->attrNames = (char **)malloc(3 * sizeof(char *));
+    schema->attrNames = (char **)malloc(schema->numAttr * sizeof(char *));
     schema->dataTypes = (DataType *)malloc(schema->numAttr * sizeof(DataType));
     schema->typeLength = (int *)malloc(schema->numAttr * sizeof(int));
 
@@ -240,75 +778,301 @@ Schema *deserializeSchema(char *data) {
 
 
 
+// Secondary indexes. The index on attribute n of table t is the B+ tree in
+// the file t.idxn; its keys are the attribute of a record followed by the
+// record's page and slot, and the RID is stored with the key as well.
+static void indexFileName(char *table, int attrNum, char *out) {
+    snprintf(out, 64, "%s.idx%d", table, attrNum);
+}
+
+// Bytes an attribute takes up in a record
+static int attrLength(Schema *schema, int attrNum) {
+    switch (schema->dataTypes[attrNum]) {
+        case DT_INT:
+            return sizeof(int);
+        case DT_FLOAT:
+            return sizeof(float);
+        case DT_BOOL:
+            return sizeof(bool);
+        case DT_STRING:
+            return schema->typeLength[attrNum];
+    }
+    return 0;
+}
+
+// Largest order whose nodes, keys, RIDs and header, fit in a page
+static int indexOrder(int keySize) {
+    return (PAGE_SIZE - 64) / (keySize + (int)sizeof(RID)) - 1;
+}
+
+// Key of a record in the index on attrNum; a string is allocated
+static RC indexKey(Schema *schema, int attrNum, Record *record, Value *key) {
+    Value *value;
+    RC rc = getAttr(record, schema, attrNum, &value);
+    if (rc != RC_OK) return rc;
+    key[0] = *value;
+    free(value);
+    key[1].dt = key[2].dt = DT_INT;
+    key[1].v.intV = record->id.page;
+    key[2].v.intV = record->id.slot;
+    return RC_OK;
+}
+
+static void freeIndexKey(Value *key) {
+    if (key[0].dt == DT_STRING) {
+        free(key[0].v.stringV);
+    }
+}
+
+static RM_Index *findIndex(RM_TableMgmtData *table, int attrNum) {
+    for (int i = 0; i < table->numIndexes; i++) {
+        if (table->indexes[i].attrNum == attrNum) {
+            return &table->indexes[i];
+        }
+    }
+    return NULL;
+}
+
+// Record the attributes the open indexes are on in the metadata page
+static RC writeIndexList(RM_TableData *rel) {
+    RM_TableMgmtData *table = tableData(rel);
+    TableMetaPage meta;
+    BM_PageHandle page;
+
+    beginChange(rel);
+    RC rc = pinForUpdate(rel, &page, 1);
+    if (rc == RC_OK) {
+        memcpy(&meta, page.data, sizeof(meta));
+        meta.numIndexes = table->numIndexes;
+        for (int i = 0; i < table->numIndexes; i++) {
+            meta.indexAttrs[i] = table->indexes[i].attrNum;
+        }
+        memcpy(page.data, &meta, sizeof(meta));
+        rc = unpinUpdated(rel, &page);
+    }
+    return endChange(rel, rc);
+}
+
+// Create the empty index file of an attribute
+static RC createIndexFile(RM_TableData *rel, int attrNum, char *fileName) {
+    Schema *schema = rel->schema;
+    DataType keyTypes[3] = {schema->dataTypes[attrNum], DT_INT, DT_INT};
+    int keyLengths[3] = {schema->typeLength[attrNum], 0, 0};
+    int keySize = attrLength(schema, attrNum) + 2 * sizeof(int);
+    indexFileName(rel->name, attrNum, fileName);
+    return createBtreeWithKey(fileName, 3, keyTypes, keyLengths, indexOrder(keySize));
+}
+
+static RC buildIndex(RM_TableData *rel, RM_Index *index);
+
+// Open the indexes the metadata page lists. Index files are not logged, so
+// after a crash they are built anew from the recovered records.
+static RC openIndexes(RM_TableData *rel, bool rebuild) {
+    RM_TableMgmtData *table = tableData(rel);
+    TableMetaPage meta;
+
+    RC rc = readMeta(rel, &meta);
+    if (rc != RC_OK) return rc;
+    if (meta.numIndexes < 0 || meta.numIndexes > RM_MAX_INDEXES) {
+        return RC_READ_FAILED;
+    }
+
+    for (int i = 0; i < meta.numIndexes; i++) {
+        char fileName[64];
+        RM_Index *index = &table->indexes[table->numIndexes];
+        index->attrNum = meta.indexAttrs[i];
+        if (rebuild) {
+            rc = createIndexFile(rel, index->attrNum, fileName);
+            if (rc != RC_OK) return rc;
+        } else {
+            indexFileName(rel->name, index->attrNum, fileName);
+        }
+        rc = openBtree(&index->tree, fileName);
+        if (rc != RC_OK) return rc;
+        if (rebuild && (rc = buildIndex(rel, index)) != RC_OK) {
+            closeBtree(index->tree);
+            return rc;
+        }
+        table->numIndexes++;
+    }
+    return RC_OK;
+}
+
 
 RC openTable(RM_TableData *rel, char *name) {
     // Step 1: Construct the file name for the table
-    SM_FileHandle fh;
     char local_fname[64] = {'\0'};
     strcat(local_fname, name);
     // strcat(local_fname, ".bin");
 
     // Step 2: Initialize buffer pool
-    BM_BufferPool *buffer_pool = MAKE_POOL();
-    RC rc = initBufferPool(buffer_pool, local_fname, 4, RS_FIFO, NULL);  // 4 pages, FIFO replacement
+    RM_TableMgmtData *table = (RM_TableMgmtData *)calloc(1, sizeof(RM_TableMgmtData));
+    BM_BufferPool *buffer_pool = &table->pool;
+    rel->name = strdup(name);   // Duplicate name string for persistence, the pool keeps a pointer to it
+    RC rc = initBufferPool(buffer_pool, rel->name, TABLE_POOL_SIZE, RS_LRU, NULL);
     if (rc != RC_OK) {
+        free(rel->name);
+        free(table);
         return rc;  // Return error if buffer pool initialization fails
     }
-    forceFlushPool(buffer_pool);
-    // Step 3: Pin the first page to read the schema
-    BM_PageHandle *page = MAKE_PAGE_HANDLE();
-    rc = pinPage(buffer_pool, page, 0);  // First page contains schema
-    //printf("Contents of page->data in openTable before deserialization: %s\n", page->data);
-
-    openPageFile(name, &fh);
-    char buffer[PAGE_SIZE];
-    //printf("Direct read from disk in openTable: %s\n", buffer);
-    closePageFile(&fh);
 
+    // Step 3: Pin the first page to read the schema
+    BM_PageHandle page;
+    rc = pinPage(buffer_pool, &page, 0);  // First page contains schema
     if (rc != RC_OK) {
         shutdownBufferPool(buffer_pool);
+        free(rel->name);
+        free(table);
         return rc;  // Handle pinning error
     }
 
     // Step 4: Deserialize schema from page data
-    //printf("Contents of page->data being passed to deserializeSchema: %s\n", buffer);
-
-    Schema *schema = deserializeSchema(buffer);
+    Schema *schema = deserializeSchema(page.data);
+    unpinPage(buffer_pool, &page);
     if (schema == NULL) {
-        unpinPage(buffer_pool, page);
         shutdownBufferPool(buffer_pool);
+        free(rel->name);
+        free(table);
         printf("NULL Schema\n");
         return -1;  // Handle deserialization failure
     }
 
     // Step 5: Populate the RM_TableData structure
-    rel->name = strdup(name);   // Duplicate name string for persistence
     rel->schema = schema;       // Assign the deserialized schema
-    rel->mgmtData = buffer_pool;  // Store buffer pool in mgmtData for future access
+    rel->mgmtData = table;      // Store the pool and the indexes in mgmtData for future access
+    int recordSize = getRecordSize(schema);
+    int maxTuple = recordSize < (int)sizeof(RID) ? (int)sizeof(RID) : recordSize;
+    table->maxTupleSpace = sizeof(RID) + maxTuple + sizeof(unsigned short);
+    table->recordBuffer = (char *)malloc(recordSize);
+    table->tupleBuffer = (char *)malloc(sizeof(RID) + maxTuple);
+
+    // Step 6: Open the log; the pool writes no page before the log has its
+    // changes. A log with records in it is left by a crash: recover from it.
+    char logName[64];
+    logFileName(name, logName);
+    pthread_mutexattr_t latchAttr;
+    pthread_mutexattr_init(&latchAttr);
+    pthread_mutexattr_settype(&latchAttr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&table->latch, &latchAttr);
+    pthread_mutexattr_destroy(&latchAttr);
+    for (int i = 0; i < RM_MAX_PAGE_IMAGES; i++) {
+        table->images[i].pageNum = NO_PAGE;
+        table->images[i].data = (char *)malloc(PAGE_SIZE);
+    }
+    table->logBuffer = (char *)malloc(LOG_BUFFER_SIZE);
+    rc = openLog(&table->log, logName);
+    if (rc != RC_OK) {
+        closeTable(rel);
+        return rc;
+    }
+    setPoolLog(buffer_pool, table->log);
+    bool recovered;
+    rc = recoverTable(rel, &recovered);
+    if (rc != RC_OK) {
+        closeTable(rel);
+        return rc;
+    }
+    table->checkpointLSN = getEndLSN(table->log);
 
-    // Step 6: Unpin the page and clean up
-    unpinPage(buffer_pool, page);
+    // Step 7: Open the indexes listed on the metadata page
+    rc = openIndexes(rel, recovered);
+    if (rc != RC_OK) {
+        closeTable(rel);
+        return rc;
+    }
 
     return RC_OK;  // Successfully opened the table
 }
 
 
 RC closeTable(RM_TableData *rel) {
-    // Step 1: Free the schema if it exists
+    // Step 1: Close the indexes, then write back every dirty page and release the buffer pool
+    RM_TableMgmtData *table = tableData(rel);
+    if (table != NULL) {
+        RC rc = RC_OK;
+        // A transaction this thread left open is rolled back
+        pthread_mutex_lock(&table->latch);
+        if (table->tx != NULL) {
+            rc = abortTransaction(table->tx);
+        }
+        pthread_mutex_unlock(&table->latch);
+        for (int i = 0; i < table->numIndexes; i++) {
+            RC closeRc = closeBtree(table->indexes[i].tree);
+            if (rc == RC_OK)
+                rc = closeRc;
+        }
+        table->numIndexes = 0;
+
+        // With every page written back and on disk, the log has served its purpose
+        if (table->log != NULL) {
+            RC flushRc = forceFlushPool(&table->pool);
+            if (flushRc == RC_OK)
+                flushRc = syncPool(&table->pool);
+            if (flushRc == RC_OK)
+                flushRc = truncateLog(table->log);
+            if (rc == RC_OK)
+                rc = flushRc;
+        }
+        RC shutdownRc = shutdownBufferPool(&table->pool);
+        if (shutdownRc != RC_OK) {
+            return shutdownRc;
+        }
+        if (table->log != NULL) {
+            RC logRc = closeLog(table->log);
+            if (rc == RC_OK)
+                rc = logRc;
+        }
+        pthread_mutex_destroy(&table->latch);
+        free(table->indexChanges);
+        for (int i = 0; i < RM_MAX_PAGE_IMAGES; i++) {
+            free(table->images[i].data);
+        }
+        free(table->logBuffer);
+        free(table->recordBuffer);
+        free(table->tupleBuffer);
+        free(table);
+        rel->mgmtData = NULL;
+        if (rc != RC_OK) {
+            return rc;
+        }
+    }
+
+    // Step 2: Free the schema if it exists
     if (rel->schema != NULL) {
         freeSchema(rel->schema);
         rel->schema = NULL;
     }
-
-    // Step 2: Set other management data to NULL if needed
-    // rel->mgmtData is reserved for additional metadata, set to NULL for cleanup
-    rel->mgmtData = NULL;
+    free(rel->name);
+    rel->name = NULL;
 
     return RC_OK;
 }
 RC deleteTable(char *name) {
+    // Delete the index files listed on the metadata page first
+    SM_FileHandle fh;
+    TableMetaPage meta;
+    char buffer[PAGE_SIZE];
+    RC rc = openPageFile(name, &fh);
+    if (rc != RC_OK) {
+        return rc;
+    }
+    rc = readBlock(1, &fh, buffer);
+    closePageFile(&fh);
+    if (rc != RC_OK) {
+        return rc;
+    }
+    memcpy(&meta, buffer, sizeof(meta));
+    for (int i = 0; i < meta.numIndexes && i < RM_MAX_INDEXES; i++) {
+        char fileName[64];
+        indexFileName(name, meta.indexAttrs[i], fileName);
+        destroyPageFile(fileName);
+    }
+    char logName[64];
+    logFileName(name, logName);
+    remove(logName);
+
     // Use the storage manager function to delete the file
-    RC rc = destroyPageFile(name);
+    rc = destroyPageFile(name);
 
     // Return the result of the delete operation
     if (rc != RC_OK) {
@@ -318,288 +1082,1124 @@ RC deleteTable(char *name) {
     return RC_OK;
 }
 int getNumTuples(RM_TableData *rel) {
-    SM_FileHandle fh;
-    RC rc;
+    RM_TableMgmtData *table = tableData(rel);
+    TableMetaPage meta;
 
-    // Open the page file to read the tuple count
-    rc = openPageFile(rel->name, &fh);
+    // The tuple count lives in the metadata page (page 1)
+    pthread_mutex_lock(&table->latch);
+    RC rc = readMeta(rel, &meta);
+    pthread_mutex_unlock(&table->latch);
     if (rc != RC_OK) {
-        return -1; // Return -1 to indicate an error if file opening fails
-    }
-
-    // Allocate a buffer for reading the first page (metadata page)
-    char *data = (char *) malloc(PAGE_SIZE);
-    rc = readBlock(1, &fh, data);
-    if (rc != RC_OK) {
-        free(data);
-        closePageFile(&fh);
         return -1; // Return -1 to indicate an error if reading fails
     }
 
-    // Extract the tuple count from the metadata
-    int numTuples;
-    memcpy(&numTuples, data, sizeof(int));
-
-    // Clean up: free the buffer and close the file
-    free(data);
-    closePageFile(&fh);
-
-    return numTuples; // Return the retrieved tuple count
+    return meta.numTuples; // Return the retrieved tuple count
 }
 
+// Order of index entries: by value, then by RID
+static int compareIndexEntries(const void *a, const void *b) {
+    const Value *x = (const Value *)a;
+    const Value *y = (const Value *)b;
+    int c = 0;
+    switch (x[0].dt) {
+        case DT_INT:
+            c = (x[0].v.intV > y[0].v.intV) - (x[0].v.intV < y[0].v.intV);
+            break;
+        case DT_FLOAT:
+            c = (x[0].v.floatV > y[0].v.floatV) - (x[0].v.floatV < y[0].v.floatV);
+            break;
+        case DT_BOOL:
+            c = (int)x[0].v.boolV - (int)y[0].v.boolV;
+            break;
+        case DT_STRING:
+            c = strcmp(x[0].v.stringV, y[0].v.stringV);
+            break;
+    }
+    for (int i = 1; c == 0 && i < 3; i++) {
+        c = (x[i].v.intV > y[i].v.intV) - (x[i].v.intV < y[i].v.intV);
+    }
+    return c;
+}
 
-
-// handling records in a table
-RC insertRecord(RM_TableData *rel, Record *record) {
-    SM_FileHandle fh;
+// Fill a new index with the records already in the table: their keys are
+// sorted and handed to the bulk loader, which writes each node once
+static RC buildIndex(RM_TableData *rel, RM_Index *index) {
+    RM_ScanHandle scan;
+    Record record = {{0, 0}, NULL};
+    int numTuples = getNumTuples(rel);
+    int numEntries = 0;
     RC rc;
 
-    // Open the table file
-    rc = openPageFile(rel->name, &fh);
-    if (rc != RC_OK) return rc;
-
-    // Calculate record size and slots per page
-    int recordSize = getRecordSize(rel->schema);
-    int slotsPerPage = (PAGE_SIZE - sizeof(int)) / recordSize;
-
-    // Read metadata page (page 1)
-    char *metaData = (char *)malloc(PAGE_SIZE);
-    if (metaData == NULL) {
-        closePageFile(&fh);
-        return RC_WRITE_FAILED;
+    Value (*entries)[3] = malloc((numTuples > 0 ? numTuples : 1) * sizeof(*entries));
+    if (entries == NULL) return RC_MEMORY_ALLOCATION_FAIL;
+    rc = startScan(rel, &scan, NULL);
+    while (rc == RC_OK && (rc = next(&scan, &record)) == RC_OK) {
+        rc = indexKey(rel->schema, index->attrNum, &record, entries[numEntries]);
+        if (rc == RC_OK) numEntries++;
     }
-    memset(metaData, 0, PAGE_SIZE);
-    rc = readBlock(1, &fh, metaData);
-    if (rc != RC_OK) {
-        free(metaData);
-        closePageFile(&fh);
-        return rc;
+    closeScan(&scan);
+    free(record.data);
+
+    if (rc == RC_RM_NO_MORE_TUPLES) {
+        BT_BulkLoadHandle *bulk;
+        qsort(entries, numEntries, sizeof(*entries), compareIndexEntries);
+        rc = startBulkLoad(index->tree, INDEX_BUILD_FILL, &bulk);
+        for (int i = 0; rc == RC_OK && i < numEntries; i++) {
+            RID rid = {entries[i][1].v.intV, entries[i][2].v.intV};
+            rc = bulkLoadEntry(bulk, entries[i], rid);
+        }
+        if (rc == RC_OK) {
+            rc = finishBulkLoad(bulk);
+        } else {
+            finishBulkLoad(bulk);
+        }
+    }
+    for (int i = 0; i < numEntries; i++) {
+        freeIndexKey(entries[i]);
     }
+    free(entries);
+    return rc;
+}
 
-    // Get current number of tuples
-    int numTuples;
-    memcpy(&numTuples, metaData, sizeof(int));
+static RC createIndexLatched(RM_TableData *rel, int attrNum) {
+    RM_TableMgmtData *table = tableData(rel);
+    Schema *schema = rel->schema;
+    char fileName[64];
 
-    // Calculate target page and slot
-    int targetPage = 2 + (numTuples / slotsPerPage);
-    int targetSlot = numTuples % slotsPerPage;
+    if (attrNum < 0 || attrNum >= schema->numAttr) return RC_RM_INVALID_ATTRIBUTE;
+    if (findIndex(table, attrNum) != NULL) return RC_RM_INDEX_EXISTS;
+    if (table->numIndexes == RM_MAX_INDEXES) return RC_RM_TOO_MANY_INDEXES;
 
-    // Read or create target page
-    char *pageData = (char *)malloc(PAGE_SIZE);
-    if (pageData == NULL) {
-        free(metaData);
-        closePageFile(&fh);
-        return RC_WRITE_FAILED;
-    }
-    memset(pageData, 0, PAGE_SIZE);
+    RC rc = createIndexFile(rel, attrNum, fileName);
+    if (rc != RC_OK) return rc;
 
-    // Ensure capacity
-    rc = ensureCapacity(targetPage, &fh);
+    RM_Index *index = &table->indexes[table->numIndexes];
+    index->attrNum = attrNum;
+    rc = openBtree(&index->tree, fileName);
     if (rc != RC_OK) {
-        free(metaData);
-        free(pageData);
-        closePageFile(&fh);
-        return rc;
-    }
-
-    // Read existing page data if it exists
-    rc = readBlock(targetPage, &fh, pageData);
-    if (rc != RC_OK && rc != RC_READ_NON_EXISTING_PAGE) {
-        free(metaData);
-        free(pageData);
-        closePageFile(&fh);
+        deleteBtree(fileName);
         return rc;
     }
-
-    // Write record data
-    int offset = targetSlot * recordSize;
-    memcpy(pageData + offset, record->data, recordSize);
-
-    // Write page back
-    rc = writeBlock(targetPage, &fh, pageData);
+    rc = buildIndex(rel, index);
     if (rc != RC_OK) {
-        free(metaData);
-        free(pageData);
-        closePageFile(&fh);
+        closeBtree(index->tree);
+        deleteBtree(fileName);
         return rc;
     }
+    table->numIndexes++;
+    return writeIndexList(rel);
+}
 
-    // Update number of tuples
-    numTuples++;
-    memcpy(metaData, &numTuples, sizeof(int));
+// Index the table on an attribute. The index is built from the records the
+// table holds and is kept up to date by every insert, update and delete.
+// The latch is held throughout, so no change misses the new index. Index
+// files are not logged, so a transaction cannot create or drop one; the
+// latch waits for the transactions of other threads.
+RC createIndex(RM_TableData *rel, int attrNum) {
+    RM_TableMgmtData *table = tableData(rel);
+    pthread_mutex_lock(&table->latch);
+    RC rc = table->tx != NULL ? RC_RM_TRANSACTION_OPEN : createIndexLatched(rel, attrNum);
+    pthread_mutex_unlock(&table->latch);
+    return rc;
+}
 
-    // Write updated metadata
-    rc = writeBlock(1, &fh, metaData);
-    if (rc != RC_OK) {
-        free(metaData);
-        free(pageData);
-        closePageFile(&fh);
-        return rc;
-    }
+static RC dropIndexLatched(RM_TableData *rel, int attrNum) {
+    RM_TableMgmtData *table = tableData(rel);
+    char fileName[64];
 
-    // Set record ID
-    record->id.page = targetPage;
-    record->id.slot = targetSlot;
+    RM_Index *index = findIndex(table, attrNum);
+    if (index == NULL) return RC_RM_INDEX_NOT_FOUND;
+    RC rc = closeBtree(index->tree);
+    *index = table->indexes[--table->numIndexes];
 
-    // Cleanup
-    free(metaData);
-    free(pageData);
-    closePageFile(&fh);
+    RC writeRc = writeIndexList(rel);
+    if (rc == RC_OK) rc = writeRc;
+    indexFileName(rel->name, attrNum, fileName);
+    RC deleteRc = deleteBtree(fileName);
+    return rc != RC_OK ? rc : deleteRc;
+}
 
-    return RC_OK;
+// Remove the index on an attribute and its file, with the latch held so
+// that no change is using its tree when it is closed
+RC dropIndex(RM_TableData *rel, int attrNum) {
+    RM_TableMgmtData *table = tableData(rel);
+    pthread_mutex_lock(&table->latch);
+    RC rc = table->tx != NULL ? RC_RM_TRANSACTION_OPEN : dropIndexLatched(rel, attrNum);
+    pthread_mutex_unlock(&table->latch);
+    return rc;
 }
 
-// Delete a record with the specified RID
-RC deleteRecord(RM_TableData *rel, RID id) {
-    SM_FileHandle fh;
-    RC rc;
+// Data pages are slotted: a header, then a directory of one entry per slot
+// that grows up from it, while the tuples fill the page from its end down.
+// A RID names a page and an entry of its directory, so a tuple may move
+// within its page without its RID changing.
+//
+// Every tuple takes at least a RID and its directory entry, which bounds
+// the slots of a page. The header keeps one bit per slot that is set while
+// the slot holds a record, so scans find the records of a page with word
+// operations on the bitmap instead of looking at every directory entry.
+#define MAX_PAGE_SLOTS (PAGE_SIZE / (sizeof(RID) + sizeof(unsigned short)))
+#define LIVE_WORDS ((MAX_PAGE_SLOTS + 63) / 64)
+
+typedef struct DataPageHeader {
+    LSN pageLSN; // Last logged change, see unpinUpdated
+    PageNumber nextFreePage; // Free list link, see pushFreePage
+    int numSlots; // Entries in the slot directory
+    int tupleStart; // Offset of the lowest tuple
+    int garbage; // Bytes of removed tuples above tupleStart
+    uint64_t live[LIVE_WORDS]; // Slots holding a record, a tuple or a FORWARD
+} DataPageHeader;
+
+// A directory entry holds the offset of its tuple, 0 for a free slot, and
+// flags in the bits above it. A record that outgrew its page in an update
+// is stored in a MOVED tuple on another page, which starts with the RID of
+// the record, and its own slot keeps a FORWARD tuple with the RID of that.
+#define SLOT_OFFSET 0x0FFF
+#define SLOT_MOVED 0x4000
+#define SLOT_FORWARD 0x8000
+
+#if PAGE_SIZE > SLOT_OFFSET + 1
+#error "tuple offsets do not fit in a slot directory entry"
+#endif
+
+static DataPageHeader *pageHeader(BM_PageHandle *page) {
+    return (DataPageHeader *)page->data;
+}
 
-    // Open the table file
-    rc = openPageFile(rel->name, &fh);
-    if (rc != RC_OK) return rc;
+static unsigned short *slotDirectory(BM_PageHandle *page) {
+    return (unsigned short *)(page->data + sizeof(DataPageHeader));
+}
 
-    // Calculate record size
-    int recordSize = getRecordSize(rel->schema);
+static char *tupleAt(BM_PageHandle *page, int slot) {
+    return page->data + (slotDirectory(page)[slot] & SLOT_OFFSET);
+}
 
-    // Read the page
-    char *pageData = (char *)malloc(PAGE_SIZE);
-    rc = readBlock(id.page, &fh, pageData);
-    if (rc != RC_OK) {
-        free(pageData);
-        closePageFile(&fh);
-        return rc;
+static void initDataPage(BM_PageHandle *page) {
+    DataPageHeader *header = pageHeader(page);
+    header->pageLSN = 0;
+    header->nextFreePage = 0;
+    header->numSlots = 0;
+    header->tupleStart = PAGE_SIZE;
+    header->garbage = 0;
+    memset(header->live, 0, sizeof(header->live));
+}
+
+static bool slotLive(BM_PageHandle *page, int slot) {
+    return (pageHeader(page)->live[slot / 64] >> (slot % 64)) & 1;
+}
+
+static void setSlotLive(BM_PageHandle *page, int slot, bool live) {
+    uint64_t bit = (uint64_t)1 << (slot % 64);
+    if (live) {
+        pageHeader(page)->live[slot / 64] |= bit;
+    } else {
+        pageHeader(page)->live[slot / 64] &= ~bit;
     }
+}
 
-    // Mark the record as deleted
-    int offset = id.slot * recordSize;
-    char deletionMarker[] = "~!@#$";
-    memcpy(pageData + offset, deletionMarker, 5);
+// First slot from slot on that holds a record, numSlots when there is none
+static int nextLiveSlot(BM_PageHandle *page, int slot) {
+    DataPageHeader *header = pageHeader(page);
+    if (slot >= header->numSlots) {
+        return header->numSlots;
+    }
+    int word = slot / 64;
+    uint64_t bits = header->live[word] & (~(uint64_t)0 << (slot % 64));
+    while (bits == 0) {
+        if (++word >= (int)LIVE_WORDS) {
+            return header->numSlots;
+        }
+        bits = header->live[word];
+    }
+    return word * 64 + __builtin_ctzll(bits);
+}
 
-    // Write the modified page back
-    rc = writeBlock(id.page, &fh, pageData);
-    free(pageData);
-    if (rc != RC_OK) {
-        closePageFile(&fh);
-        return rc;
+// Tuples hold the attributes of a record one after the other, strings at
+// their length and followed by a zero byte unless they fill the attribute.
+// A tuple is at least as long as a RID, so any slot can take a FORWARD.
+static int encodeTuple(Schema *schema, const char *data, char *out) {
+    int length = 0;
+    for (int i = 0; i < schema->numAttr; i++) {
+        int size = attrLength(schema, i);
+        if (schema->dataTypes[i] == DT_STRING) {
+            const char *end = memchr(data, '\0', size);
+            int n = end != NULL ? end - data : size;
+            memcpy(out + length, data, n);
+            length += n;
+            if (n < size) {
+                out[length++] = '\0';
+            }
+        } else {
+            memcpy(out + length, data, size);
+            length += size;
+        }
+        data += size;
     }
+    if (length < (int)sizeof(RID)) {
+        memset(out + length, 0, sizeof(RID) - length);
+        length = sizeof(RID);
+    }
+    return length;
+}
 
-    // Close the file
-    closePageFile(&fh);
+// Record data of a tuple, strings padded with zeros to their attribute
+static void decodeTuple(Schema *schema, const char *in, char *data) {
+    for (int i = 0; i < schema->numAttr; i++) {
+        int size = attrLength(schema, i);
+        if (schema->dataTypes[i] == DT_STRING) {
+            const char *end = memchr(in, '\0', size);
+            int n = end != NULL ? end - in : size;
+            memcpy(data, in, n);
+            memset(data + n, 0, size - n);
+            in += n < size ? n + 1 : n;
+        } else {
+            memcpy(data, in, size);
+            in += size;
+        }
+        data += size;
+    }
+}
 
-    return RC_OK;
+static int encodedLength(Schema *schema, const char *in) {
+    int length = 0;
+    for (int i = 0; i < schema->numAttr; i++) {
+        int size = attrLength(schema, i);
+        if (schema->dataTypes[i] == DT_STRING) {
+            const char *end = memchr(in + length, '\0', size);
+            length += end != NULL ? end - (in + length) + 1 : size;
+        } else {
+            length += size;
+        }
+    }
+    return length < (int)sizeof(RID) ? (int)sizeof(RID) : length;
 }
-// Update a record with new data
-RC updateRecord(RM_TableData *rel, Record *record) {
-    SM_FileHandle fh;
+
+static int tupleLength(Schema *schema, BM_PageHandle *page, int slot) {
+    unsigned short entry = slotDirectory(page)[slot];
+    if (entry & SLOT_FORWARD) {
+        return sizeof(RID);
+    }
+    if (entry & SLOT_MOVED) {
+        return sizeof(RID) + encodedLength(schema, tupleAt(page, slot) + sizeof(RID));
+    }
+    return encodedLength(schema, tupleAt(page, slot));
+}
+
+// Bytes a page could still take, with its garbage reclaimed
+static int pageFreeSpace(BM_PageHandle *page) {
+    DataPageHeader *header = pageHeader(page);
+    int directoryEnd = sizeof(DataPageHeader) + header->numSlots * sizeof(unsigned short);
+    return header->tupleStart - directoryEnd + header->garbage;
+}
+
+// Move the tuples of a page together at its end, reclaiming the garbage
+static void compactPage(Schema *schema, BM_PageHandle *page) {
+    char copy[PAGE_SIZE];
+    BM_PageHandle old = {page->pageNum, copy};
+    DataPageHeader *header = pageHeader(page);
+    unsigned short *directory = slotDirectory(page);
+    int end = PAGE_SIZE;
+
+    memcpy(copy, page->data, PAGE_SIZE);
+    for (int slot = 0; slot < header->numSlots; slot++) {
+        if (directory[slot] == 0) {
+            continue;
+        }
+        int length = tupleLength(schema, &old, slot);
+        end -= length;
+        memcpy(page->data + end, tupleAt(&old, slot), length);
+        directory[slot] = (directory[slot] & ~SLOT_OFFSET) | end;
+    }
+    header->tupleStart = end;
+    header->garbage = 0;
+}
+
+// Store a tuple in a page, in slot or, when slot is -1, in a free slot of
+// the directory or a new one at its end. Returns the slot the tuple went
+// to, -1 when the page has no room for it.
+static int placeTuple(Schema *schema, BM_PageHandle *page, int slot, const char *tuple, int length,
+                      unsigned short flags) {
+    DataPageHeader *header = pageHeader(page);
+    unsigned short *directory = slotDirectory(page);
+    int newEntry = 0;
+
+    if (slot < 0) {
+        for (slot = 0; slot < header->numSlots && directory[slot] != 0; slot++)
+            ;
+        newEntry = slot == header->numSlots ? sizeof(unsigned short) : 0;
+    }
+    if (pageFreeSpace(page) < length + newEntry) {
+        return -1;
+    }
+    int directoryEnd = sizeof(DataPageHeader) + header->numSlots * sizeof(unsigned short) + newEntry;
+    if (header->tupleStart - directoryEnd < length) {
+        compactPage(schema, page);
+    }
+    if (newEntry) {
+        header->numSlots++;
+    }
+    header->tupleStart -= length;
+    memcpy(page->data + header->tupleStart, tuple, length);
+    directory[slot] = flags | header->tupleStart;
+    setSlotLive(page, slot, !(flags & SLOT_MOVED));
+    return slot;
+}
+
+// Free the tuple of a slot. Free slots at the end of the directory are
+// dropped unless keepSlot asks to refill this one.
+static void removeTuple(Schema *schema, BM_PageHandle *page, int slot, bool keepSlot) {
+    DataPageHeader *header = pageHeader(page);
+    unsigned short *directory = slotDirectory(page);
+
+    header->garbage += tupleLength(schema, page, slot);
+    directory[slot] = 0;
+    setSlotLive(page, slot, false);
+    while (!keepSlot && header->numSlots > 0 && directory[header->numSlots - 1] == 0) {
+        header->numSlots--;
+    }
+}
+
+// Free space. Data pages with room for any tuple are chained into a free
+// list that starts in the metadata page, through the nextFreePage of their
+// headers: 0 for a page that is not on the list, NO_PAGE for the last page
+// on it. A page joins the list when a delete or update makes room on it
+// and leaves when an insert fills it, so an insert looks at one page.
+static bool pageHasRoom(RM_TableData *rel, BM_PageHandle *page) {
+    return pageFreeSpace(page) >= tableData(rel)->maxTupleSpace;
+}
+
+static void pushFreePage(RM_TableData *rel, TableMetaPage *meta, BM_PageHandle *page) {
+    DataPageHeader *header = pageHeader(page);
+    if (header->nextFreePage == 0 && pageHasRoom(rel, page)) {
+        header->nextFreePage = meta->firstFreePage != 0 ? meta->firstFreePage : NO_PAGE;
+        meta->firstFreePage = page->pageNum;
+    }
+}
+
+// Take the first page off the free list
+static void popFreePage(TableMetaPage *meta, BM_PageHandle *first) {
+    DataPageHeader *header = pageHeader(first);
+    meta->firstFreePage = header->nextFreePage != NO_PAGE ? header->nextFreePage : 0;
+    header->nextFreePage = 0;
+}
+
+// The metadata page stays pinned while a record is changed and is written
+// back with the changes to its copy at the end
+static RC pinMeta(RM_TableData *rel, BM_PageHandle *metaPage, TableMetaPage *meta) {
+    RC rc = pinForUpdate(rel, metaPage, 1);
+    if (rc == RC_OK) {
+        memcpy(meta, metaPage->data, sizeof(*meta));
+    }
+    return rc;
+}
+
+static RC unpinMeta(RM_TableData *rel, BM_PageHandle *metaPage, TableMetaPage *meta) {
+    memcpy(metaPage->data, meta, sizeof(*meta));
+    return unpinUpdated(rel, metaPage);
+}
+
+// Store a tuple on the first page of the free list, or on a new page at
+// the end of the table when no page is listed
+static RC insertTuple(RM_TableData *rel, TableMetaPage *meta, const char *tuple, int length,
+                      unsigned short flags, RID *rid) {
+    BM_BufferPool *buffer_pool = tablePool(rel);
+    BM_PageHandle page;
     RC rc;
 
-    // Step 1: Open the table file
-    rc = openPageFile(rel->name, &fh);
+    while (meta->firstFreePage != 0) {
+        rc = pinForUpdate(rel, &page, meta->firstFreePage);
+        if (rc != RC_OK) return rc;
+        int slot = placeTuple(rel->schema, &page, -1, tuple, length, flags);
+        if (slot < 0 || !pageHasRoom(rel, &page)) {
+            popFreePage(meta, &page);
+        }
+        rc = unpinUpdated(rel, &page);
+        if (rc != RC_OK) return rc;
+        if (slot >= 0) {
+            rid->page = page.pageNum;
+            rid->slot = slot;
+            return RC_OK;
+        }
+    }
+
+    // Make sure the file covers the new page before the pool writes it back
+    PageNumber pageNum = 2 + meta->numPages;
+    rc = ensurePoolCapacity(buffer_pool, pageNum + 1);
+    if (rc != RC_OK) return rc;
+    rc = pinForUpdate(rel, &page, pageNum);
     if (rc != RC_OK) return rc;
+    initDataPage(&page);
+    int slot = placeTuple(rel->schema, &page, -1, tuple, length, flags);
+    if (slot >= 0) {
+        meta->numPages++;
+        pushFreePage(rel, meta, &page);
+        rid->page = pageNum;
+        rid->slot = slot;
+    }
+    rc = unpinUpdated(rel, &page);
+    if (rc != RC_OK) return rc;
+    return slot >= 0 ? RC_OK : RC_RM_RECORD_TOO_LARGE;
+}
 
-    // Step 2: Read the page where the record resides
-    char *pageBuffer = (char *) malloc(PAGE_SIZE);
-    rc = readBlock(record->id.page, &fh, pageBuffer);
-    if (rc != RC_OK) {
-        free(pageBuffer);
-        closePageFile(&fh);
-        return rc;
+// Pin the page of a RID, for update or not, checking that the RID names a
+// slot of a data page. RC_RM_NO_MORE_TUPLES for a free slot past the end
+// of the directory.
+static RC pinRID(RM_TableData *rel, RID id, BM_PageHandle *page, bool forUpdate) {
+    TableMetaPage meta;
+
+    RC rc = readMeta(rel, &meta);
+    if (rc != RC_OK) return rc;
+    if (id.page < 2 || id.page >= 2 + meta.numPages || id.slot < 0 || id.slot >= (int)MAX_PAGE_SLOTS) {
+        return RC_READ_NON_EXISTING_PAGE;
+    }
+    rc = forUpdate ? pinForUpdate(rel, page, id.page) : pinPage(tablePool(rel), page, id.page);
+    if (rc != RC_OK) return rc;
+    if (id.slot >= pageHeader(page)->numSlots) {
+        forUpdate ? unpinUpdated(rel, page) : unpinPage(tablePool(rel), page);
+        return RC_RM_NO_MORE_TUPLES;
     }
+    return RC_OK;
+}
 
-    // Step 3: Calculate the slot size and get the position of the record in the page
-    int slotSize = getRecordSize(rel->schema);
-    char *recordSlot = pageBuffer + record->id.slot * slotSize;
+// Decode the record whose RID names slot of page into data, following a
+// FORWARD. RC_RM_NO_MORE_TUPLES when the slot holds no record.
+static RC readRecord(RM_TableData *rel, BM_PageHandle *page, int slot, char *data) {
+    if (!slotLive(page, slot)) {
+        return RC_RM_NO_MORE_TUPLES;
+    }
+    if (slotDirectory(page)[slot] & SLOT_FORWARD) {
+        BM_PageHandle target;
+        RID rid;
+        memcpy(&rid, tupleAt(page, slot), sizeof(RID));
+        RC rc = pinPage(tablePool(rel), &target, rid.page);
+        if (rc != RC_OK) return rc;
+        decodeTuple(rel->schema, tupleAt(&target, rid.slot) + sizeof(RID), data);
+        return unpinPage(tablePool(rel), &target);
+    }
+    decodeTuple(rel->schema, tupleAt(page, slot), data);
+    return RC_OK;
+}
 
-    // Step 4: Update the record data in the slot
-    memcpy(recordSlot, record->data, slotSize);
+// Free the tuples of the record in slot of page, the MOVED one as well.
+// The page the MOVED tuple was on goes on the free list, unless meta is NULL.
+static RC removeRecord(RM_TableData *rel, TableMetaPage *meta, BM_PageHandle *page, int slot, bool keepSlot) {
+    if (slotDirectory(page)[slot] & SLOT_FORWARD) {
+        BM_PageHandle target;
+        RID rid;
+        memcpy(&rid, tupleAt(page, slot), sizeof(RID));
+        RC rc = pinForUpdate(rel, &target, rid.page);
+        if (rc != RC_OK) return rc;
+        removeTuple(rel->schema, &target, rid.slot, false);
+        if (meta != NULL) {
+            pushFreePage(rel, meta, &target);
+        }
+        rc = unpinUpdated(rel, &target);
+        if (rc != RC_OK) return rc;
+    }
+    removeTuple(rel->schema, page, slot, keepSlot);
+    return RC_OK;
+}
 
-    // Step 5: Write the modified page back to the file
-    rc = writeBlock(record->id.page, &fh, pageBuffer);
-    free(pageBuffer); // Free the buffer
+// Store a record in its free slot of page: in place when the page has
+// room, otherwise as a MOVED tuple on another page with a FORWARD to it.
+// The FORWARD always fits, the slot held a tuple at least as long.
+static RC storeRecord(RM_TableData *rel, TableMetaPage *meta, BM_PageHandle *page, int slot, Record *record) {
+    char *buffer = tableData(rel)->tupleBuffer;
+    RID target;
+
+    memcpy(buffer, &record->id, sizeof(RID));
+    int length = encodeTuple(rel->schema, record->data, buffer + sizeof(RID));
+    if (placeTuple(rel->schema, page, slot, buffer + sizeof(RID), length, 0) >= 0) {
+        return RC_OK;
+    }
+    RC rc = insertTuple(rel, meta, buffer, sizeof(RID) + length, SLOT_MOVED, &target);
+    if (rc != RC_OK) return rc;
+    placeTuple(rel->schema, page, slot, (char *)&target, sizeof(RID), SLOT_FORWARD);
+    return RC_OK;
+}
 
+// Add or remove an index entry and note the change for rollBack, which
+// takes the key over. Index files are not logged, so this list is what
+// rolls them back.
+static RC changeIndex(RM_TableData *rel, RM_Index *index, Value *key, RID rid, bool insert) {
+    RM_TableMgmtData *table = tableData(rel);
+    if (table->numIndexChanges == table->maxIndexChanges) {
+        int size = table->maxIndexChanges > 0 ? 2 * table->maxIndexChanges : 16;
+        RM_IndexChange *grown = (RM_IndexChange *)realloc(table->indexChanges, size * sizeof(RM_IndexChange));
+        if (grown == NULL) {
+            freeIndexKey(key);
+            return RC_MEMORY_ALLOCATION_FAIL;
+        }
+        table->indexChanges = grown;
+        table->maxIndexChanges = size;
+    }
+    RC rc = insert ? insertKey(index->tree, key, rid) : deleteKey(index->tree, key);
     if (rc != RC_OK) {
-        closePageFile(&fh);
+        freeIndexKey(key);
         return rc;
     }
+    RM_IndexChange *change = &table->indexChanges[table->numIndexChanges++];
+    change->attrNum = index->attrNum;
+    change->inserted = insert;
+    memcpy(change->key, key, sizeof(change->key));
+    return RC_OK;
+}
 
-    // Step 6: Close the file
-    rc = closePageFile(&fh);
-    if (rc != RC_OK) return rc;
+static void clearIndexChanges(RM_TableMgmtData *table) {
+    for (int i = 0; i < table->numIndexChanges; i++) {
+        freeIndexKey(table->indexChanges[i].key);
+    }
+    table->numIndexChanges = 0;
+}
 
+// Bring the indexes up to date for a record changing from before to
+// after, either of which is NULL for an insert or a delete. Indexes on
+// attributes a change in place leaves as they were are not touched.
+static RC maintainIndexes(RM_TableData *rel, Record *before, Record *after) {
+    RM_TableMgmtData *table = tableData(rel);
+    Schema *schema = rel->schema;
+    Value key[3];
+    RC rc;
+
+    for (int i = 0; i < table->numIndexes; i++) {
+        RM_Index *index = &table->indexes[i];
+        int offset = attrOffset(schema, index->attrNum);
+        if (before != NULL && after != NULL
+            && before->id.page == after->id.page && before->id.slot == after->id.slot
+            && memcmp(before->data + offset, after->data + offset, attrLength(schema, index->attrNum)) == 0) {
+            continue;
+        }
+        if (before != NULL) {
+            rc = indexKey(schema, index->attrNum, before, key);
+            if (rc != RC_OK) return rc;
+            rc = changeIndex(rel, index, key, before->id, false);
+            if (rc != RC_OK) return rc;
+        }
+        if (after != NULL) {
+            rc = indexKey(schema, index->attrNum, after, key);
+            if (rc != RC_OK) return rc;
+            rc = changeIndex(rel, index, key, after->id, true);
+            if (rc != RC_OK) return rc;
+        }
+    }
     return RC_OK;
 }
 
-// Retrieve a record by its RID
-RC getRecord(RM_TableData *rel, RID id, Record *record) {
-    SM_FileHandle fh;
-    RC rc;
+// handling records in a table; each call below runs with the table's
+// latch held
+static RC insertRecordLatched(RM_TableData *rel, Record *record) {
+    BM_PageHandle metaPage;
+    TableMetaPage meta;
 
-    // Open the table file
-    rc = openPageFile(rel->name, &fh);
+    // Pin metadata page (page 1) for the tuple count and the free list
+    RC rc = pinMeta(rel, &metaPage, &meta);
     if (rc != RC_OK) return rc;
 
-    // Calculate record size
-    int recordSize = getRecordSize(rel->schema);
+    // Store the record encoded, on a page with room or a new one
+    char *tuple = tableData(rel)->tupleBuffer;
+    int length = encodeTuple(rel->schema, record->data, tuple);
+    rc = insertTuple(rel, &meta, tuple, length, 0, &record->id);
+    if (rc == RC_OK) {
+        meta.numTuples++;
+    }
+    RC unpinRc = unpinMeta(rel, &metaPage, &meta);
+    if (rc != RC_OK) return rc;
+    if (unpinRc != RC_OK) return unpinRc;
 
-    // Allocate buffer for page
-    char *pageData = (char *)malloc(PAGE_SIZE);
-    if (pageData == NULL) {
-        closePageFile(&fh);
-        return RC_WRITE_FAILED;
+    return maintainIndexes(rel, NULL, record);
+}
+
+// Delete a record with the specified RID
+static RC deleteRecordLatched(RM_TableData *rel, RID id) {
+    BM_PageHandle page, metaPage;
+    TableMetaPage meta;
+
+    // Nothing to do for a record that is gone already
+    RC rc = pinRID(rel, id, &page, true);
+    if (rc != RC_OK) return rc == RC_RM_NO_MORE_TUPLES ? RC_OK : rc;
+    Record before = {id, tableData(rel)->recordBuffer};
+    rc = readRecord(rel, &page, id.slot, before.data);
+    if (rc != RC_OK) {
+        unpinUpdated(rel, &page);
+        return rc == RC_RM_NO_MORE_TUPLES ? RC_OK : rc;
     }
-    memset(pageData, 0, PAGE_SIZE);
 
-    // Read the page
-    rc = readBlock(id.page, &fh, pageData);
+    // Take the record out of the indexes
+    rc = maintainIndexes(rel, &before, NULL);
+    if (rc == RC_OK) {
+        rc = pinMeta(rel, &metaPage, &meta);
+    }
     if (rc != RC_OK) {
-        free(pageData);
-        closePageFile(&fh);
+        unpinUpdated(rel, &page);
         return rc;
     }
 
-    // Calculate offset
-    int offset = id.slot * recordSize;
+    // Free its slot, the next insert may use the room
+    rc = removeRecord(rel, &meta, &page, id.slot, false);
+    if (rc == RC_OK) {
+        pushFreePage(rel, &meta, &page);
+        meta.numTuples--;
+    }
+    RC unpinRc = unpinUpdated(rel, &page);
+    RC metaRc = unpinMeta(rel, &metaPage, &meta);
+    if (rc != RC_OK) return rc;
+    return unpinRc != RC_OK ? unpinRc : metaRc;
+}
+// Update a record with new data
+static RC updateRecordLatched(RM_TableData *rel, Record *record) {
+    BM_PageHandle page, metaPage;
+    TableMetaPage meta;
 
-    // Check if the record is deleted
-    char isDeleted[6];  // 5 characters for "~!@#$" plus null terminator
-    memcpy(isDeleted, pageData + offset, 5);
-    isDeleted[5] = '\0';  // Ensure null-termination
-    if (strcmp(isDeleted, "~!@#$") == 0) {
-        free(pageData);
-        closePageFile(&fh);
-        return RC_RM_NO_MORE_TUPLES;  // Or a custom error code for deleted records
+    // Step 1: Pin the page where the record resides and keep its old version for the indexes
+    RC rc = pinRID(rel, record->id, &page, true);
+    if (rc != RC_OK) return rc;
+    Record before = {record->id, tableData(rel)->recordBuffer};
+    rc = readRecord(rel, &page, record->id.slot, before.data);
+    if (rc == RC_OK) {
+        rc = pinMeta(rel, &metaPage, &meta);
     }
+    if (rc != RC_OK) {
+        unpinUpdated(rel, &page);
+        return rc;
+    }
+
+    // Step 2: Replace the tuple, in its page or moved to another one
+    rc = removeRecord(rel, &meta, &page, record->id.slot, true);
+    if (rc == RC_OK) {
+        rc = storeRecord(rel, &meta, &page, record->id.slot, record);
+    }
+    pushFreePage(rel, &meta, &page);
+
+    // Step 3: Log the changes and let the buffer pool write the pages back
+    RC unpinRc = unpinUpdated(rel, &page);
+    RC metaRc = unpinMeta(rel, &metaPage, &meta);
+    if (rc != RC_OK) return rc;
+    if (unpinRc != RC_OK) return unpinRc;
+    if (metaRc != RC_OK) return metaRc;
+    return maintainIndexes(rel, &before, record);
+}
+
+RC insertRecord(RM_TableData *rel, Record *record) {
+    beginChange(rel);
+    return endChange(rel, insertRecordLatched(rel, record));
+}
+
+RC deleteRecord(RM_TableData *rel, RID id) {
+    beginChange(rel);
+    return endChange(rel, deleteRecordLatched(rel, id));
+}
+
+RC updateRecord(RM_TableData *rel, Record *record) {
+    beginChange(rel);
+    return endChange(rel, updateRecordLatched(rel, record));
+}
+
+// Retrieve a record by its RID
+static RC getRecordLatched(RM_TableData *rel, RID id, Record *record) {
+    BM_BufferPool *buffer_pool = tablePool(rel);
+    BM_PageHandle page;
+
+    RC rc = pinRID(rel, id, &page, false);
+    if (rc != RC_OK) return rc;
 
     // Allocate memory for record data if needed
     if (record->data == NULL) {
-        record->data = (char *)malloc(recordSize);
+        record->data = (char *)malloc(getRecordSize(rel->schema));
         if (record->data == NULL) {
-            free(pageData);
-            closePageFile(&fh);
+            unpinPage(buffer_pool, &page);
             return RC_WRITE_FAILED;
         }
     }
-    memset(record->data, 0, recordSize);
 
-    // Copy record data
-    memcpy(record->data, pageData + offset, recordSize);
-    record->id = id;
+    // Decode the tuple, a deleted record has none
+    rc = readRecord(rel, &page, id.slot, record->data);
+    if (rc == RC_OK) {
+        record->id = id;
+    }
 
-    // Cleanup
-    free(pageData);
-    closePageFile(&fh);
+    unpinPage(buffer_pool, &page);
+    return rc;
+}
+
+RC getRecord(RM_TableData *rel, RID id, Record *record) {
+    RM_TableMgmtData *table = tableData(rel);
+    pthread_mutex_lock(&table->latch);
+    RC rc = getRecordLatched(rel, id, record);
+    pthread_mutex_unlock(&table->latch);
+    return rc;
+}
 
+// Undo what the running transaction did since its savepoint, newest first:
+// the index entries from the list changeIndex keeps, the pages by following
+// the transaction's records back through the log. Undoing the pages
+// physically is sound because the transaction held the latch throughout,
+// so no other one changed them in between.
+static RC rollBack(RM_TableData *rel) {
+    RM_TableMgmtData *table = tableData(rel);
+    RC rc = RC_OK;
+
+    while (table->numIndexChanges > table->savepointIndexChanges) {
+        RM_IndexChange *change = &table->indexChanges[--table->numIndexChanges];
+        RM_Index *index = findIndex(table, change->attrNum);
+        if (index != NULL && rc == RC_OK) {
+            RID rid = {change->key[1].v.intV, change->key[2].v.intV};
+            rc = change->inserted ? deleteKey(index->tree, change->key) : insertKey(index->tree, change->key, rid);
+        }
+        freeIndexKey(change->key);
+    }
+
+    // The records are read back from the log file
+    LSN lsn = table->lastLSN;
+    if (rc == RC_OK && lsn > table->savepointLSN) {
+        rc = flushLog(table->log, lsn);
+    }
+    char *buffer = NULL;
+    int bufferSize = 0;
+    while (rc == RC_OK && lsn > table->savepointLSN) {
+        rc = readLogRecord(table->log, lsn, &buffer, &bufferSize);
+        if (rc == RC_OK) {
+            rc = undoRecord(rel, (WAL_Record *)buffer, &lsn);
+        }
+    }
+    free(buffer);
+    return rc;
+}
+
+// transactions
+RC beginTransaction(RM_TableData *rel, RM_TxHandle **tx) {
+    RM_TableMgmtData *table = tableData(rel);
+    RM_TxHandle *handle = (RM_TxHandle *)malloc(sizeof(RM_TxHandle));
+    if (handle == NULL) return RC_MEMORY_ALLOCATION_FAIL;
+
+    // The latch taken here is held until the transaction ends
+    beginChange(rel);
+    if (table->tx != NULL) {
+        pthread_mutex_unlock(&table->latch);
+        free(handle);
+        return RC_RM_TRANSACTION_OPEN;
+    }
+    handle->rel = rel;
+    handle->owner = pthread_self();
+    table->tx = handle;
+    *tx = handle;
     return RC_OK;
 }
 
+// Whether tx is the open transaction of its table, run by this thread. A
+// thread that does not run tx does not look at the table, whose latch it
+// does not hold.
+static bool ownsTransaction(RM_TxHandle *tx) {
+    return tx != NULL && pthread_equal(tx->owner, pthread_self()) && tableData(tx->rel)->tx == tx;
+}
+
+RC commitTransaction(RM_TxHandle *tx) {
+    if (!ownsTransaction(tx)) return RC_RM_NOT_IN_TRANSACTION;
+    RM_TableData *rel = tx->rel;
+    tableData(rel)->tx = NULL;
+    free(tx);
+    return finishChange(rel, WAL_COMMIT);
+}
+
+RC abortTransaction(RM_TxHandle *tx) {
+    if (!ownsTransaction(tx)) return RC_RM_NOT_IN_TRANSACTION;
+    RM_TableData *rel = tx->rel;
+    RM_TableMgmtData *table = tableData(rel);
+    table->savepointLSN = 0;
+    table->savepointIndexChanges = 0;
+    RC rc = rollBack(rel);
+    table->tx = NULL;
+    free(tx);
+    RC endRc = finishChange(rel, rc == RC_OK ? WAL_ABORT : 0);
+    return rc != RC_OK ? rc : endRc;
+}
+
+RC insertRecordInTx(RM_TxHandle *tx, Record *record) {
+    if (!ownsTransaction(tx)) return RC_RM_NOT_IN_TRANSACTION;
+    return insertRecord(tx->rel, record);
+}
+
+RC deleteRecordInTx(RM_TxHandle *tx, RID id) {
+    if (!ownsTransaction(tx)) return RC_RM_NOT_IN_TRANSACTION;
+    return deleteRecord(tx->rel, id);
+}
+
+RC updateRecordInTx(RM_TxHandle *tx, Record *record) {
+    if (!ownsTransaction(tx)) return RC_RM_NOT_IN_TRANSACTION;
+    return updateRecord(tx->rel, record);
+}
+
+RC getRecordInTx(RM_TxHandle *tx, RID id, Record *record) {
+    if (!ownsTransaction(tx)) return RC_RM_NOT_IN_TRANSACTION;
+    return getRecord(tx->rel, id, record);
+}
+
+// A scan in a transaction sees its changes; its thread has the latch that
+// next() takes
+RC startScanInTx(RM_TxHandle *tx, RM_ScanHandle *scan, Expr *cond) {
+    if (!ownsTransaction(tx)) return RC_RM_NOT_IN_TRANSACTION;
+    return startScan(tx->rel, scan, cond);
+}
+
+// Move the records on page from onto page to until to has no room left;
+// *drained tells whether from was emptied. A record of its own slot gets a
+// new RID and its index entries move along; for a MOVED tuple only the
+// FORWARD of its record is pointed at the new place.
+static RC drainPage(RM_TableData *rel, BM_PageHandle *to, BM_PageHandle *from, bool *drained) {
+    RM_TableMgmtData *table = tableData(rel);
+    Schema *schema = rel->schema;
+    RC rc;
+
+    *drained = false;
+    for (int slot = 0; slot < pageHeader(from)->numSlots; slot++) {
+        unsigned short entry = slotDirectory(from)[slot];
+        if (entry == 0) {
+            continue;
+        }
+        if (entry & SLOT_MOVED) {
+            BM_PageHandle home;
+            RID homeRid, target;
+            memcpy(&homeRid, tupleAt(from, slot), sizeof(RID));
+            target.page = to->pageNum;
+            target.slot = placeTuple(schema, to, -1, tupleAt(from, slot), tupleLength(schema, from, slot), SLOT_MOVED);
+            if (target.slot < 0) return RC_OK;
+            rc = pinForUpdate(rel, &home, homeRid.page);
+            if (rc != RC_OK) return rc;
+            memcpy(tupleAt(&home, homeRid.slot), &target, sizeof(RID));
+            rc = unpinUpdated(rel, &home);
+            if (rc != RC_OK) return rc;
+            removeTuple(schema, from, slot, false);
+        } else {
+            Record before = {{from->pageNum, slot}, table->recordBuffer};
+            rc = readRecord(rel, from, slot, before.data);
+            if (rc != RC_OK) return rc;
+            int length = encodeTuple(schema, before.data, table->tupleBuffer);
+            Record after = {{to->pageNum, -1}, before.data};
+            after.id.slot = placeTuple(schema, to, -1, table->tupleBuffer, length, 0);
+            if (after.id.slot < 0) return RC_OK;
+            rc = removeRecord(rel, NULL, from, slot, false);
+            if (rc == RC_OK) {
+                rc = maintainIndexes(rel, &before, &after);
+            }
+            if (rc != RC_OK) return rc;
+        }
+    }
+    *drained = true;
+    return RC_OK;
+}
+
+// Compact the table online: the records on the last pages are moved into
+// the room on the first ones until the two meet, then every page left is
+// compacted and the free list is rebuilt from them. Moved records get new
+// RIDs, their index entries move along. The pages emptied at the end are
+// reused by the next inserts. No scan may be open.
+static RC vacuumTableLatched(RM_TableData *rel) {
+    BM_PageHandle metaPage, low, high;
+    TableMetaPage meta;
+    bool drained;
+
+    RC rc = pinMeta(rel, &metaPage, &meta);
+    if (rc != RC_OK) return rc;
+
+    PageNumber first = 2, last = 1 + meta.numPages;
+    while (rc == RC_OK && first < last) {
+        rc = pinForUpdate(rel, &low, first);
+        if (rc != RC_OK) break;
+        rc = pinForUpdate(rel, &high, last);
+        if (rc == RC_OK) {
+            rc = drainPage(rel, &low, &high, &drained);
+            RC unpinRc = unpinUpdated(rel, &high);
+            if (rc == RC_OK) rc = unpinRc;
+            if (drained) {
+                last--;
+            } else {
+                first++;
+            }
+        }
+        RC unpinRc = unpinUpdated(rel, &low);
+        if (rc == RC_OK) rc = unpinRc;
+    }
+
+    // Rebuild the free list over the pages left, the first page at its head
+    if (rc == RC_OK) {
+        meta.numPages = last - 1;
+        meta.firstFreePage = 0;
+        for (PageNumber pageNum = last; rc == RC_OK && pageNum >= 2; pageNum--) {
+            rc = pinForUpdate(rel, &low, pageNum);
+            if (rc != RC_OK) break;
+            compactPage(rel->schema, &low);
+            pageHeader(&low)->nextFreePage = 0;
+            pushFreePage(rel, &meta, &low);
+            rc = unpinUpdated(rel, &low);
+        }
+    }
+    RC unpinRc = unpinMeta(rel, &metaPage, &meta);
+    return rc != RC_OK ? rc : unpinRc;
+}
+
+RC vacuumTable(RM_TableData *rel) {
+    beginChange(rel);
+    return endChange(rel, vacuumTableLatched(rel));
+}
+
 // scans
 typedef struct ScanMgmt {
     Expr *condition;
     int currentPage;
     int currentSlot;
     bool scanStarted;
+    int endPage;        // first page past the data pages when the scan starts
+    int recordSize;
+    char *tuple;        // record being looked at, decoded
+    BM_PageHandle page; // data page currently pinned by the scan
+    bool pagePinned;
+    RID *indexRids;     // the RIDs to visit, NULL to visit every slot
+    int numIndexRids;
+    int nextIndexRid;
 } ScanMgmt;
 
+// Bounds a condition puts on one attribute, NULL where it has none. Only
+// comparisons of the attribute with a constant count, also below ANDs and
+// NOTs; the scan still checks the whole condition on every record.
+typedef struct AttrBounds {
+    Value *low;
+    bool lowInclusive;
+    Value *high;
+    bool highInclusive;
+} AttrBounds;
+
+static bool isAttrRef(Expr *expr, int attrNum) {
+    return expr->type == EXPR_ATTRREF && expr->expr.attrRef == attrNum;
+}
+
+static bool isConstOfType(Expr *expr, DataType dt) {
+    return expr->type == EXPR_CONST && expr->expr.cons->dt == dt;
+}
+
+static void setBound(Value **bound, bool *inclusive, Value *value, bool valueInclusive) {
+    if (*bound == NULL) {
+        *bound = value;
+        *inclusive = valueInclusive;
+    }
+}
+
+static void findBounds(Expr *cond, int attrNum, DataType dt, bool negated, AttrBounds *bounds) {
+    if (cond == NULL || cond->type != EXPR_OP) {
+        return;
+    }
+    Operator *op = cond->expr.op;
+    switch (op->type) {
+        case OP_BOOL_AND:
+            if (!negated) {
+                findBounds(op->args[0], attrNum, dt, false, bounds);
+                findBounds(op->args[1], attrNum, dt, false, bounds);
+            }
+            break;
+        case OP_BOOL_NOT:
+            findBounds(op->args[0], attrNum, dt, !negated, bounds);
+            break;
+        case OP_COMP_EQUAL:
+        case OP_COMP_SMALLER: {
+            Expr *left = op->args[0];
+            Expr *right = op->args[1];
+            bool attrLeft = isAttrRef(left, attrNum) && isConstOfType(right, dt);
+            if (!attrLeft && !(isConstOfType(left, dt) && isAttrRef(right, attrNum))) {
+                break;
+            }
+            Value *value = attrLeft ? right->expr.cons : left->expr.cons;
+            if (op->type == OP_COMP_EQUAL) {
+                if (!negated) {
+                    setBound(&bounds->low, &bounds->lowInclusive, value, true);
+                    setBound(&bounds->high, &bounds->highInclusive, value, true);
+                }
+            } else if (attrLeft != negated) {
+                // attr < value, or NOT (value < attr)
+                setBound(&bounds->high, &bounds->highInclusive, value, negated);
+            } else {
+                // value < attr, or NOT (attr < value)
+                setBound(&bounds->low, &bounds->lowInclusive, value, negated);
+            }
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+// Collect the RIDs of the entries of the index that bounds the condition
+// most, an equality before a one-sided range, with the latch held. They
+// are all read before the scan returns its first record, so a record
+// whose update moves its entry further into the range is not returned
+// again. Leaves scan->indexRids NULL when no index helps.
+static void openIndexScan(RM_TableData *rel, Expr *cond, ScanMgmt *scan) {
+    RM_TableMgmtData *table = tableData(rel);
+    RM_Index *best = NULL;
+    AttrBounds bestBounds;
+    int bestScore = 0;
+
+    scan->indexRids = NULL;
+    scan->numIndexRids = 0;
+    scan->nextIndexRid = 0;
+    for (int i = 0; i < table->numIndexes; i++) {
+        RM_Index *index = &table->indexes[i];
+        AttrBounds bounds = {NULL, false, NULL, false};
+        findBounds(cond, index->attrNum, rel->schema->dataTypes[index->attrNum], false, &bounds);
+        int score = (bounds.low != NULL) + (bounds.high != NULL);
+        if (score > bestScore) {
+            best = index;
+            bestBounds = bounds;
+            bestScore = score;
+        }
+    }
+    if (best == NULL) {
+        return;
+    }
+
+    // A bound on the value becomes a bound on (value, page, slot) below or
+    // above every RID, depending on whether the value itself is in range
+    Value low[3], high[3];
+    if (bestBounds.low != NULL) {
+        low[0] = *bestBounds.low;
+        low[1].dt = low[2].dt = DT_INT;
+        low[1].v.intV = low[2].v.intV = bestBounds.lowInclusive ? INT_MIN : INT_MAX;
+    }
+    if (bestBounds.high != NULL) {
+        high[0] = *bestBounds.high;
+        high[1].dt = high[2].dt = DT_INT;
+        high[1].v.intV = high[2].v.intV = bestBounds.highInclusive ? INT_MAX : INT_MIN;
+    }
+    // A constant that cannot be encoded, e.g. a string longer than the
+    // attribute, leaves the table scan to it
+    BT_ScanHandle *indexScan;
+    if (openTreeRangeScan(best->tree, bestBounds.low != NULL ? low : NULL, true,
+                          bestBounds.high != NULL ? high : NULL, true, &indexScan) != RC_OK) {
+        return;
+    }
+    int maxRids = 16;
+    RID *rids = malloc(maxRids * sizeof(RID));
+    RID rid;
+    RC rc = RC_OK;
+    while (rids != NULL && (rc = nextEntry(indexScan, &rid)) == RC_OK) {
+        if (scan->numIndexRids == maxRids) {
+            maxRids *= 2;
+            RID *grown = realloc(rids, maxRids * sizeof(RID));
+            if (grown == NULL) {
+                free(rids);
+                rids = NULL;
+                break;
+            }
+            rids = grown;
+        }
+        rids[scan->numIndexRids++] = rid;
+    }
+    closeTreeScan(indexScan);
+    if (rids == NULL || rc != RC_IM_NO_MORE_ENTRIES) {
+        free(rids); // the table scan finds the records as well
+        scan->numIndexRids = 0;
+        return;
+    }
+    scan->indexRids = rids;
+}
+
 RC startScan(RM_TableData *rel, RM_ScanHandle *scan, Expr *cond) {
     // Initialize scan management data
     ScanMgmt *mgmt = (ScanMgmt *)malloc(sizeof(ScanMgmt));
@@ -608,9 +2208,25 @@ RC startScan(RM_TableData *rel, RM_ScanHandle *scan, Expr *cond) {
     }
 
     mgmt->condition = cond;
-    mgmt->currentPage = 1;  // Start from first data page (page 0 is schema, page 1 is metadata)
+    mgmt->currentPage = 2;  // Start from first data page (page 0 is schema, page 1 is metadata)
     mgmt->currentSlot = -1; // Will be incremented to 0 in first next() call
     mgmt->scanStarted = false;
+    mgmt->recordSize = getRecordSize(rel->schema);
+    mgmt->tuple = (char *)malloc(mgmt->recordSize);
+    mgmt->pagePinned = false;
+    TableMetaPage meta;
+    pthread_mutex_lock(&tableData(rel)->latch);
+    RC rc = readMeta(rel, &meta);
+    if (rc == RC_OK) {
+        openIndexScan(rel, cond, mgmt);
+    }
+    pthread_mutex_unlock(&tableData(rel)->latch);
+    if (rc != RC_OK) {
+        free(mgmt->tuple);
+        free(mgmt);
+        return rc;
+    }
+    mgmt->endPage = 2 + meta.numPages;
 
     scan->rel = rel;
     scan->mgmtData = mgmt;
@@ -618,76 +2234,141 @@ RC startScan(RM_TableData *rel, RM_ScanHandle *scan, Expr *cond) {
     return RC_OK;
 }
 
-RC next(RM_ScanHandle *scan, Record *record) {
-    ScanMgmt *mgmt = (ScanMgmt *)scan->mgmtData;
-    if (mgmt == NULL) {
-        return -199;
+// Whether the record in a slot is there and meets the scan's condition;
+// it is decoded into mgmt->tuple
+static RC scanMatches(RM_TableData *rel, ScanMgmt *mgmt, RID rid, bool *matches) {
+    *matches = false;
+    RC rc = readRecord(rel, &mgmt->page, rid.slot, mgmt->tuple);
+    if (rc != RC_OK) {
+        return rc == RC_RM_NO_MORE_TUPLES ? RC_OK : rc;
     }
+    if (mgmt->condition == NULL) {
+        *matches = true;
+        return RC_OK;
+    }
+    Record tuple = {rid, mgmt->tuple};
+    Value *result = NULL;
+    rc = evalExpr(&tuple, rel->schema, mgmt->condition, &result);
+    *matches = rc == RC_OK && result->v.boolV;
+    free(result);
+    return RC_OK;
+}
 
-    Schema *schema = scan->rel->schema;
-    int recordSize = getRecordSize(schema);
-    int slotsPerPage = (PAGE_SIZE - sizeof(int)) / recordSize;
-    bool foundRecord = false;
-
-    // Get total number of tuples
-    int totalTuples = getNumTuples(scan->rel);
-    if (totalTuples <= 0) {
-        return RC_RM_NO_MORE_TUPLES;
+static void scanResult(ScanMgmt *mgmt, RID rid, Record *record) {
+    if (record->data == NULL) {
+        record->data = (char *)malloc(mgmt->recordSize);
     }
+    memcpy(record->data, mgmt->tuple, mgmt->recordSize);
+    record->id = rid;
+}
 
-    while (!foundRecord) {
-        // Move to next slot
-        mgmt->currentSlot++;
+// next for a scan driven by an index: the records of the RIDs in range are
+// read, keeping a data page pinned while consecutive RIDs are on it
+static RC nextFromIndex(RM_ScanHandle *scan, Record *record) {
+    ScanMgmt *mgmt = (ScanMgmt *)scan->mgmtData;
+    BM_BufferPool *buffer_pool = tablePool(scan->rel);
+    bool matches;
+    RC rc;
 
-        // If we've reached the end of the current page
-        if (mgmt->currentSlot >= slotsPerPage) {
-            mgmt->currentPage++;
-            mgmt->currentSlot = 0;
+    while (mgmt->nextIndexRid < mgmt->numIndexRids) {
+        RID rid = mgmt->indexRids[mgmt->nextIndexRid++];
+        if (mgmt->pagePinned && mgmt->page.pageNum != rid.page) {
+            unpinPage(buffer_pool, &mgmt->page);
+            mgmt->pagePinned = false;
         }
-
-        // Calculate if we've gone through all possible record positions
-        int currentPosition = ((mgmt->currentPage - 2) * slotsPerPage) + mgmt->currentSlot;
-        if (currentPosition >= totalTuples) {
-            return RC_RM_NO_MORE_TUPLES;
+        if (!mgmt->pagePinned) {
+            rc = pinPage(buffer_pool, &mgmt->page, rid.page);
+            if (rc != RC_OK) {
+                return rc;
+            }
+            mgmt->pagePinned = true;
         }
+        if (rid.slot >= pageHeader(&mgmt->page)->numSlots) {
+            continue;
+        }
+        rc = scanMatches(scan->rel, mgmt, rid, &matches);
+        if (rc != RC_OK) {
+            return rc;
+        }
+        if (matches) {
+            scanResult(mgmt, rid, record);
+            return RC_OK;
+        }
+    }
+    if (mgmt->pagePinned) {
+        unpinPage(buffer_pool, &mgmt->page);
+        mgmt->pagePinned = false;
+    }
+    return RC_RM_NO_MORE_TUPLES;
+}
 
-        // Try to get the record at current position
-        RID rid = {mgmt->currentPage, mgmt->currentSlot};
-        RC rc = getRecord(scan->rel, rid, record);
+static RC nextLatched(RM_ScanHandle *scan, Record *record) {
+    ScanMgmt *mgmt = (ScanMgmt *)scan->mgmtData;
+    if (mgmt->indexRids != NULL) {
+        return nextFromIndex(scan, record);
+    }
 
-        // Skip if record doesn't exist or is deleted
-        if (rc != RC_OK) {
-            continue;
+    BM_BufferPool *buffer_pool = tablePool(scan->rel);
+    bool matches;
+
+    while (true) {
+        // Each data page is pinned once and its slots are read in place
+        if (!mgmt->pagePinned) {
+            if (mgmt->currentPage >= mgmt->endPage) {
+                return RC_RM_NO_MORE_TUPLES;
+            }
+            RC rc = pinPage(buffer_pool, &mgmt->page, mgmt->currentPage);
+            if (rc != RC_OK) {
+                return rc;
+            }
+            mgmt->pagePinned = true;
+            mgmt->currentSlot = -1;
         }
 
-        // If no condition, return record
-        if (mgmt->condition == NULL) {
-            foundRecord = true;
+        // Move to the next slot holding a record, if we've reached the end of the current page, release it
+        mgmt->currentSlot = nextLiveSlot(&mgmt->page, mgmt->currentSlot + 1);
+        if (mgmt->currentSlot >= pageHeader(&mgmt->page)->numSlots) {
+            unpinPage(buffer_pool, &mgmt->page);
+            mgmt->pagePinned = false;
+            mgmt->currentPage++;
             continue;
         }
 
-        // Evaluate condition
-        Value *result = NULL;
-        rc = evalExpr(record, schema, mgmt->condition, &result);
+        // Evaluate the condition on the decoded tuple, copy only matches
+        RID rid = {mgmt->currentPage, mgmt->currentSlot};
+        RC rc = scanMatches(scan->rel, mgmt, rid, &matches);
         if (rc != RC_OK) {
-            free(result);
-            continue;
+            return rc;
         }
-
-        // Check if condition is satisfied
-        if (result->v.boolV) {
-            foundRecord = true;
+        if (matches) {
+            scanResult(mgmt, rid, record);
+            return RC_OK;
         }
-
-        free(result);
     }
+}
 
-    return RC_OK;
+// The table's latch is held for one record at a time, changes to the table
+// may come in between
+RC next(RM_ScanHandle *scan, Record *record) {
+    ScanMgmt *mgmt = (ScanMgmt *)scan->mgmtData;
+    if (mgmt == NULL) {
+        return -199;
+    }
+    RM_TableMgmtData *table = tableData(scan->rel);
+    pthread_mutex_lock(&table->latch);
+    RC rc = nextLatched(scan, record);
+    pthread_mutex_unlock(&table->latch);
+    return rc;
 }
 
 RC closeScan(RM_ScanHandle *scan) {
     ScanMgmt *mgmt = (ScanMgmt *)scan->mgmtData;
     if (mgmt != NULL) {
+        if (mgmt->pagePinned) {
+            unpinPage(tablePool(scan->rel), &mgmt->page);
+        }
+        free(mgmt->indexRids);
+        free(mgmt->tuple);
         // Don't free the condition as it might be used elsewhere
         free(mgmt);
         scan->mgmtData = NULL;
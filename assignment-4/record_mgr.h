@@ -1,9 +1,82 @@
 #ifndef RECORD_MGR_H
 #define RECORD_MGR_H
 
+#include <pthread.h>
+
 #include "dberror.h"
 #include "expr.h"
 #include "tables.h"
+#include "buffer_mgr.h"
+#include "btree_mgr.h"
+#include "wal.h"
+
+// Most indexes a table can have
+#define RM_MAX_INDEXES 8
+
+// Secondary index on one attribute of a table, kept in the file
+// <table>.idx<attrNum>. Its keys are the attribute followed by the RID of
+// the record, so records with equal values get keys of their own.
+typedef struct RM_Index
+{
+	int attrNum;
+	BTreeHandle *tree;
+} RM_Index;
+
+// Most pages one change to a table keeps pinned for update at a time
+#define RM_MAX_PAGE_IMAGES 8
+
+// A page pinned for update and its contents before the change, which the
+// log record of the change is made from
+typedef struct RM_PageImage
+{
+	PageNumber pageNum; // NO_PAGE for an unused image
+	int pins;
+	char *data;
+} RM_PageImage;
+
+// An index entry a transaction added or removed, undone by removing or
+// adding it again when the transaction rolls back
+typedef struct RM_IndexChange
+{
+	int attrNum;
+	bool inserted;
+	Value key[3]; // attribute value, page and slot
+} RM_IndexChange;
+
+// A transaction on one table, from beginTransaction to commitTransaction
+// or abortTransaction. It holds the table's latch all along: calls on the
+// table from its thread belong to it, those of other threads wait for it
+// to end. The handle is freed when the transaction ends.
+typedef struct RM_TxHandle
+{
+	RM_TableData *rel;
+	pthread_t owner; // thread that began it
+} RM_TxHandle;
+
+// State of an open table. The buffer pool comes first, so mgmtData may
+// also be used as the table's pool.
+typedef struct RM_TableMgmtData
+{
+	BM_BufferPool pool;
+	int numIndexes;
+	RM_Index indexes[RM_MAX_INDEXES];
+	int maxTupleSpace; // free bytes a data page needs to take any tuple
+	char *recordBuffer; // scratch space for one record
+	char *tupleBuffer; // scratch space for one encoded tuple
+	pthread_mutex_t latch; // held while a call reads or changes the table's pages, recursive
+	WAL_Log *log; // write-ahead log of the table's pages, <table>.log
+	RM_TxHandle *tx; // open transaction, NULL while each change commits on its own
+	int txId; // transaction of the running change
+	LSN lastLSN; // last record it logged, 0 before the first
+	LSN savepointLSN; // lastLSN when the running call began, rolled back to if it fails
+	RM_IndexChange *indexChanges; // index entries the transaction changed, oldest first
+	int numIndexChanges;
+	int maxIndexChanges;
+	int savepointIndexChanges; // numIndexChanges when the running call began
+	LSN checkpointLSN; // last checkpoint, or the end of the log at openTable
+	RM_PageImage images[RM_MAX_PAGE_IMAGES];
+	char *logBuffer; // scratch space for one log record
+} RM_TableMgmtData;
 
 // Bookkeeping for scans
 typedef struct RM_ScanHandle
@@ -21,12 +94,36 @@ extern RC closeTable (RM_TableData *rel);
 extern RC deleteTable (char *name);
 extern int getNumTuples (RM_TableData *rel);
 
+// secondary indexes, updated by every record mutation and used by scans
+// whose condition compares an indexed attribute with a constant
+extern RC createIndex (RM_TableData *rel, int attrNum);
+extern RC dropIndex (RM_TableData *rel, int attrNum);
+
 // handling records in a table
 extern RC insertRecord (RM_TableData *rel, Record *record);
 extern RC deleteRecord (RM_TableData *rel, RID id);
 extern RC updateRecord (RM_TableData *rel, Record *record);
 extern RC getRecord (RM_TableData *rel, RID id, Record *record);
 
+// compacting a table: records move to fill the first pages, so the RIDs
+// of moved records change and RIDs held from before the call become
+// invalid. The table's latch is held for the whole call, which other
+// threads wait for, and no scan may be open on the table.
+extern RC vacuumTable (RM_TableData *rel);
+
+// transactions: the inserts, updates and deletes of a transaction become
+// durable together with one log flush at commitTransaction, or are all
+// undone by abortTransaction. A call that fails within a transaction is
+// undone by itself and leaves the transaction open.
+extern RC beginTransaction (RM_TableData *rel, RM_TxHandle **tx);
+extern RC commitTransaction (RM_TxHandle *tx);
+extern RC abortTransaction (RM_TxHandle *tx);
+extern RC insertRecordInTx (RM_TxHandle *tx, Record *record);
+extern RC deleteRecordInTx (RM_TxHandle *tx, RID id);
+extern RC updateRecordInTx (RM_TxHandle *tx, Record *record);
+extern RC getRecordInTx (RM_TxHandle *tx, RID id, Record *record);
+extern RC startScanInTx (RM_TxHandle *tx, RM_ScanHandle *scan, Expr *cond);
+
 // scans
 extern RC startScan (RM_TableData *rel, RM_ScanHandle *scan, Expr *cond);
 extern RC next (RM_ScanHandle *scan, Record *record);
@@ -0,0 +1,179 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dberror.h"
+#include "buffer_mgr.h"
+#include "storage_mgr.h"
+
+// Replays page reference traces against every replacement strategy and
+// reports the hit ratio of each. A trace file holds whitespace separated
+// page numbers; lines starting with '#' are comments. Without trace files
+// a few synthetic traces are generated.
+//
+//   ./replay_trace [-n numFrames] [-k K] [trace ...]
+
+#define REPLAY_FILE "replay_trace.bin"
+#define REPLAY_DEFAULT_FRAMES 100
+#define SYNTHETIC_LENGTH 200000
+
+typedef struct Trace {
+    char *name;
+    int *pages;
+    int length;
+} Trace;
+
+static ReplacementStrategy strategies[] = { RS_FIFO, RS_LRU, RS_CLOCK, RS_LFU, RS_LRU_K };
+static char *strategyNames[] = { "FIFO", "LRU", "CLOCK", "LFU", "LRU-K" };
+
+static void appendPage(Trace *trace, int *capacity, int pageNum) {
+    if (trace->length == *capacity) {
+        *capacity = *capacity == 0 ? 1024 : *capacity * 2;
+        trace->pages = realloc(trace->pages, *capacity * sizeof(int));
+    }
+    trace->pages[trace->length++] = pageNum;
+}
+
+static RC loadTrace(char *fileName, Trace *trace) {
+    FILE *file = fopen(fileName, "r");
+    char line[256];
+    int capacity = 0;
+
+    if (file == NULL) {
+        return RC_FILE_NOT_FOUND;
+    }
+    trace->name = fileName;
+    trace->pages = NULL;
+    trace->length = 0;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        if (line[0] == '#') {
+            continue;
+        }
+        char *token = strtok(line, " \t\r\n");
+        while (token != NULL) {
+            appendPage(trace, &capacity, atoi(token));
+            token = strtok(NULL, " \t\r\n");
+        }
+    }
+    fclose(file);
+    return RC_OK;
+}
+
+// Skewed accesses: 80% of the references go to 20% of the pages
+static void makeSkewedTrace(Trace *trace, int numPages) {
+    int capacity = 0;
+    trace->name = "synthetic 80/20 skew";
+    trace->pages = NULL;
+    trace->length = 0;
+    for (int i = 0; i < SYNTHETIC_LENGTH; i++) {
+        int hotPages = numPages / 5;
+        if (rand() % 10 < 8) {
+            appendPage(trace, &capacity, rand() % hotPages);
+        } else {
+            appendPage(trace, &capacity, hotPages + rand() % (numPages - hotPages));
+        }
+    }
+}
+
+// A hot set that fits the pool, interrupted by long sequential scans
+// over cold pages. Recency-only policies let the scans flush the hot set.
+static void makeScanPollutedTrace(Trace *trace, int numFrames) {
+    int capacity = 0;
+    int scanPage = numFrames * 10;
+    trace->name = "synthetic hot set + scans";
+    trace->pages = NULL;
+    trace->length = 0;
+    while (trace->length < SYNTHETIC_LENGTH) {
+        for (int i = 0; i < numFrames * 4; i++) {
+            appendPage(trace, &capacity, rand() % (numFrames / 2));
+        }
+        for (int i = 0; i < numFrames * 2; i++) {
+            appendPage(trace, &capacity, scanPage++);
+        }
+    }
+}
+
+// Repeated sequential loop slightly larger than the pool
+static void makeLoopTrace(Trace *trace, int numFrames) {
+    int capacity = 0;
+    int loopLength = numFrames + numFrames / 10 + 1;
+    trace->name = "synthetic loop";
+    trace->pages = NULL;
+    trace->length = 0;
+    for (int i = 0; i < SYNTHETIC_LENGTH; i++) {
+        appendPage(trace, &capacity, i % loopLength);
+    }
+}
+
+static double replay(Trace *trace, ReplacementStrategy strategy, int numFrames, int k) {
+    BM_BufferPool *bm = MAKE_POOL();
+    BM_PageHandle *h = MAKE_PAGE_HANDLE();
+
+    CHECK(initBufferPool(bm, REPLAY_FILE, numFrames, strategy, &k));
+    for (int i = 0; i < trace->length; i++) {
+        CHECK(pinPage(bm, h, trace->pages[i]));
+        CHECK(unpinPage(bm, h));
+    }
+    double hits = trace->length - getNumReadIO(bm);
+    CHECK(shutdownBufferPool(bm));
+    free(bm);
+    free(h);
+    return hits / trace->length;
+}
+
+static void report(Trace *trace, int numFrames, int k) {
+    printf("%-28s %9d", trace->name, trace->length);
+    for (int i = 0; i < (int)(sizeof(strategies) / sizeof(strategies[0])); i++) {
+        printf(" %7.4f", replay(trace, strategies[i], numFrames, k));
+    }
+    printf("\n");
+}
+
+int main(int argc, char **argv) {
+    int numFrames = REPLAY_DEFAULT_FRAMES;
+    int k = DEFAULT_LRU_K;
+    int numTraceFiles = 0;
+    Trace trace;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            numFrames = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-k") == 0 && i + 1 < argc) {
+            k = atoi(argv[++i]);
+        } else {
+            argv[1 + numTraceFiles++] = argv[i];
+        }
+    }
+
+    CHECK(createPageFile(REPLAY_FILE));
+    printf("%d frames, K = %d\n", numFrames, k);
+    printf("%-28s %9s", "trace", "refs");
+    for (int i = 0; i < (int)(sizeof(strategies) / sizeof(strategies[0])); i++) {
+        printf(" %7s", strategyNames[i]);
+    }
+    printf("\n");
+
+    if (numTraceFiles == 0) {
+        srand(42);
+        makeSkewedTrace(&trace, numFrames * 5);
+        report(&trace, numFrames, k);
+        free(trace.pages);
+        makeScanPollutedTrace(&trace, numFrames);
+        report(&trace, numFrames, k);
+        free(trace.pages);
+        makeLoopTrace(&trace, numFrames);
+        report(&trace, numFrames, k);
+        free(trace.pages);
+    }
+    for (int i = 0; i < numTraceFiles; i++) {
+        if (loadTrace(argv[1 + i], &trace) != RC_OK) {
+            printf("cannot read trace %s\n", argv[1 + i]);
+            continue;
+        }
+        report(&trace, numFrames, k);
+        free(trace.pages);
+    }
+
+    CHECK(destroyPageFile(REPLAY_FILE));
+    return 0;
+}
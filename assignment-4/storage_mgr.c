@@ -1,8 +1,111 @@
+#define _GNU_SOURCE // mremap
 #include "storage_mgr.h"
 #include "dberror.h"
+#include "dt.h"
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+// Per open file state kept behind SM_FileHandle.mgmtInfo. Pages are moved
+// with pread/pwrite at explicit offsets, so nothing is buffered in stdio
+// and no shared file position is changed: several threads may read
+// through one handle at the same time.
+//
+// In SM_MODE_MMAP the whole file is also mapped shared, reads and writes
+// become memcpy, and getBlockPointer hands out pointers into the mapping.
+// The mapping follows the file as ensureCapacity grows it.
+typedef struct SM_FileInfo {
+    int fd;
+    SM_FileMode mode;
+    char *map; // SM_MODE_MMAP: file contents, NULL while the file is empty
+    size_t mapSize;
+} SM_FileInfo;
+
+static SM_FileInfo *fileInfo(SM_FileHandle *fHandle) {
+    return (SM_FileInfo *)fHandle->mgmtInfo;
+}
+
+static int fileDescriptor(SM_FileHandle *fHandle) {
+    return fileInfo(fHandle)->fd;
+}
+
+static bool isMapped(SM_FileHandle *fHandle) {
+    return fileInfo(fHandle)->mode == SM_MODE_MMAP;
+}
+
+// The current page position is moved by every read and write. Threads
+// that share a handle all move it, so it is stored and loaded atomically;
+// it only means something to a caller that has the handle to itself.
+static void setBlockPos(SM_FileHandle *fHandle, int pageNum) {
+    __atomic_store_n(&fHandle->curPagePos, pageNum, __ATOMIC_RELAXED);
+}
+
+// Map the first numPages pages of the file, moving the mapping if it has
+// to grow. Pointers from getBlockPointer are invalid afterwards.
+static RC remapFile(SM_FileInfo *info, int numPages) {
+    size_t size = (size_t)numPages * PAGE_SIZE;
+    if (size == info->mapSize) {
+        return RC_OK;
+    }
+    void *map;
+    if (info->map == NULL) {
+        map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, info->fd, 0);
+    } else {
+        map = mremap(info->map, info->mapSize, size, MREMAP_MAYMOVE);
+    }
+    if (map == MAP_FAILED) {
+        return RC_FILE_NOT_MAPPED;
+    }
+    info->map = map;
+    info->mapSize = size;
+    return RC_OK;
+}
+
+// Transfer exactly count bytes at offset, retrying after signals and
+// partial transfers. Returns the number of bytes moved, which is less than
+// count only at end of file (reads) or on an error.
+static ssize_t preadFully(int fd, char *buffer, size_t count, off_t offset) {
+    size_t done = 0;
+    while (done < count) {
+        ssize_t n = pread(fd, buffer + done, count - done, offset + done);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (n == 0)
+            break;
+        done += n;
+    }
+    return done;
+}
+
+static ssize_t pwriteFully(int fd, const char *buffer, size_t count, off_t offset) {
+    size_t done = 0;
+    while (done < count) {
+        ssize_t n = pwrite(fd, buffer + done, count - done, offset + done);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (n == 0)
+            break;
+        done += n;
+    }
+    return done;
+}
 
 /*
  * ############################
@@ -14,37 +117,99 @@ void initStorageManager(void) {
     printf("Storage manager init.\n");
 }
 
+// Move numPages consecutive pages starting at firstPage to or from the
+// buffers in memPages with as few preadv/pwritev calls as IOV_MAX allows.
+// Partial transfers are resumed from where they stopped.
+static RC transferBlocks(bool write, int firstPage, int numPages, int fd, SM_PageHandle *memPages) {
+    struct iovec iov[IOV_MAX];
+    off_t offset = (off_t)firstPage * PAGE_SIZE;
+    int done = 0;
+    while (done < numPages) {
+        int count = numPages - done < IOV_MAX ? numPages - done : IOV_MAX;
+        for (int i = 0; i < count; i++) {
+            iov[i].iov_base = memPages[done + i];
+            iov[i].iov_len = PAGE_SIZE;
+        }
+        struct iovec *next = iov;
+        int remaining = count;
+        while (remaining > 0) {
+            ssize_t n = write ? pwritev(fd, next, remaining, offset) : preadv(fd, next, remaining, offset);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                return write ? RC_WRITE_FAILED : RC_READ_FAILED;
+            offset += n;
+            while (remaining > 0 && (size_t)n >= next->iov_len) {
+                n -= next->iov_len;
+                next++;
+                remaining--;
+            }
+            if (remaining > 0) {
+                next->iov_base = (char *)next->iov_base + n;
+                next->iov_len -= n;
+            }
+        }
+        done += count;
+    }
+    return RC_OK;
+}
+
 RC createPageFile(char *fileName) {
-    FILE *file = fopen(fileName, "w");
-    if (file == NULL) {
+    int fd = open(fileName, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
         printf("Error creating file\n");
         return RC_FILE_NOT_FOUND;
     }
-    for (int i = 0; i < PAGE_SIZE; i++) {
-        fputc('\0', file);
-    }
-    fclose(file);
-    return RC_OK;
+    char emptyPage[PAGE_SIZE];
+    memset(emptyPage, 0, PAGE_SIZE);
+    ssize_t written = pwriteFully(fd, emptyPage, PAGE_SIZE, 0);
+    close(fd);
+    return written == PAGE_SIZE ? RC_OK : RC_WRITE_FAILED;
 }
 
 RC openPageFile(char *fileName, SM_FileHandle *fHandle) {
-    FILE *page = fopen(fileName, "rb+");
-    if (page == NULL) {
+    return openPageFileWithMode(fileName, fHandle, SM_MODE_PIO);
+}
+
+RC openPageFileWithMode(char *fileName, SM_FileHandle *fHandle, SM_FileMode mode) {
+    int fd = open(fileName, O_RDWR);
+    if (fd < 0) {
         printf("Error: File '%s' not found.\n", fileName);
         return RC_FILE_NOT_FOUND;
     }
-    fseek(page, 0, SEEK_END);
-    long fileSize = ftell(page);
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) != 0) {
+        close(fd);
+        return RC_FILE_NOT_FOUND;
+    }
+    SM_FileInfo *info = malloc(sizeof(SM_FileInfo));
+    info->fd = fd;
+    info->mode = mode;
+    info->map = NULL;
+    info->mapSize = 0;
     fHandle->fileName = fileName;
     fHandle->curPagePos = 0;
-    fHandle->totalNumPages = fileSize / PAGE_SIZE;
-    fHandle->mgmtInfo = page;
+    fHandle->totalNumPages = fileStat.st_size / PAGE_SIZE;
+    if (mode == SM_MODE_MMAP && fHandle->totalNumPages > 0) {
+        RC rc = remapFile(info, fHandle->totalNumPages);
+        if (rc != RC_OK) {
+            close(fd);
+            free(info);
+            return rc;
+        }
+    }
+    fHandle->mgmtInfo = info;
     return RC_OK;
 }
 
 RC closePageFile(SM_FileHandle *fHandle) {
     if (fHandle->mgmtInfo != NULL) {
-        fclose(fHandle->mgmtInfo);
+        SM_FileInfo *info = fileInfo(fHandle);
+        if (info->map != NULL) {
+            munmap(info->map, info->mapSize);
+        }
+        close(info->fd);
+        free(info);
         fHandle->mgmtInfo = NULL;
     }
     return RC_OK;
@@ -68,14 +233,59 @@ RC readBlock(int pageNum, SM_FileHandle *fHandle, SM_PageHandle memPage) {
         return RC_READ_NON_EXISTING_PAGE;
     }
 
-    fseek(fHandle->mgmtInfo, pageNum * PAGE_SIZE, SEEK_SET);
-    fread(memPage, sizeof(char), PAGE_SIZE, fHandle->mgmtInfo);
-    fHandle->curPagePos = pageNum;
+    off_t offset = (off_t)pageNum * PAGE_SIZE;
+    if (isMapped(fHandle)) {
+        memcpy(memPage, fileInfo(fHandle)->map + offset, PAGE_SIZE);
+    } else if (preadFully(fileDescriptor(fHandle), memPage, PAGE_SIZE, offset) != PAGE_SIZE) {
+        return RC_READ_FAILED;
+    }
+    setBlockPos(fHandle, pageNum);
+    return RC_OK;
+}
+
+RC readBlocks(int firstPage, int numPages, SM_FileHandle *fHandle, SM_PageHandle *memPages) {
+    if (fHandle->mgmtInfo == NULL) {
+        return RC_FILE_NOT_FOUND;
+    }
+    if (firstPage < 0 || numPages < 0 || firstPage + numPages > fHandle->totalNumPages) {
+        return RC_READ_NON_EXISTING_PAGE;
+    }
+    if (numPages == 0) {
+        return RC_OK;
+    }
+    if (isMapped(fHandle)) {
+        for (int i = 0; i < numPages; i++) {
+            memcpy(memPages[i], fileInfo(fHandle)->map + (size_t)(firstPage + i) * PAGE_SIZE, PAGE_SIZE);
+        }
+    } else {
+        RC rc = transferBlocks(false, firstPage, numPages, fileDescriptor(fHandle), memPages);
+        if (rc != RC_OK) {
+            return rc;
+        }
+    }
+    setBlockPos(fHandle, firstPage + numPages - 1);
+    return RC_OK;
+}
+
+// Zero-copy read for files opened in SM_MODE_MMAP: *pagePtr points at the
+// page inside the mapping until the file is grown or closed
+RC getBlockPointer(int pageNum, SM_FileHandle *fHandle, SM_PageHandle *pagePtr) {
+    if (fHandle->mgmtInfo == NULL) {
+        return RC_FILE_NOT_FOUND;
+    }
+    if (!isMapped(fHandle)) {
+        return RC_FILE_NOT_MAPPED;
+    }
+    if (pageNum < 0 || pageNum >= fHandle->totalNumPages) {
+        return RC_READ_NON_EXISTING_PAGE;
+    }
+    *pagePtr = fileInfo(fHandle)->map + (size_t)pageNum * PAGE_SIZE;
+    setBlockPos(fHandle, pageNum);
     return RC_OK;
 }
 
 int getBlockPos(SM_FileHandle *fHandle) {
-    return fHandle->curPagePos;
+    return __atomic_load_n(&fHandle->curPagePos, __ATOMIC_RELAXED);
 }
 
 RC readFirstBlock(SM_FileHandle *fHandle, SM_PageHandle memPage) {
@@ -83,15 +293,15 @@ RC readFirstBlock(SM_FileHandle *fHandle, SM_PageHandle memPage) {
 }
 
 RC readPreviousBlock(SM_FileHandle *fHandle, SM_PageHandle memPage) {
-    return readBlock(fHandle->curPagePos - 1, fHandle, memPage);
+    return readBlock(getBlockPos(fHandle) - 1, fHandle, memPage);
 }
 
 RC readCurrentBlock(SM_FileHandle *fHandle, SM_PageHandle memPage) {
-    return readBlock(fHandle->curPagePos, fHandle, memPage);
+    return readBlock(getBlockPos(fHandle), fHandle, memPage);
 }
 
 RC readNextBlock(SM_FileHandle *fHandle, SM_PageHandle memPage) {
-    return readBlock(fHandle->curPagePos + 1, fHandle, memPage);
+    return readBlock(getBlockPos(fHandle) + 1, fHandle, memPage);
 }
 
 RC readLastBlock(SM_FileHandle *fHandle, SM_PageHandle memPage) {
@@ -108,35 +318,112 @@ RC writeBlock(int pageNum, SM_FileHandle *fHandle, SM_PageHandle memPage) {
     if (fHandle->mgmtInfo == NULL) {
         return RC_FILE_NOT_FOUND;
     }
-    fseek(fHandle->mgmtInfo, pageNum * PAGE_SIZE, SEEK_SET);
-    fwrite(memPage, sizeof(char), PAGE_SIZE, fHandle->mgmtInfo);
-    fHandle->curPagePos = pageNum;
+    if (pageNum < 0) {
+        return RC_WRITE_FAILED;
+    }
+    off_t offset = (off_t)pageNum * PAGE_SIZE;
+    if (isMapped(fHandle)) {
+        RC rc = ensureCapacity(pageNum + 1, fHandle);
+        if (rc != RC_OK) {
+            return rc;
+        }
+        memcpy(fileInfo(fHandle)->map + offset, memPage, PAGE_SIZE);
+        setBlockPos(fHandle, pageNum);
+        return RC_OK;
+    }
+    if (pwriteFully(fileDescriptor(fHandle), memPage, PAGE_SIZE, offset) != PAGE_SIZE) {
+        return RC_WRITE_FAILED;
+    }
+    // Writing past the end extends the file
+    if (pageNum >= fHandle->totalNumPages) {
+        fHandle->totalNumPages = pageNum + 1;
+    }
+    setBlockPos(fHandle, pageNum);
+    return RC_OK;
+}
+
+RC writeBlocks(int firstPage, int numPages, SM_FileHandle *fHandle, SM_PageHandle *memPages) {
+    if (fHandle->mgmtInfo == NULL) {
+        return RC_FILE_NOT_FOUND;
+    }
+    if (firstPage < 0 || numPages < 0) {
+        return RC_WRITE_FAILED;
+    }
+    if (numPages == 0) {
+        return RC_OK;
+    }
+    if (isMapped(fHandle)) {
+        RC rc = ensureCapacity(firstPage + numPages, fHandle);
+        if (rc != RC_OK) {
+            return rc;
+        }
+        for (int i = 0; i < numPages; i++) {
+            memcpy(fileInfo(fHandle)->map + (size_t)(firstPage + i) * PAGE_SIZE, memPages[i], PAGE_SIZE);
+        }
+        setBlockPos(fHandle, firstPage + numPages - 1);
+        return RC_OK;
+    }
+    RC rc = transferBlocks(true, firstPage, numPages, fileDescriptor(fHandle), memPages);
+    if (rc != RC_OK) {
+        return rc;
+    }
+    if (firstPage + numPages > fHandle->totalNumPages) {
+        fHandle->totalNumPages = firstPage + numPages;
+    }
+    setBlockPos(fHandle, firstPage + numPages - 1);
     return RC_OK;
 }
 
 RC writeCurrentBlock(SM_FileHandle *fHandle, SM_PageHandle memPage) {
-    return writeBlock(fHandle->curPagePos, fHandle, memPage);
+    return writeBlock(getBlockPos(fHandle), fHandle, memPage);
 }
 
 RC appendEmptyBlock(SM_FileHandle *fHandle) {
+    return ensureCapacity(fHandle->totalNumPages + 1, fHandle);
+}
+
+// Grow the file to numberOfPages in one step. Blocks are reserved with
+// posix_fallocate where the file system supports it; otherwise the file
+// is extended with ftruncate and the new pages read back as zeros.
+RC ensureCapacity(int numberOfPages, SM_FileHandle *fHandle) {
     if (fHandle->mgmtInfo == NULL) {
         return RC_FILE_NOT_FOUND;
     }
-    fseek(fHandle->mgmtInfo, fHandle->totalNumPages * PAGE_SIZE, SEEK_SET);
-    for (int i = 0; i < PAGE_SIZE; i++) {
-        fputc('\0', fHandle->mgmtInfo);
+    if (fHandle->totalNumPages >= numberOfPages) {
+        return RC_OK;
     }
-    fHandle->totalNumPages++;
-    fHandle->curPagePos = fHandle->totalNumPages - 1;
+    int fd = fileDescriptor(fHandle);
+    off_t newSize = (off_t)numberOfPages * PAGE_SIZE;
+    int err = posix_fallocate(fd, 0, newSize);
+    if (err == EINTR) {
+        err = posix_fallocate(fd, 0, newSize);
+    }
+    if (err == EOPNOTSUPP || err == EINVAL) {
+        err = ftruncate(fd, newSize) == 0 ? 0 : errno;
+    }
+    if (err != 0) {
+        return RC_WRITE_FAILED;
+    }
+    if (isMapped(fHandle)) {
+        RC rc = remapFile(fileInfo(fHandle), numberOfPages);
+        if (rc != RC_OK) {
+            return rc;
+        }
+    }
+    fHandle->totalNumPages = numberOfPages;
+    setBlockPos(fHandle, numberOfPages - 1);
     return RC_OK;
 }
 
-RC ensureCapacity(int numberOfPages, SM_FileHandle *fHandle) {
-    if (fHandle->totalNumPages < numberOfPages) {
-        int pagesToAdd = numberOfPages - fHandle->totalNumPages;
-        for (int i = 0; i < pagesToAdd; i++) {
-            appendEmptyBlock(fHandle);
-        }
+// Make the pages written so far durable. fsync rather than fdatasync, so
+// that a file ensureCapacity grew keeps its new size after a crash.
+RC syncPageFile(SM_FileHandle *fHandle) {
+    if (fHandle->mgmtInfo == NULL) {
+        return RC_FILE_NOT_FOUND;
     }
-    return RC_OK;
+    SM_FileInfo *info = fileInfo(fHandle);
+    if (info->map != NULL && msync(info->map, info->mapSize, MS_SYNC) != 0) {
+        return RC_WRITE_FAILED;
+    }
+    return fsync(info->fd) == 0 ? RC_OK : RC_WRITE_FAILED;
 }
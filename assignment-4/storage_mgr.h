@@ -15,6 +15,13 @@ typedef struct SM_FileHandle {
 
 typedef char* SM_PageHandle;
 
+/* how an open page file moves pages: pread/pwrite, or a shared mapping of
+ * the whole file that grows with it */
+typedef enum SM_FileMode {
+	SM_MODE_PIO = 0,
+	SM_MODE_MMAP = 1
+} SM_FileMode;
+
 /************************************************************
  *                    interface                             *
  ************************************************************/
@@ -22,6 +29,7 @@ typedef char* SM_PageHandle;
 extern void initStorageManager (void);
 extern RC createPageFile (char *fileName);
 extern RC openPageFile (char *fileName, SM_FileHandle *fHandle);
+extern RC openPageFileWithMode (char *fileName, SM_FileHandle *fHandle, SM_FileMode mode);
 extern RC closePageFile (SM_FileHandle *fHandle);
 extern RC destroyPageFile (char *fileName);
 
@@ -33,11 +41,19 @@ extern RC readPreviousBlock (SM_FileHandle *fHandle, SM_PageHandle memPage);
 extern RC readCurrentBlock (SM_FileHandle *fHandle, SM_PageHandle memPage);
 extern RC readNextBlock (SM_FileHandle *fHandle, SM_PageHandle memPage);
 extern RC readLastBlock (SM_FileHandle *fHandle, SM_PageHandle memPage);
+/* numPages consecutive pages starting at firstPage, page firstPage + i
+ * goes to memPages[i], in one vectored read */
+extern RC readBlocks (int firstPage, int numPages, SM_FileHandle *fHandle, SM_PageHandle *memPages);
+/* SM_MODE_MMAP only: point *pagePtr at the page inside the mapping */
+extern RC getBlockPointer (int pageNum, SM_FileHandle *fHandle, SM_PageHandle *pagePtr);
 
 /* writing blocks to a page file */
 extern RC writeBlock (int pageNum, SM_FileHandle *fHandle, SM_PageHandle memPage);
 extern RC writeCurrentBlock (SM_FileHandle *fHandle, SM_PageHandle memPage);
+extern RC writeBlocks (int firstPage, int numPages, SM_FileHandle *fHandle, SM_PageHandle *memPages);
 extern RC appendEmptyBlock (SM_FileHandle *fHandle);
 extern RC ensureCapacity (int numberOfPages, SM_FileHandle *fHandle);
+/* wait until the pages written so far are on disk */
+extern RC syncPageFile (SM_FileHandle *fHandle);
 
 #endif
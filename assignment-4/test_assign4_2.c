@@ -0,0 +1,2359 @@
+#include <stdlib.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "dberror.h"
+#include "expr.h"
+#include "buffer_mgr.h"
+#include "buffer_mgr_stat.h"
+#include "btree_mgr.h"
+#include "record_mgr.h"
+#include "tables.h"
+#include "test_helper.h"
+
+
+#define ASSERT_EQUALS_RECORDS(_l,_r, schema, message)			\
+  do {									\
+    Record *_lR = _l;							\
+    Record *_rR = _r;							\
+    ASSERT_TRUE(memcmp(_lR->data,_rR->data,getRecordSize(schema)) == 0, message); \
+    freeRecord(_lR);							\
+  } while(0)
+
+// check whether two the content of a buffer pool is the same as an expected content
+// (given in the format produced by sprintPoolContent)
+#define ASSERT_EQUALS_POOL(expected,bm,message)			        \
+  do {									\
+    char *real;								\
+    char *_exp = (char *) (expected);                                   \
+    real = sprintPoolContent(bm);					\
+    if (strcmp((_exp),real) != 0)					\
+      {									\
+	printf("[%s-%s-L%i-%s] FAILED: expected <%s> but was <%s>: %s\n",TEST_INFO, _exp, real, message); \
+	free(real);							\
+	exit(1);							\
+      }									\
+    printf("[%s-%s-L%i-%s] OK: expected <%s> and was <%s>: %s\n",TEST_INFO, _exp, real, message); \
+    free(real);								\
+  } while(0)
+
+// test methods
+static void testRecordsThroughBufferPool (void);
+static void testPageAtATimeScan (void);
+static void testClock (void);
+static void testLFU (void);
+static void testLRU_K (void);
+static void testFailedWriteBack (void);
+static void testVectoredIO (void);
+static void testMappedFile (void);
+static void testPersistentBtree (void);
+static void testBulkLoad (void);
+static void testRangeScan (void);
+static void testKeyTypes (void);
+static void testDeleteRebalance (void);
+static void testConcurrentAccess (void);
+static void testSecondaryIndex (void);
+static void testFreeSpaceReuse (void);
+static void testVariableLengthRecords (void);
+static void testLiveSlotBitmap (void);
+static void testWriteAheadLog (void);
+static void testCrashRecovery (void);
+static void testTransactions (void);
+
+// helper methods
+static void usePages (BM_BufferPool *bm, const int *pages, int numPages);
+
+// struct for test records
+typedef struct TestRecord {
+  int a;
+  char *b;
+  int c;
+} TestRecord;
+
+// helper methods
+static Record *testRecord(Schema *schema, int a, char *b, int c);
+static Schema *testSchema (void);
+static Record *fromTestRecord (Schema *schema, TestRecord in);
+
+// threads of testConcurrentAccess
+#define CONCURRENT_KEYS 20000
+#define CONCURRENT_READERS 4
+#define CONCURRENT_WRITERS 2
+
+typedef struct ConcurrentWorker {
+  BTreeHandle *tree;
+  int id;
+  int *done;
+  int errors;
+  int operations;
+} ConcurrentWorker;
+
+static void *concurrentReader (void *arg);
+static void *concurrentWriter (void *arg);
+static void *concurrentScanner (void *arg);
+
+// threads of testWriteAheadLog
+#define WAL_THREADS 4
+#define WAL_INSERTS 200
+
+typedef struct WalWorker {
+  RM_TableData *table;
+  Schema *schema;
+  int id;
+  int errors;
+} WalWorker;
+
+static void *walInserter (void *arg);
+
+// threads of testWriteAheadLog flushing a log whose writes fail
+typedef struct WalFlusher {
+  WAL_Log *log;
+  LSN lsn;
+  RC rc;
+} WalFlusher;
+
+static void *walFlusher (void *arg);
+
+// inserts of testCrashRecovery, enough to log a checkpoint
+#define RECOVERY_INSERTS 8000
+
+static void writeUncommittedUpdate (RM_TableMgmtData *mgmt);
+
+// thread of testTransactions working on a table while another thread has
+// a transaction open on it
+typedef struct TxOutsider {
+  RM_TableData *table;
+  RM_TxHandle *tx;
+  RC txRc;
+  bool triedTx; // done with tx, which is freed when it ends
+  int numTuples;
+} TxOutsider;
+
+static void *txOutsider (void *arg);
+
+// test name
+char *testName;
+
+// main method
+int
+main (void)
+{
+  testName = "";
+
+  testRecordsThroughBufferPool();
+  testPageAtATimeScan();
+  testClock();
+  testLFU();
+  testLRU_K();
+  testFailedWriteBack();
+  testVectoredIO();
+  testMappedFile();
+  testPersistentBtree();
+  testBulkLoad();
+  testRangeScan();
+  testKeyTypes();
+  testDeleteRebalance();
+  testConcurrentAccess();
+  testSecondaryIndex();
+  testFreeSpaceReuse();
+  testVariableLengthRecords();
+  testLiveSlotBitmap();
+  testWriteAheadLog();
+  testCrashRecovery();
+  testTransactions();
+
+  return 0;
+}
+
+// ************************************************************
+void
+testRecordsThroughBufferPool (void)
+{
+  RM_TableData *table = (RM_TableData *) malloc(sizeof(RM_TableData));
+  TestRecord inserts[] = {
+    {1, "aaaa", 3},
+    {2, "bbbb", 2},
+    {3, "cccc", 1},
+    {4, "dddd", 3},
+    {5, "eeee", 5},
+  };
+  int numInserts = 5, i, readIO;
+  Record *r;
+  RID *rids;
+  Schema *schema;
+  testName = "test record access through the table's buffer pool";
+  schema = testSchema();
+  rids = (RID *) malloc(sizeof(RID) * numInserts);
+
+  TEST_CHECK(initRecordManager(NULL));
+  TEST_CHECK(createTable("test_table_r",schema));
+  TEST_CHECK(openTable(table, "test_table_r"));
+
+  for(i = 0; i < numInserts; i++)
+    {
+      r = fromTestRecord(schema, inserts[i]);
+      TEST_CHECK(insertRecord(table,r));
+      rids[i] = r->id;
+      freeRecord(r);
+    }
+  ASSERT_EQUALS_INT(numInserts, getNumTuples(table), "tuple count");
+
+  // records must survive closing the table, which flushes the pool
+  TEST_CHECK(closeTable(table));
+  TEST_CHECK(openTable(table, "test_table_r"));
+
+  TEST_CHECK(createRecord(&r, schema));
+  TEST_CHECK(getRecord(table, rids[0], r));
+  ASSERT_EQUALS_RECORDS(fromTestRecord(schema, inserts[0]), r, schema, "compare records");
+
+  // the data page and the metadata page are cached now
+  readIO = getNumReadIO((BM_BufferPool *) table->mgmtData);
+  for(i = 0; i < 1000; i++)
+    {
+      int pos = rand() % numInserts;
+      TEST_CHECK(getRecord(table, rids[pos], r));
+      ASSERT_EQUALS_RECORDS(fromTestRecord(schema, inserts[pos]), r, schema, "compare records");
+    }
+  ASSERT_EQUALS_INT(readIO, getNumReadIO((BM_BufferPool *) table->mgmtData), "no reads for cached pages");
+
+  // updates and deletes stay in the pool until the table is closed
+  TEST_CHECK(deleteRecord(table, rids[1]));
+  ASSERT_ERROR(getRecord(table, rids[1], r), "deleted record is gone");
+  freeRecord(r);
+  r = fromTestRecord(schema, inserts[4]);
+  r->id = rids[0];
+  TEST_CHECK(updateRecord(table, r));
+  freeRecord(r);
+  ASSERT_EQUALS_INT(0, getNumWriteIO((BM_BufferPool *) table->mgmtData), "no writes before close");
+
+  TEST_CHECK(closeTable(table));
+  TEST_CHECK(openTable(table, "test_table_r"));
+  TEST_CHECK(createRecord(&r, schema));
+  TEST_CHECK(getRecord(table, rids[0], r));
+  ASSERT_EQUALS_RECORDS(fromTestRecord(schema, inserts[4]), r, schema, "update was written back");
+  ASSERT_ERROR(getRecord(table, rids[1], r), "delete was written back");
+  freeRecord(r);
+
+  TEST_CHECK(closeTable(table));
+  TEST_CHECK(deleteTable("test_table_r"));
+  TEST_CHECK(shutdownRecordManager());
+
+  free(rids);
+  free(table);
+  freeSchema(schema);
+  TEST_DONE();
+}
+
+// ************************************************************
+void
+testPageAtATimeScan (void)
+{
+  RM_TableData *table = (RM_TableData *) malloc(sizeof(RM_TableData));
+  RM_ScanHandle *sc = (RM_ScanHandle *) malloc(sizeof(RM_ScanHandle));
+  int numInserts = 2000, numDeletes = 0, i, rc, seen, readIO;
+  int numDataPages;
+  Expr *sel, *left, *right;
+  Record *r;
+  RID *rids;
+  Schema *schema;
+  testName = "test scanning a table one pinned page at a time";
+  schema = testSchema();
+  rids = (RID *) malloc(sizeof(RID) * numInserts);
+
+  TEST_CHECK(initRecordManager(NULL));
+  TEST_CHECK(createTable("test_table_r",schema));
+  TEST_CHECK(openTable(table, "test_table_r"));
+
+  for(i = 0; i < numInserts; i++)
+    {
+      r = testRecord(schema, i, "abcd", i % 7);
+      TEST_CHECK(insertRecord(table,r));
+      rids[i] = r->id;
+      freeRecord(r);
+    }
+  numDataPages = rids[numInserts - 1].page - 1;
+  for(i = 0; i < numInserts; i += 10)
+    {
+      TEST_CHECK(deleteRecord(table, rids[i]));
+      numDeletes++;
+    }
+
+  TEST_CHECK(closeTable(table));
+  TEST_CHECK(openTable(table, "test_table_r"));
+
+  // full scan: every data page is read exactly once, on top of the
+  // schema page read by openTable and the metadata page
+  TEST_CHECK(createRecord(&r, schema));
+  TEST_CHECK(startScan(table, sc, NULL));
+  seen = 0;
+  while((rc = next(sc, r)) == RC_OK)
+    {
+      ASSERT_TRUE(r->id.page == rids[seen + seen / 9 + 1].page
+		  && r->id.slot == rids[seen + seen / 9 + 1].slot, "scan returns tuples in RID order");
+      seen++;
+    }
+  ASSERT_EQUALS_INT(RC_RM_NO_MORE_TUPLES, rc, "scan ends cleanly");
+  TEST_CHECK(closeScan(sc));
+  ASSERT_EQUALS_INT(numInserts - numDeletes, seen, "deleted tuples are skipped");
+  ASSERT_EQUALS_INT(numDataPages + 2, getNumReadIO((BM_BufferPool *) table->mgmtData), "one read per page");
+
+  // selective scan: c = 3
+  readIO = getNumReadIO((BM_BufferPool *) table->mgmtData);
+  MAKE_CONS(left, stringToValue("i3"));
+  MAKE_ATTRREF(right, 2);
+  MAKE_BINOP_EXPR(sel, left, right, OP_COMP_EQUAL);
+  TEST_CHECK(startScan(table, sc, sel));
+  seen = 0;
+  while((rc = next(sc, r)) == RC_OK)
+    {
+      Value *val;
+      TEST_CHECK(getAttr(r, schema, 2, &val));
+      ASSERT_EQUALS_INT(3, val->v.intV, "condition holds");
+      freeVal(val);
+      seen++;
+    }
+  TEST_CHECK(closeScan(sc));
+  ASSERT_TRUE(seen > 0, "selective scan found tuples");
+  ASSERT_EQUALS_INT(readIO, getNumReadIO((BM_BufferPool *) table->mgmtData), "second scan is served from the pool");
+
+  freeRecord(r);
+  freeExpr(sel);
+  TEST_CHECK(closeTable(table));
+  TEST_CHECK(deleteTable("test_table_r"));
+
+  free(rids);
+  free(sc);
+  free(table);
+  freeSchema(schema);
+  TEST_DONE();
+}
+
+// ************************************************************
+void
+testClock (void)
+{
+  const int loads[] = {0, 1, 2};
+  const int reuse[] = {1};
+  BM_BufferPool *bm = MAKE_POOL();
+  BM_PageHandle *h = MAKE_PAGE_HANDLE();
+  testName = "Testing CLOCK page replacement";
+
+  CHECK(createPageFile("testbuffer.bin"));
+  CHECK(initBufferPool(bm, "testbuffer.bin", 3, RS_CLOCK, NULL));
+
+  usePages(bm, loads, 3);
+  ASSERT_EQUALS_POOL("[0 0],[1 0],[2 0]", bm, "pool filled");
+
+  // every frame is referenced, the hand clears all bits and takes frame 0
+  CHECK(pinPage(bm, h, 3));
+  CHECK(unpinPage(bm, h));
+  ASSERT_EQUALS_POOL("[3 0],[1 0],[2 0]", bm, "full sweep evicts frame 0");
+
+  // page 1 gets a second chance, page 2 does not
+  usePages(bm, reuse, 1);
+  CHECK(pinPage(bm, h, 4));
+  CHECK(unpinPage(bm, h));
+  ASSERT_EQUALS_POOL("[3 0],[1 0],[4 0]", bm, "referenced page skipped");
+
+  // pinned frames are never chosen
+  CHECK(pinPage(bm, h, 1));
+  CHECK(pinPage(bm, h, 5));
+  CHECK(unpinPage(bm, h));
+  ASSERT_EQUALS_POOL("[5 0],[1 1],[4 0]", bm, "pinned page skipped");
+  h->pageNum = 1;
+  CHECK(unpinPage(bm, h));
+
+  CHECK(shutdownBufferPool(bm));
+  CHECK(destroyPageFile("testbuffer.bin"));
+  free(bm);
+  free(h);
+  TEST_DONE();
+}
+
+// ************************************************************
+void
+testLFU (void)
+{
+  const int accesses[] = {0, 0, 0, 1, 1, 2};
+  BM_BufferPool *bm = MAKE_POOL();
+  BM_PageHandle *h = MAKE_PAGE_HANDLE();
+  testName = "Testing LFU page replacement";
+
+  CHECK(createPageFile("testbuffer.bin"));
+  CHECK(initBufferPool(bm, "testbuffer.bin", 3, RS_LFU, NULL));
+
+  usePages(bm, accesses, 6);
+  ASSERT_EQUALS_POOL("[0 0],[1 0],[2 0]", bm, "pool filled");
+
+  CHECK(pinPage(bm, h, 3));
+  CHECK(unpinPage(bm, h));
+  ASSERT_EQUALS_POOL("[0 0],[1 0],[3 0]", bm, "least frequently used page evicted");
+
+  // page 3 has one reference, ties with nothing, so it goes next
+  CHECK(pinPage(bm, h, 4));
+  CHECK(unpinPage(bm, h));
+  ASSERT_EQUALS_POOL("[0 0],[1 0],[4 0]", bm, "new page is the least frequently used");
+  ASSERT_EQUALS_INT(5, getNumReadIO(bm), "check number of read I/Os");
+
+  CHECK(shutdownBufferPool(bm));
+  CHECK(destroyPageFile("testbuffer.bin"));
+  free(bm);
+  free(h);
+  TEST_DONE();
+}
+
+// ************************************************************
+void
+testLRU_K (void)
+{
+  // LRU would evict page 0, the least recently used one; LRU-2 evicts
+  // page 2 since it has been referenced only once
+  const int accesses[] = {0, 0, 1, 1, 2};
+  const int orderRequests[] = {3, 4, 0, 2, 1};
+  int k = 2, i;
+  BM_BufferPool *bm = MAKE_POOL();
+  BM_PageHandle *h = MAKE_PAGE_HANDLE();
+  testName = "Testing LRU_K page replacement";
+
+  CHECK(createPageFile("testbuffer.bin"));
+  CHECK(initBufferPool(bm, "testbuffer.bin", 3, RS_LRU_K, &k));
+
+  usePages(bm, accesses, 5);
+  CHECK(pinPage(bm, h, 3));
+  CHECK(unpinPage(bm, h));
+  ASSERT_EQUALS_POOL("[0 0],[1 0],[3 0]", bm, "page with fewer than K references evicted");
+  CHECK(pinPage(bm, h, 4));
+  CHECK(unpinPage(bm, h));
+  ASSERT_EQUALS_POOL("[0 0],[1 0],[4 0]", bm, "new page evicted before the hot pages");
+  CHECK(shutdownBufferPool(bm));
+
+  // with K = 1 the policy is plain LRU
+  k = 1;
+  CHECK(initBufferPool(bm, "testbuffer.bin", 5, RS_LRU_K, &k));
+  for(i = 0; i < 5; i++)
+    {
+      CHECK(pinPage(bm, h, i));
+      CHECK(unpinPage(bm, h));
+    }
+  usePages(bm, orderRequests, 5);
+  for(i = 0; i < 5; i++)
+    {
+      CHECK(pinPage(bm, h, 5 + i));
+      CHECK(unpinPage(bm, h));
+    }
+  ASSERT_EQUALS_POOL("[7 0],[9 0],[8 0],[5 0],[6 0]", bm, "K = 1 evicts in LRU order");
+
+  CHECK(shutdownBufferPool(bm));
+  CHECK(destroyPageFile("testbuffer.bin"));
+  free(bm);
+  free(h);
+  TEST_DONE();
+}
+
+// ************************************************************
+void
+testFailedWriteBack (void)
+{
+  BM_BufferPool *bm = MAKE_POOL();
+  BM_PageHandle *h = MAKE_PAGE_HANDLE();
+  SM_FileHandle fh;
+  WAL_Log *log;
+  WAL_Record record;
+  LSN lsn;
+  int fd;
+  testName = "Testing a victim that cannot be written back";
+
+  // a pool on a missing file frees what it allocated
+  ASSERT_ERROR(initBufferPool(bm, "testbuffer.bin", 2, RS_FIFO, NULL), "pool on a missing file fails");
+  ASSERT_TRUE(bm->mgmtData == NULL, "failed pool keeps no state");
+
+  CHECK(createPageFile("testbuffer.bin"));
+  CHECK(openPageFile("testbuffer.bin", &fh));
+  CHECK(ensureCapacity(4, &fh));
+  CHECK(closePageFile(&fh));
+  CHECK(initBufferPool(bm, "testbuffer.bin", 2, RS_FIFO, NULL));
+  CHECK(openLog(&log, "testbuffer.log"));
+  CHECK(setPoolLog(bm, log));
+
+  // page 0 is changed by a record that is not durable yet
+  memset(&record, 0, sizeof(record));
+  record.length = sizeof(record);
+  record.type = WAL_COMMIT;
+  CHECK(pinPage(bm, h, 0));
+  CHECK(appendLogRecord(log, &record, &lsn));
+  CHECK(markDirtyLSN(bm, h, lsn));
+  CHECK(unpinPage(bm, h));
+  CHECK(pinPage(bm, h, 1));
+  CHECK(unpinPage(bm, h));
+  ASSERT_EQUALS_POOL("[0x0],[1 0]", bm, "page 0 dirty");
+
+  // the log can no longer be written, so neither can page 0: the pin
+  // fails and page 0 stays in the pool, still dirty
+  fd = open("/dev/null", O_RDONLY);
+  dup2(fd, log->fd);
+  close(fd);
+  ASSERT_ERROR(pinPage(bm, h, 2), "pin that must evict page 0 fails");
+  ASSERT_EQUALS_POOL("[0x0],[1 0]", bm, "page 0 kept");
+  ASSERT_EQUALS_INT(0, getNumWriteIO(bm), "nothing written");
+
+  // FIFO now evicts page 1 first; the run of prefetched pages is given
+  // back when page 0 cannot be evicted for its second page
+  ASSERT_ERROR(prefetchPages(bm, 2, 2), "prefetch that must evict page 0 fails");
+  ASSERT_EQUALS_POOL("[0x0],[-1 0]", bm, "page 0 kept by prefetch");
+
+  CHECK(shutdownBufferPool(bm));
+  closeLog(log);
+  CHECK(destroyPageFile("testbuffer.bin"));
+  unlink("testbuffer.log");
+  free(bm);
+  free(h);
+  TEST_DONE();
+}
+
+// ************************************************************
+void
+testVectoredIO (void)
+{
+  SM_FileHandle fh;
+  SM_PageHandle out[6], in[6];
+  BM_BufferPool *bm = MAKE_POOL();
+  BM_PageHandle *h = MAKE_PAGE_HANDLE();
+  int i;
+  testName = "Testing multi-page reads and writes";
+
+  for(i = 0; i < 6; i++)
+    {
+      out[i] = calloc(PAGE_SIZE, 1);
+      in[i] = calloc(PAGE_SIZE, 1);
+      sprintf(out[i], "vec-%i", i);
+    }
+
+  CHECK(createPageFile("testbuffer.bin"));
+  CHECK(openPageFile("testbuffer.bin", &fh));
+  CHECK(writeBlocks(0, 6, &fh, out));
+  ASSERT_EQUALS_INT(6, fh.totalNumPages, "writeBlocks extends the file");
+  CHECK(readBlocks(0, 6, &fh, in));
+  for(i = 0; i < 6; i++)
+    ASSERT_EQUALS_STRING(out[i], in[i], "page read back by readBlocks");
+  ASSERT_ERROR(readBlocks(4, 3, &fh, in), "reading past the end fails");
+  CHECK(closePageFile(&fh));
+
+  // prefetched pages are resident but not pinned
+  CHECK(initBufferPool(bm, "testbuffer.bin", 4, RS_FIFO, NULL));
+  CHECK(prefetchPages(bm, 1, 3));
+  ASSERT_EQUALS_POOL("[1 0],[2 0],[3 0],[-1 0]", bm, "pages prefetched");
+  ASSERT_EQUALS_INT(3, getNumReadIO(bm), "prefetch reads each page once");
+  CHECK(pinPage(bm, h, 2));
+  CHECK(unpinPage(bm, h));
+  ASSERT_EQUALS_INT(3, getNumReadIO(bm), "prefetched page is a hit");
+
+  // adjacent dirty pages are flushed together
+  for(i = 1; i <= 3; i++)
+    {
+      CHECK(pinPage(bm, h, i));
+      sprintf(h->data, "flushed-%i", i);
+      CHECK(markDirty(bm, h));
+      CHECK(unpinPage(bm, h));
+    }
+  CHECK(forceFlushPool(bm));
+  ASSERT_EQUALS_POOL("[1 0],[2 0],[3 0],[-1 0]", bm, "flush clears dirty flags");
+  ASSERT_EQUALS_INT(3, getNumWriteIO(bm), "one write I/O per flushed page");
+  CHECK(shutdownBufferPool(bm));
+
+  CHECK(openPageFile("testbuffer.bin", &fh));
+  CHECK(readBlocks(0, 6, &fh, in));
+  ASSERT_EQUALS_STRING("vec-0", in[0], "page before the run untouched");
+  ASSERT_EQUALS_STRING("flushed-2", in[2], "flushed page on disk");
+  ASSERT_EQUALS_STRING("vec-4", in[4], "page after the run untouched");
+  CHECK(closePageFile(&fh));
+
+  CHECK(destroyPageFile("testbuffer.bin"));
+  for(i = 0; i < 6; i++)
+    {
+      free(out[i]);
+      free(in[i]);
+    }
+  free(bm);
+  free(h);
+  TEST_DONE();
+}
+
+// ************************************************************
+void
+testMappedFile (void)
+{
+  SM_FileHandle fh;
+  SM_PageHandle page = calloc(PAGE_SIZE, 1);
+  SM_PageHandle mapped;
+  testName = "Testing memory-mapped page files";
+
+  CHECK(createPageFile("testbuffer.bin"));
+  CHECK(openPageFileWithMode("testbuffer.bin", &fh, SM_MODE_MMAP));
+  strcpy(page, "mapped-0");
+  CHECK(writeBlock(0, &fh, page));
+  CHECK(getBlockPointer(0, &fh, &mapped));
+  ASSERT_EQUALS_STRING("mapped-0", mapped, "page visible through the mapping");
+
+  // the mapping grows with the file
+  CHECK(ensureCapacity(4, &fh));
+  ASSERT_EQUALS_INT(4, fh.totalNumPages, "file grown");
+  strcpy(page, "mapped-5");
+  CHECK(writeBlock(5, &fh, page));
+  ASSERT_EQUALS_INT(6, fh.totalNumPages, "write past the end grows the file");
+  CHECK(getBlockPointer(5, &fh, &mapped));
+  ASSERT_EQUALS_STRING("mapped-5", mapped, "pointer into the grown mapping");
+  CHECK(getBlockPointer(3, &fh, &mapped));
+  ASSERT_EQUALS_INT(0, mapped[0], "new pages are zero");
+  ASSERT_ERROR(getBlockPointer(6, &fh, &mapped), "no pointer past the end");
+  CHECK(closePageFile(&fh));
+
+  // the data reached the file
+  CHECK(openPageFile("testbuffer.bin", &fh));
+  CHECK(readBlock(5, &fh, page));
+  ASSERT_EQUALS_STRING("mapped-5", page, "mapped write read back with pread");
+  ASSERT_ERROR(getBlockPointer(0, &fh, &mapped), "no pointers without a mapping");
+  CHECK(closePageFile(&fh));
+
+  CHECK(destroyPageFile("testbuffer.bin"));
+  free(page);
+  TEST_DONE();
+}
+
+// ************************************************************
+void
+testPersistentBtree (void)
+{
+  // many more nodes than the tree's buffer pool has frames
+  const int numKeys = 5000;
+  BTreeHandle *tree = NULL;
+  BT_ScanHandle *sc = NULL;
+  Value key;
+  RID rid;
+  int i, testint, rc;
+  int *order = (int *) malloc(numKeys * sizeof(int));
+  testName = "test b-tree stored on pages";
+
+  for(i = 0; i < numKeys; i++)
+    order[i] = i;
+  for(i = 0; i < numKeys; i++)
+    {
+      int j = rand() % numKeys, temp = order[i];
+      order[i] = order[j];
+      order[j] = temp;
+    }
+
+  TEST_CHECK(initIndexManager(NULL));
+  ASSERT_ERROR(openBtree(&tree, "testidx"), "missing index file is not opened");
+  ASSERT_TRUE(tree == NULL, "no tree for a missing index file");
+  ASSERT_EQUALS_INT(RC_IM_N_TO_LAGE, createBtree("testidx", DT_INT, PAGE_SIZE), "order must fit a page");
+  TEST_CHECK(createBtree("testidx", DT_INT, 4));
+  TEST_CHECK(openBtree(&tree, "testidx"));
+  key.dt = DT_INT;
+  for(i = 0; i < numKeys; i++)
+    {
+      key.v.intV = order[i];
+      rid.page = order[i] / 10;
+      rid.slot = order[i] % 10;
+      TEST_CHECK(insertKey(tree, &key, rid));
+    }
+  ASSERT_EQUALS_INT(RC_IM_KEY_ALREADY_EXISTS, insertKey(tree, &key, rid), "duplicate key rejected");
+  TEST_CHECK(getNumNodes(tree, &testint));
+  ASSERT_TRUE(testint > 1000, "tree larger than its buffer pool");
+  TEST_CHECK(closeBtree(tree));
+
+  // everything is read back from the index file
+  TEST_CHECK(openBtree(&tree, "testidx"));
+  TEST_CHECK(getNumEntries(tree, &testint));
+  ASSERT_EQUALS_INT(numKeys, testint, "entries survive reopening");
+  TEST_CHECK(getKeyType(tree, &key.dt));
+  ASSERT_EQUALS_INT(DT_INT, key.dt, "key type survives reopening");
+  for(i = 0; i < numKeys; i += 7)
+    {
+      key.v.intV = i;
+      TEST_CHECK(findKey(tree, &key, &rid));
+      ASSERT_TRUE(rid.page == i / 10 && rid.slot == i % 10, "found RID after reopening");
+    }
+
+  TEST_CHECK(openTreeScan(tree, &sc));
+  i = 0;
+  while((rc = nextEntry(sc, &rid)) == RC_OK)
+    {
+      if (rid.page != i / 10 || rid.slot != i % 10)
+        break;
+      i++;
+    }
+  ASSERT_EQUALS_INT(numKeys, i, "scan returns every entry in key order");
+  ASSERT_EQUALS_INT(RC_IM_NO_MORE_ENTRIES, rc, "scan ends after the last leaf");
+  TEST_CHECK(closeTreeScan(sc));
+
+  TEST_CHECK(closeBtree(tree));
+  TEST_CHECK(deleteBtree("testidx"));
+  free(order);
+  TEST_DONE();
+}
+
+// ************************************************************
+void
+testBulkLoad (void)
+{
+  int orders[] = { 3, 4, 8 };
+  float fills[] = { 0.5, 0.7, 1.0 };
+  int sizes[] = { 0, 1, 2, 5, 37, 3000 };
+  BT_BulkLoadHandle *bl = NULL;
+  BTreeHandle *tree = NULL;
+  BT_ScanHandle *sc = NULL;
+  Value key;
+  RID rid;
+  int o, f, s, i, testint, rc;
+  testName = "test bulk loading a b-tree from sorted keys";
+
+  TEST_CHECK(initIndexManager(NULL));
+  key.dt = DT_INT;
+  for(o = 0; o < 3; o++)
+    for(f = 0; f < 3; f++)
+      for(s = 0; s < 6; s++)
+	{
+	  int numKeys = sizes[s];
+
+	  // even keys only, so the odd ones can be inserted afterwards
+	  TEST_CHECK(createBtree("testidx", DT_INT, orders[o]));
+	  TEST_CHECK(openBtree(&tree, "testidx"));
+	  TEST_CHECK(startBulkLoad(tree, fills[f], &bl));
+	  for(i = 0; i < numKeys; i++)
+	    {
+	      key.v.intV = i * 2;
+	      rid.page = i;
+	      rid.slot = 0;
+	      TEST_CHECK(bulkLoadEntry(bl, &key, rid));
+	    }
+	  if (numKeys > 0)
+	    {
+	      ASSERT_EQUALS_INT(RC_IM_KEY_ALREADY_EXISTS, bulkLoadEntry(bl, &key, rid), "duplicate key rejected");
+	      key.v.intV = -1;
+	      ASSERT_EQUALS_INT(RC_IM_KEYS_NOT_SORTED, bulkLoadEntry(bl, &key, rid), "unsorted key rejected");
+	    }
+	  TEST_CHECK(finishBulkLoad(bl));
+	  TEST_CHECK(closeBtree(tree));
+
+	  TEST_CHECK(openBtree(&tree, "testidx"));
+	  TEST_CHECK(getNumEntries(tree, &testint));
+	  ASSERT_EQUALS_INT(numKeys, testint, "every entry was loaded");
+	  if (numKeys == 3000 && orders[o] == 4 && fills[f] == 1.0)
+	    {
+	      // 750 full leaves and 189 internal nodes above them
+	      TEST_CHECK(getNumNodes(tree, &testint));
+	      ASSERT_EQUALS_INT(939, testint, "leaves packed full");
+	    }
+	  for(i = 0; i < numKeys; i++)
+	    {
+	      key.v.intV = i * 2;
+	      TEST_CHECK(findKey(tree, &key, &rid));
+	      ASSERT_TRUE(rid.page == i, "found bulk loaded key");
+	      key.v.intV = i * 2 + 1;
+	      ASSERT_EQUALS_INT(RC_IM_KEY_NOT_FOUND, findKey(tree, &key, &rid), "key between loaded keys missing");
+	    }
+
+	  // the loaded tree takes ordinary inserts
+	  for(i = 0; i < numKeys; i++)
+	    {
+	      key.v.intV = i * 2 + 1;
+	      rid.page = numKeys + i;
+	      TEST_CHECK(insertKey(tree, &key, rid));
+	    }
+	  TEST_CHECK(openTreeScan(tree, &sc));
+	  i = 0;
+	  while((rc = nextEntry(sc, &rid)) == RC_OK)
+	    {
+	      if (rid.page != (i % 2 == 0 ? i / 2 : numKeys + i / 2))
+		break;
+	      i++;
+	    }
+	  ASSERT_EQUALS_INT(numKeys * 2, i, "scan returns loaded and inserted keys in order");
+	  TEST_CHECK(closeTreeScan(sc));
+
+	  TEST_CHECK(closeBtree(tree));
+	  TEST_CHECK(deleteBtree("testidx"));
+	}
+
+  // only an empty tree can be bulk loaded
+  TEST_CHECK(createBtree("testidx", DT_INT, 4));
+  TEST_CHECK(openBtree(&tree, "testidx"));
+  key.v.intV = 1;
+  TEST_CHECK(insertKey(tree, &key, rid));
+  ASSERT_EQUALS_INT(RC_IM_TREE_NOT_EMPTY, startBulkLoad(tree, 1.0, &bl), "tree is not empty");
+  TEST_CHECK(closeBtree(tree));
+  TEST_CHECK(deleteBtree("testidx"));
+  TEST_DONE();
+}
+
+// ************************************************************
+void
+testRangeScan (void)
+{
+  // bounds of each range, and whether they are inclusive
+  int lows[] = { 100, 100, 101, -50, 1990, 500, 700 };
+  int highs[] = { 200, 200, 199, 7, 5000, 500, 600 };
+  bool lowIncl[] = { true, false, true, false, true, true, true };
+  bool highIncl[] = { true, false, false, true, false, true, true };
+  const int numKeys = 1000, numRanges = 7;
+  BT_BulkLoadHandle *bl = NULL;
+  BTreeHandle *tree = NULL;
+  BT_ScanHandle *sc = NULL;
+  BM_BufferPool *pool;
+  Value key, low, high;
+  RID rid;
+  int r, i, expected, readIO, rc;
+  testName = "test b-tree range scans";
+
+  // even keys from 0 to 1998
+  TEST_CHECK(initIndexManager(NULL));
+  TEST_CHECK(createBtree("testidx", DT_INT, 4));
+  TEST_CHECK(openBtree(&tree, "testidx"));
+  TEST_CHECK(startBulkLoad(tree, 1.0, &bl));
+  key.dt = DT_INT;
+  for(i = 0; i < numKeys; i++)
+    {
+      key.v.intV = i * 2;
+      rid.page = i;
+      rid.slot = 0;
+      TEST_CHECK(bulkLoadEntry(bl, &key, rid));
+    }
+  TEST_CHECK(finishBulkLoad(bl));
+
+  low.dt = high.dt = DT_INT;
+  for(r = 0; r < numRanges; r++)
+    {
+      low.v.intV = lows[r];
+      high.v.intV = highs[r];
+      TEST_CHECK(openTreeRangeScan(tree, &low, lowIncl[r], &high, highIncl[r], &sc));
+      expected = lows[r] < 0 ? 0 : lows[r] + lows[r] % 2;
+      if (expected == lows[r] && !lowIncl[r])
+	expected += 2;
+      while((rc = nextEntryWithKey(sc, &key, &rid)) == RC_OK)
+	{
+	  if (key.v.intV != expected || rid.page != expected / 2)
+	    break;
+	  expected += 2;
+	}
+      ASSERT_EQUALS_INT(RC_IM_NO_MORE_ENTRIES, rc, "range scan returns keys in order");
+      ASSERT_TRUE(expected > highs[r] || (expected == highs[r] && !highIncl[r]) || expected >= numKeys * 2,
+		  "range scan stops at the upper bound");
+      TEST_CHECK(closeTreeScan(sc));
+    }
+
+  // open ends
+  high.v.intV = 10;
+  TEST_CHECK(openTreeRangeScan(tree, NULL, false, &high, false, &sc));
+  for(i = 0; (rc = nextEntryWithKey(sc, &key, &rid)) == RC_OK; i++)
+    ASSERT_EQUALS_INT(i * 2, key.v.intV, "scan from the first key");
+  ASSERT_EQUALS_INT(5, i, "keys below the upper bound");
+  TEST_CHECK(closeTreeScan(sc));
+  low.v.intV = 1990;
+  TEST_CHECK(openTreeRangeScan(tree, &low, false, NULL, false, &sc));
+  for(i = 0; (rc = nextEntry(sc, &rid)) == RC_OK; i++)
+    ASSERT_EQUALS_INT(996 + i, rid.page, "scan to the last key");
+  ASSERT_EQUALS_INT(4, i, "keys above the lower bound");
+  TEST_CHECK(closeTreeScan(sc));
+
+  // a small slice only reads the path down to it and the leaves it covers
+  TEST_CHECK(closeBtree(tree));
+  TEST_CHECK(openBtree(&tree, "testidx"));
+  pool = ((BTreeMgmtData *) tree->mgmtData)->pool;
+  readIO = getNumReadIO(pool);
+  low.v.intV = 1000;
+  high.v.intV = 1010;
+  TEST_CHECK(openTreeRangeScan(tree, &low, true, &high, true, &sc));
+  for(i = 0; nextEntry(sc, &rid) == RC_OK; i++)
+    ;
+  ASSERT_EQUALS_INT(6, i, "keys in the slice");
+  TEST_CHECK(closeTreeScan(sc));
+  ASSERT_TRUE(getNumReadIO(pool) - readIO <= 8, "range scan reads few pages");
+
+  TEST_CHECK(closeBtree(tree));
+  TEST_CHECK(deleteBtree("testidx"));
+  TEST_DONE();
+}
+
+// ************************************************************
+void
+testKeyTypes (void)
+{
+  float floats[] = { 2.5, -1.0, 0.0, -1000.25, 3e20, -3e-20, 1.0 };
+  float sortedFloats[] = { -1000.25, -1.0, -3e-20, 0.0, 1.0, 2.5, 3e20 };
+  char *strings[] = { "pear", "apple", "", "applesau", "b", "zz", "apples" };
+  char *sortedStrings[] = { "", "apple", "apples", "applesau", "b", "pear", "zz" };
+  char *names[] = { "bbbb", "aaaa", "bbbb", "cccc", "bbbb", "aaaa" };
+  int numbers[] = { 3, 7, -2, 0, 10, -7 };
+  int sortedComposite[] = { 5, 1, 2, 0, 4, 3 }; // positions in names and numbers
+  int stringLength = 8;
+  DataType stringType = DT_STRING;
+  BTreeHandle *tree = NULL;
+  BT_ScanHandle *sc = NULL;
+  Schema *schema;
+  Value key, low[2], high[2], composite[2];
+  RID rid;
+  int i, rc;
+  testName = "test float, string, bool and composite b-tree keys";
+
+  TEST_CHECK(initIndexManager(NULL));
+
+  // floats, negative ones included
+  TEST_CHECK(createBtree("testidx", DT_FLOAT, 3));
+  TEST_CHECK(openBtree(&tree, "testidx"));
+  key.dt = DT_FLOAT;
+  for(i = 0; i < 7; i++)
+    {
+      key.v.floatV = floats[i];
+      rid.page = i;
+      rid.slot = 0;
+      TEST_CHECK(insertKey(tree, &key, rid));
+    }
+  key.v.floatV = -0.0;
+  ASSERT_EQUALS_INT(RC_IM_KEY_ALREADY_EXISTS, insertKey(tree, &key, rid), "-0 is the same key as 0");
+  key.dt = DT_INT;
+  key.v.intV = 1;
+  ASSERT_EQUALS_INT(RC_RM_COMPARE_VALUE_OF_DIFFERENT_DATATYPE, findKey(tree, &key, &rid), "key of the wrong type");
+  TEST_CHECK(openTreeScan(tree, &sc));
+  for(i = 0; (rc = nextEntryWithKey(sc, &key, &rid)) == RC_OK; i++)
+    ASSERT_TRUE(key.dt == DT_FLOAT && key.v.floatV == sortedFloats[i], "floats in order");
+  ASSERT_EQUALS_INT(7, i, "every float key");
+  TEST_CHECK(closeTreeScan(sc));
+  TEST_CHECK(closeBtree(tree));
+  TEST_CHECK(openBtree(&tree, "testidx"));
+  TEST_CHECK(getKeyType(tree, &key.dt));
+  ASSERT_EQUALS_INT(DT_FLOAT, key.dt, "key type survives reopening");
+  key.v.floatV = -1000.25;
+  TEST_CHECK(findKey(tree, &key, &rid));
+  ASSERT_EQUALS_INT(3, rid.page, "found float key");
+  TEST_CHECK(closeBtree(tree));
+  TEST_CHECK(deleteBtree("testidx"));
+
+  // strings of up to 8 characters
+  TEST_CHECK(createBtreeWithKey("testidx", 1, &stringType, &stringLength, 3));
+  TEST_CHECK(openBtree(&tree, "testidx"));
+  key.dt = DT_STRING;
+  for(i = 0; i < 7; i++)
+    {
+      key.v.stringV = strings[i];
+      rid.page = i;
+      TEST_CHECK(insertKey(tree, &key, rid));
+    }
+  key.v.stringV = "applesauce";
+  ASSERT_EQUALS_INT(RC_IM_KEY_TOO_LONG, insertKey(tree, &key, rid), "string longer than the key");
+  key.v.stringV = "apples";
+  TEST_CHECK(findKey(tree, &key, &rid));
+  ASSERT_EQUALS_INT(6, rid.page, "found string key");
+  key.v.stringV = "appl";
+  ASSERT_EQUALS_INT(RC_IM_KEY_NOT_FOUND, findKey(tree, &key, &rid), "prefix is a different key");
+  TEST_CHECK(openTreeScan(tree, &sc));
+  for(i = 0; (rc = nextEntryWithKey(sc, &key, &rid)) == RC_OK; i++)
+    {
+      ASSERT_EQUALS_STRING(sortedStrings[i], key.v.stringV, "strings in order");
+      free(key.v.stringV);
+    }
+  ASSERT_EQUALS_INT(7, i, "every string key");
+  TEST_CHECK(closeTreeScan(sc));
+  TEST_CHECK(closeBtree(tree));
+  TEST_CHECK(deleteBtree("testidx"));
+
+  // booleans
+  TEST_CHECK(createBtree("testidx", DT_BOOL, 3));
+  TEST_CHECK(openBtree(&tree, "testidx"));
+  key.dt = DT_BOOL;
+  key.v.boolV = true;
+  TEST_CHECK(insertKey(tree, &key, rid));
+  key.v.boolV = false;
+  TEST_CHECK(insertKey(tree, &key, rid));
+  TEST_CHECK(openTreeScan(tree, &sc));
+  TEST_CHECK(nextEntryWithKey(sc, &key, &rid));
+  ASSERT_TRUE(!key.v.boolV, "false first");
+  TEST_CHECK(nextEntryWithKey(sc, &key, &rid));
+  ASSERT_TRUE(key.v.boolV, "true second");
+  TEST_CHECK(closeTreeScan(sc));
+  TEST_CHECK(closeBtree(tree));
+  TEST_CHECK(deleteBtree("testidx"));
+
+  // composite key (b, a) of the test schema
+  schema = testSchema();
+  schema->keyAttrs = (int *) realloc(schema->keyAttrs, 2 * sizeof(int));
+  schema->keyAttrs[0] = 1;
+  schema->keyAttrs[1] = 0;
+  schema->keySize = 2;
+  TEST_CHECK(createBtreeForSchema("testidx", schema, 3));
+  TEST_CHECK(openBtree(&tree, "testidx"));
+  for(i = 0; i < 6; i++)
+    {
+      composite[0].dt = DT_STRING;
+      composite[0].v.stringV = names[i];
+      composite[1].dt = DT_INT;
+      composite[1].v.intV = numbers[i];
+      rid.page = i;
+      TEST_CHECK(insertKey(tree, composite, rid));
+    }
+  TEST_CHECK(openTreeScan(tree, &sc));
+  for(i = 0; (rc = nextEntryWithKey(sc, composite, &rid)) == RC_OK; i++)
+    {
+      ASSERT_EQUALS_INT(sortedComposite[i], rid.page, "composite keys in order");
+      ASSERT_EQUALS_STRING(names[rid.page], composite[0].v.stringV, "first attribute returned");
+      ASSERT_EQUALS_INT(numbers[rid.page], composite[1].v.intV, "second attribute returned");
+      free(composite[0].v.stringV);
+    }
+  ASSERT_EQUALS_INT(6, i, "every composite key");
+  TEST_CHECK(closeTreeScan(sc));
+
+  // every key with b = "bbbb"
+  low[0].dt = high[0].dt = DT_STRING;
+  low[0].v.stringV = high[0].v.stringV = "bbbb";
+  low[1].dt = high[1].dt = DT_INT;
+  low[1].v.intV = -2147483647 - 1;
+  high[1].v.intV = 2147483647;
+  TEST_CHECK(openTreeRangeScan(tree, low, true, high, true, &sc));
+  for(i = 0; (rc = nextEntry(sc, &rid)) == RC_OK; i++)
+    ASSERT_EQUALS_INT(sortedComposite[i + 2], rid.page, "composite prefix range");
+  ASSERT_EQUALS_INT(3, i, "keys with the prefix");
+  TEST_CHECK(closeTreeScan(sc));
+
+  TEST_CHECK(closeBtree(tree));
+  TEST_CHECK(deleteBtree("testidx"));
+  freeSchema(schema);
+  TEST_DONE();
+}
+
+// ************************************************************
+void
+testDeleteRebalance (void)
+{
+  const int numKeys = 4000, numKept = 40;
+  BTreeHandle *tree = NULL;
+  BT_ScanHandle *sc = NULL;
+  metaData *meta;
+  Value key;
+  RID rid;
+  int i, j, round, testint, rc, peakPages;
+  int *order = (int *) malloc(numKeys * sizeof(int));
+  testName = "test b-tree deletes merging and redistributing nodes";
+
+  TEST_CHECK(initIndexManager(NULL));
+  key.dt = DT_INT;
+  for(i = 0; i < numKeys; i++)
+    order[i] = i;
+  for(round = 0; round < 3; round++)
+    {
+      int n = round + 2; // orders 2, 3 and 4
+
+      TEST_CHECK(createBtree("testidx", DT_INT, n));
+      TEST_CHECK(openBtree(&tree, "testidx"));
+      meta = &((BTreeMgmtData *) tree->mgmtData)->meta;
+      for(i = 0; i < numKeys; i++)
+	{
+	  j = rand() % numKeys;
+	  testint = order[i];
+	  order[i] = order[j];
+	  order[j] = testint;
+	}
+      for(i = 0; i < numKeys; i++)
+	{
+	  key.v.intV = order[i];
+	  rid.page = order[i];
+	  rid.slot = 0;
+	  TEST_CHECK(insertKey(tree, &key, rid));
+	}
+      peakPages = meta->numPages;
+
+      // delete all but the last numKept keys in a different random order
+      for(i = 0; i < numKeys - numKept; i++)
+	{
+	  j = i + rand() % (numKeys - i);
+	  testint = order[i];
+	  order[i] = order[j];
+	  order[j] = testint;
+	  key.v.intV = order[i];
+	  TEST_CHECK(deleteKey(tree, &key));
+	}
+      ASSERT_EQUALS_INT(RC_IM_KEY_NOT_FOUND, deleteKey(tree, &key), "deleted key is gone");
+      TEST_CHECK(getNumNodes(tree, &testint));
+      ASSERT_TRUE(testint <= 2 * numKept, "nodes shrink with the entries");
+
+      // every remaining key is found, and nothing else
+      for(i = numKeys - numKept; i < numKeys; i++)
+	{
+	  key.v.intV = order[i];
+	  TEST_CHECK(findKey(tree, &key, &rid));
+	  ASSERT_EQUALS_INT(order[i], rid.page, "kept key found");
+	}
+      TEST_CHECK(openTreeScan(tree, &sc));
+      for(i = 0, j = -1; (rc = nextEntry(sc, &rid)) == RC_OK; i++)
+	{
+	  ASSERT_TRUE(rid.page > j, "scan in key order after deletes");
+	  j = rid.page;
+	}
+      ASSERT_EQUALS_INT(numKept, i, "scan sees the kept keys");
+      TEST_CHECK(closeTreeScan(sc));
+
+      // deleting everything leaves just the root leaf
+      for(i = numKeys - numKept; i < numKeys; i++)
+	{
+	  key.v.intV = order[i];
+	  TEST_CHECK(deleteKey(tree, &key));
+	}
+      TEST_CHECK(getNumNodes(tree, &testint));
+      ASSERT_EQUALS_INT(1, testint, "empty tree is a single leaf");
+      TEST_CHECK(openTreeScan(tree, &sc));
+      ASSERT_EQUALS_INT(RC_IM_NO_MORE_ENTRIES, nextEntry(sc, &rid), "empty tree scans nothing");
+      TEST_CHECK(closeTreeScan(sc));
+
+      // freed nodes are reused before the file grows
+      TEST_CHECK(closeBtree(tree));
+      TEST_CHECK(openBtree(&tree, "testidx"));
+      meta = &((BTreeMgmtData *) tree->mgmtData)->meta;
+      for(i = 0; i < numKeys; i++)
+	{
+	  key.v.intV = order[i];
+	  rid.page = order[i];
+	  TEST_CHECK(insertKey(tree, &key, rid));
+	}
+      ASSERT_TRUE(meta->numPages <= peakPages + numKeys / 10, "freed pages reused");
+      TEST_CHECK(getNumEntries(tree, &testint));
+      ASSERT_EQUALS_INT(numKeys, testint, "entries after reinserting");
+
+      TEST_CHECK(closeBtree(tree));
+      TEST_CHECK(deleteBtree("testidx"));
+    }
+  free(order);
+  TEST_DONE();
+}
+
+// ************************************************************
+void
+testConcurrentAccess (void)
+{
+  const int numThreads = CONCURRENT_READERS + CONCURRENT_WRITERS + 1;
+  pthread_t threads[CONCURRENT_READERS + CONCURRENT_WRITERS + 1];
+  ConcurrentWorker workers[CONCURRENT_READERS + CONCURRENT_WRITERS + 1];
+  BT_BulkLoadHandle *bl = NULL;
+  BTreeHandle *tree = NULL;
+  BT_ScanHandle *sc = NULL;
+  Value key;
+  RID rid;
+  int i, idx, done = 0, expected = 0, testint, rc;
+  testName = "test b-tree lookups and scans concurrent with inserts and deletes";
+
+  // even keys are loaded up front, the writers insert the odd ones and
+  // delete every other of them again while readers and a scanner run
+  TEST_CHECK(initIndexManager(NULL));
+  TEST_CHECK(createBtree("testidx", DT_INT, 16));
+  TEST_CHECK(openBtree(&tree, "testidx"));
+  TEST_CHECK(startBulkLoad(tree, 0.7, &bl));
+  key.dt = DT_INT;
+  for(i = 0; i < CONCURRENT_KEYS; i++)
+    {
+      key.v.intV = i * 2;
+      rid.page = i * 2;
+      rid.slot = 0;
+      TEST_CHECK(bulkLoadEntry(bl, &key, rid));
+    }
+  TEST_CHECK(finishBulkLoad(bl));
+
+  for(i = 0; i < numThreads; i++)
+    {
+      workers[i].tree = tree;
+      workers[i].id = i;
+      workers[i].done = &done;
+      workers[i].errors = 0;
+      workers[i].operations = 0;
+    }
+  for(i = 0; i < numThreads; i++)
+    pthread_create(&threads[i], NULL,
+		   i < CONCURRENT_WRITERS ? concurrentWriter
+		   : i < numThreads - 1 ? concurrentReader : concurrentScanner,
+		   &workers[i]);
+  for(i = 0; i < CONCURRENT_WRITERS; i++)
+    pthread_join(threads[i], NULL);
+  __atomic_store_n(&done, 1, __ATOMIC_RELEASE);
+  for(i = CONCURRENT_WRITERS; i < numThreads; i++)
+    pthread_join(threads[i], NULL);
+
+  for(i = 0; i < numThreads; i++)
+    ASSERT_EQUALS_INT(0, workers[i].errors, "thread saw no wrong result");
+  ASSERT_TRUE(workers[CONCURRENT_WRITERS].operations > 0, "readers ran alongside the writers");
+
+  // a writer keeps the odd keys it inserted at odd positions
+  for(i = 0; i < 2 * CONCURRENT_KEYS; i++)
+    {
+      idx = i / 2;
+      key.v.intV = i;
+      rc = findKey(tree, &key, &rid);
+      if (i % 2 == 0 || (idx / CONCURRENT_WRITERS) % 2 == 1)
+	{
+	  expected++;
+	  if (rc != RC_OK || rid.page != i)
+	    ASSERT_EQUALS_INT(i, rc == RC_OK ? rid.page : -1, "key found after the threads");
+	}
+      else if (rc != RC_IM_KEY_NOT_FOUND)
+	ASSERT_EQUALS_INT(RC_IM_KEY_NOT_FOUND, rc, "deleted key is gone");
+    }
+  TEST_CHECK(getNumEntries(tree, &testint));
+  ASSERT_EQUALS_INT(expected, testint, "entries after the threads");
+  TEST_CHECK(openTreeScan(tree, &sc));
+  for(i = 0; (rc = nextEntry(sc, &rid)) == RC_OK; i++);
+  ASSERT_EQUALS_INT(expected, i, "scan sees every entry");
+  TEST_CHECK(closeTreeScan(sc));
+
+  TEST_CHECK(closeBtree(tree));
+  TEST_CHECK(deleteBtree("testidx"));
+  TEST_DONE();
+}
+
+// even keys are always there, odd ones come and go with the writers
+static void *
+concurrentReader (void *arg)
+{
+  ConcurrentWorker *w = (ConcurrentWorker *) arg;
+  unsigned int seed = w->id;
+  Value key;
+  RID rid;
+  RC rc;
+
+  key.dt = DT_INT;
+  while (!__atomic_load_n(w->done, __ATOMIC_ACQUIRE))
+    {
+      key.v.intV = rand_r(&seed) % (2 * CONCURRENT_KEYS);
+      rc = findKey(w->tree, &key, &rid);
+      if (rc == RC_OK ? rid.page != key.v.intV
+	  : (key.v.intV % 2 == 0 || rc != RC_IM_KEY_NOT_FOUND))
+	w->errors++;
+      w->operations++;
+    }
+  return NULL;
+}
+
+// writer id inserts the odd keys at positions id, id + CONCURRENT_WRITERS,
+// ... and then deletes every other of them
+static void *
+concurrentWriter (void *arg)
+{
+  ConcurrentWorker *w = (ConcurrentWorker *) arg;
+  Value key;
+  RID rid;
+  int i, k;
+
+  key.dt = DT_INT;
+  rid.slot = 0;
+  for(i = 0; (k = 2 * (i * CONCURRENT_WRITERS + w->id) + 1) < 2 * CONCURRENT_KEYS; i++)
+    {
+      key.v.intV = k;
+      rid.page = k;
+      w->errors += insertKey(w->tree, &key, rid) != RC_OK;
+      w->operations++;
+    }
+  for(i = 0; (k = 2 * (i * CONCURRENT_WRITERS + w->id) + 1) < 2 * CONCURRENT_KEYS; i += 2)
+    {
+      key.v.intV = k;
+      w->errors += deleteKey(w->tree, &key) != RC_OK;
+      w->operations++;
+    }
+  return NULL;
+}
+
+// every scan returns ascending keys and all of the even ones
+static void *
+concurrentScanner (void *arg)
+{
+  ConcurrentWorker *w = (ConcurrentWorker *) arg;
+  BT_ScanHandle *sc;
+  Value key;
+  RID rid;
+  RC rc;
+  int previous, evens;
+
+  while (!__atomic_load_n(w->done, __ATOMIC_ACQUIRE))
+    {
+      if (openTreeScan(w->tree, &sc) != RC_OK)
+	{
+	  w->errors++;
+	  return NULL;
+	}
+      for(previous = -1, evens = 0; (rc = nextEntryWithKey(sc, &key, &rid)) == RC_OK; previous = key.v.intV)
+	{
+	  if (key.v.intV <= previous || rid.page != key.v.intV)
+	    w->errors++;
+	  evens += key.v.intV % 2 == 0;
+	}
+      if (rc != RC_IM_NO_MORE_ENTRIES || evens != CONCURRENT_KEYS)
+	w->errors++;
+      closeTreeScan(sc);
+      w->operations++;
+    }
+  return NULL;
+}
+
+// ************************************************************
+void
+testSecondaryIndex (void)
+{
+  RM_TableData *table = (RM_TableData *) malloc(sizeof(RM_TableData));
+  RM_ScanHandle *sc = (RM_ScanHandle *) malloc(sizeof(RM_ScanHandle));
+  const int numInserts = 3000;
+  int cvals[3000];
+  bool deleted[3000];
+  int i, rc, seen, expected, tableIO, indexIO;
+  RM_TableMgmtData *mgmt;
+  BM_BufferPool *indexPool;
+  Expr *sel, *left, *right, *lowSel, *highSel, *below;
+  Value *val;
+  Record *r;
+  RID *rids;
+  Schema *schema;
+  char b[5];
+  FILE *f;
+  pthread_t threads[2];
+  WalWorker workers[2];
+  testName = "test secondary indexes maintained by the record manager";
+  schema = testSchema();
+  rids = (RID *) malloc(sizeof(RID) * numInserts);
+
+  // the index on c exists before the inserts, the ones on a and b are
+  // built from the records afterwards
+  TEST_CHECK(initRecordManager(NULL));
+  TEST_CHECK(createTable("test_table_r",schema));
+  TEST_CHECK(openTable(table, "test_table_r"));
+  TEST_CHECK(createIndex(table, 2));
+  for(i = 0; i < numInserts; i++)
+    {
+      sprintf(b, "%04d", i % 1000);
+      r = testRecord(schema, i, b, i % 10);
+      TEST_CHECK(insertRecord(table,r));
+      rids[i] = r->id;
+      cvals[i] = i % 10;
+      deleted[i] = false;
+      freeRecord(r);
+    }
+  TEST_CHECK(createIndex(table, 0));
+  TEST_CHECK(createIndex(table, 1));
+  ASSERT_EQUALS_INT(RC_RM_INDEX_EXISTS, createIndex(table, 0), "one index per attribute");
+  ASSERT_EQUALS_INT(RC_RM_INVALID_ATTRIBUTE, createIndex(table, 3), "no index on a missing attribute");
+
+  // deletes and updates move the index entries along
+  for(i = 0; i < numInserts; i += 7)
+    {
+      TEST_CHECK(deleteRecord(table, rids[i]));
+      deleted[i] = true;
+    }
+  for(i = 0; i < numInserts; i += 5)
+    {
+      sprintf(b, "%04d", i % 1000);
+      r = testRecord(schema, i, b, (cvals[i] + 1) % 10);
+      r->id = rids[i];
+      if (deleted[i])
+	ASSERT_EQUALS_INT(RC_RM_NO_MORE_TUPLES, updateRecord(table, r), "deleted record is not updated");
+      else
+	{
+	  TEST_CHECK(updateRecord(table, r));
+	  cvals[i] = (cvals[i] + 1) % 10;
+	}
+      freeRecord(r);
+    }
+
+  // the indexes are reopened with the table
+  TEST_CHECK(closeTable(table));
+  TEST_CHECK(openTable(table, "test_table_r"));
+  mgmt = (RM_TableMgmtData *) table->mgmtData;
+  ASSERT_EQUALS_INT(3, mgmt->numIndexes, "indexes reopened");
+
+  // a point lookup reads the path down the index and one data page
+  for(i = 0; mgmt->indexes[i].attrNum != 0; i++)
+    ;
+  indexPool = ((BTreeMgmtData *) mgmt->indexes[i].tree->mgmtData)->pool;
+  tableIO = getNumReadIO((BM_BufferPool *) table->mgmtData);
+  indexIO = getNumReadIO(indexPool);
+  TEST_CHECK(createRecord(&r, schema));
+  MAKE_CONS(left, stringToValue("i1234"));
+  MAKE_ATTRREF(right, 0);
+  MAKE_BINOP_EXPR(sel, right, left, OP_COMP_EQUAL);
+  TEST_CHECK(startScan(table, sc, sel));
+  TEST_CHECK(next(sc, r));
+  ASSERT_TRUE(r->id.page == rids[1234].page && r->id.slot == rids[1234].slot, "lookup finds the record");
+  ASSERT_EQUALS_INT(RC_RM_NO_MORE_TUPLES, next(sc, r), "lookup finds one record");
+  TEST_CHECK(closeScan(sc));
+  ASSERT_TRUE(getNumReadIO((BM_BufferPool *) table->mgmtData) - tableIO <= 2, "lookup reads one data page");
+  ASSERT_TRUE(getNumReadIO(indexPool) - indexIO <= 3, "lookup reads one path of the index");
+  freeExpr(sel);
+
+  // 1 <= c < 3, through the index on c
+  MAKE_CONS(left, stringToValue("i3"));
+  MAKE_ATTRREF(right, 2);
+  MAKE_BINOP_EXPR(highSel, right, left, OP_COMP_SMALLER);
+  MAKE_CONS(left, stringToValue("i1"));
+  MAKE_ATTRREF(right, 2);
+  MAKE_BINOP_EXPR(below, right, left, OP_COMP_SMALLER);
+  MAKE_UNOP_EXPR(lowSel, below, OP_BOOL_NOT);
+  MAKE_BINOP_EXPR(sel, lowSel, highSel, OP_BOOL_AND);
+  for(i = 0, expected = 0; i < numInserts; i++)
+    expected += !deleted[i] && cvals[i] >= 1 && cvals[i] < 3;
+  TEST_CHECK(startScan(table, sc, sel));
+  for(seen = 0; (rc = next(sc, r)) == RC_OK; seen++)
+    {
+      TEST_CHECK(getAttr(r, schema, 0, &val));
+      ASSERT_TRUE(!deleted[val->v.intV] && cvals[val->v.intV] >= 1 && cvals[val->v.intV] < 3, "range holds");
+      freeVal(val);
+    }
+  ASSERT_EQUALS_INT(RC_RM_NO_MORE_TUPLES, rc, "range scan ends cleanly");
+  ASSERT_EQUALS_INT(expected, seen, "range scan finds every record");
+  TEST_CHECK(closeScan(sc));
+  freeExpr(sel);
+
+  // equality on a string attribute
+  MAKE_CONS(left, stringToValue("s0042"));
+  MAKE_ATTRREF(right, 1);
+  MAKE_BINOP_EXPR(sel, left, right, OP_COMP_EQUAL);
+  for(i = 42, expected = 0; i < numInserts; i += 1000)
+    expected += !deleted[i];
+  TEST_CHECK(startScan(table, sc, sel));
+  for(seen = 0; (rc = next(sc, r)) == RC_OK; seen++)
+    {
+      TEST_CHECK(getAttr(r, schema, 0, &val));
+      ASSERT_EQUALS_INT(42, val->v.intV % 1000, "string matches");
+      freeVal(val);
+    }
+  ASSERT_EQUALS_INT(expected, seen, "string lookup finds every record");
+  TEST_CHECK(closeScan(sc));
+  freeExpr(sel);
+
+  // without the index the same lookup scans the table
+  TEST_CHECK(dropIndex(table, 0));
+  ASSERT_EQUALS_INT(RC_RM_INDEX_NOT_FOUND, dropIndex(table, 0), "index is gone");
+  MAKE_CONS(left, stringToValue("i1234"));
+  MAKE_ATTRREF(right, 0);
+  MAKE_BINOP_EXPR(sel, right, left, OP_COMP_EQUAL);
+  TEST_CHECK(startScan(table, sc, sel));
+  TEST_CHECK(next(sc, r));
+  ASSERT_EQUALS_INT(RC_RM_NO_MORE_TUPLES, next(sc, r), "table scan finds one record");
+  TEST_CHECK(closeScan(sc));
+  freeExpr(sel);
+
+  // indexes created and dropped while other threads insert: the new index
+  // has an entry for every record, the one on c for every new one
+  for(i = 0; i < 2; i++)
+    {
+      workers[i].table = table;
+      workers[i].schema = schema;
+      workers[i].id = 10 + i;
+      workers[i].errors = 0;
+      pthread_create(&threads[i], NULL, walInserter, &workers[i]);
+    }
+  TEST_CHECK(createIndex(table, 0));
+  TEST_CHECK(dropIndex(table, 1));
+  for(i = 0; i < 2; i++)
+    {
+      pthread_join(threads[i], NULL);
+      ASSERT_EQUALS_INT(0, workers[i].errors, "inserts next to index changes succeed");
+    }
+  MAKE_CONS(left, stringToValue("i-1"));
+  MAKE_ATTRREF(right, 0);
+  MAKE_BINOP_EXPR(below, right, left, OP_COMP_SMALLER);
+  MAKE_UNOP_EXPR(sel, below, OP_BOOL_NOT);
+  TEST_CHECK(startScan(table, sc, sel));
+  for(seen = 0; (rc = next(sc, r)) == RC_OK; seen++)
+    ;
+  TEST_CHECK(closeScan(sc));
+  freeExpr(sel);
+  ASSERT_EQUALS_INT(getNumTuples(table), seen, "new index has every record");
+  MAKE_CONS(left, stringToValue("i10"));
+  MAKE_ATTRREF(right, 2);
+  MAKE_BINOP_EXPR(below, right, left, OP_COMP_SMALLER);
+  MAKE_UNOP_EXPR(sel, below, OP_BOOL_NOT);
+  TEST_CHECK(startScan(table, sc, sel));
+  for(seen = 0; (rc = next(sc, r)) == RC_OK; seen++)
+    ;
+  TEST_CHECK(closeScan(sc));
+  freeExpr(sel);
+  ASSERT_EQUALS_INT(2 * WAL_INSERTS, seen, "index on c has every new record");
+
+  // records updated while an index scan runs are returned once, also when
+  // their new key is further into the range
+  MAKE_CONS(left, stringToValue("i100"));
+  MAKE_ATTRREF(right, 0);
+  MAKE_BINOP_EXPR(sel, right, left, OP_COMP_SMALLER);
+  for(i = 0, expected = 0; i < 100; i++)
+    expected += !deleted[i];
+  TEST_CHECK(startScan(table, sc, sel));
+  for(seen = 0; (rc = next(sc, r)) == RC_OK; seen++)
+    {
+      TEST_CHECK(getAttr(r, schema, 0, &val));
+      val->v.intV += 10;
+      TEST_CHECK(setAttr(r, schema, 0, val));
+      freeVal(val);
+      TEST_CHECK(updateRecord(table, r));
+    }
+  ASSERT_EQUALS_INT(RC_RM_NO_MORE_TUPLES, rc, "updating scan ends cleanly");
+  ASSERT_EQUALS_INT(expected, seen, "updating scan returns every record once");
+  TEST_CHECK(closeScan(sc));
+  freeExpr(sel);
+  freeRecord(r);
+
+  TEST_CHECK(closeTable(table));
+  TEST_CHECK(deleteTable("test_table_r"));
+  f = fopen("test_table_r.idx2", "r");
+  ASSERT_TRUE(f == NULL, "index files are deleted with the table");
+  if (f != NULL)
+    fclose(f);
+
+  free(rids);
+  free(sc);
+  free(table);
+  freeSchema(schema);
+  TEST_DONE();
+}
+
+// ************************************************************
+void
+testFreeSpaceReuse (void)
+{
+  RM_TableData *table = (RM_TableData *) malloc(sizeof(RM_TableData));
+  RM_ScanHandle *sc = (RM_ScanHandle *) malloc(sizeof(RM_ScanHandle));
+  const int numInserts = 2000;
+  int i, rc, seen, live, lastPage, maxPage;
+  bool found[2000];
+  Expr *sel, *left, *right;
+  Value *val;
+  Record *r;
+  RID *rids;
+  Schema *schema;
+  testName = "test reusing deleted slots and vacuuming a table";
+  schema = testSchema();
+  rids = (RID *) malloc(sizeof(RID) * numInserts);
+
+  TEST_CHECK(initRecordManager(NULL));
+  TEST_CHECK(createTable("test_table_r",schema));
+  TEST_CHECK(openTable(table, "test_table_r"));
+  TEST_CHECK(createIndex(table, 0));
+  for(i = 0; i < numInserts; i++)
+    {
+      r = testRecord(schema, i, "abcd", i % 10);
+      TEST_CHECK(insertRecord(table,r));
+      rids[i] = r->id;
+      freeRecord(r);
+    }
+  lastPage = rids[numInserts - 1].page;
+
+  // churn: the holes of every other record are refilled, the table keeps its size
+  for(i = 0; i < numInserts; i += 2)
+    TEST_CHECK(deleteRecord(table, rids[i]));
+  for(i = 0; i < numInserts; i += 2)
+    {
+      r = testRecord(schema, i, "wxyz", i % 10);
+      TEST_CHECK(insertRecord(table,r));
+      ASSERT_TRUE(r->id.page <= lastPage, "insert refills a hole");
+      rids[i] = r->id;
+      freeRecord(r);
+    }
+  ASSERT_EQUALS_INT(numInserts, getNumTuples(table), "tuple count after the churn");
+  r = testRecord(schema, numInserts, "abcd", 0);
+  TEST_CHECK(insertRecord(table,r));
+  ASSERT_EQUALS_INT(numInserts + 1, getNumTuples(table), "tuple count after one more insert");
+  TEST_CHECK(deleteRecord(table, r->id));
+  freeRecord(r);
+
+  // the free list survives reopening the table
+  for(i = 0; i < numInserts; i += 3)
+    TEST_CHECK(deleteRecord(table, rids[i]));
+  TEST_CHECK(closeTable(table));
+  TEST_CHECK(openTable(table, "test_table_r"));
+  r = testRecord(schema, 0, "abcd", 0);
+  TEST_CHECK(insertRecord(table,r));
+  ASSERT_TRUE(r->id.page <= lastPage, "insert after reopening refills a hole");
+  rids[0] = r->id;
+  freeRecord(r);
+
+  // vacuum packs the live records into the first pages
+  for(i = 0, live = 0; i < numInserts; i++)
+    live += i == 0 || i % 3 != 0;
+  TEST_CHECK(vacuumTable(table));
+  ASSERT_EQUALS_INT(live, getNumTuples(table), "tuple count after vacuum");
+  TEST_CHECK(createRecord(&r, schema));
+  memset(found, 0, sizeof(found));
+  TEST_CHECK(startScan(table, sc, NULL));
+  for(seen = 0, maxPage = 0; (rc = next(sc, r)) == RC_OK; seen++)
+    {
+      if (r->id.page > maxPage)
+	maxPage = r->id.page;
+      TEST_CHECK(getAttr(r, schema, 0, &val));
+      ASSERT_TRUE(!found[val->v.intV] && (val->v.intV == 0 || val->v.intV % 3 != 0), "live record kept once");
+      found[val->v.intV] = true;
+      freeVal(val);
+    }
+  TEST_CHECK(closeScan(sc));
+  ASSERT_EQUALS_INT(live, seen, "every live record is kept");
+  ASSERT_TRUE(maxPage < lastPage, "vacuum frees pages");
+
+  // moved records are found through the index
+  MAKE_CONS(left, stringToValue("i1999"));
+  MAKE_ATTRREF(right, 0);
+  MAKE_BINOP_EXPR(sel, right, left, OP_COMP_EQUAL);
+  TEST_CHECK(startScan(table, sc, sel));
+  TEST_CHECK(next(sc, r));
+  ASSERT_TRUE(r->id.page < rids[1999].page || r->id.slot < rids[1999].slot, "last record moved");
+  TEST_CHECK(getAttr(r, schema, 0, &val));
+  ASSERT_EQUALS_INT(1999, val->v.intV, "index follows the move");
+  freeVal(val);
+  ASSERT_EQUALS_INT(RC_RM_NO_MORE_TUPLES, next(sc, r), "one entry per record");
+  TEST_CHECK(closeScan(sc));
+  freeExpr(sel);
+  freeRecord(r);
+
+  TEST_CHECK(closeTable(table));
+  TEST_CHECK(deleteTable("test_table_r"));
+
+  free(rids);
+  free(sc);
+  free(table);
+  freeSchema(schema);
+  TEST_DONE();
+}
+
+// ************************************************************
+void
+testVariableLengthRecords (void)
+{
+  RM_TableData *table = (RM_TableData *) malloc(sizeof(RM_TableData));
+  RM_ScanHandle *sc = (RM_ScanHandle *) malloc(sizeof(RM_ScanHandle));
+  const int numInserts = 100, numLong = 20;
+  char **names = (char **) malloc(sizeof(char*) * 2);
+  DataType *dt = (DataType *) malloc(sizeof(DataType) * 2);
+  int *sizes = (int *) malloc(sizeof(int) * 2);
+  int *keys = (int *) malloc(sizeof(int));
+  char longString[200];
+  int i, rc, seen;
+  bool found[100];
+  Value *val;
+  Record *r;
+  RID rids[100];
+  Schema *schema;
+  testName = "test slotted pages with variable length records";
+
+  names[0] = strdup("a");
+  names[1] = strdup("b");
+  dt[0] = DT_INT;
+  dt[1] = DT_STRING;
+  sizes[0] = 0;
+  sizes[1] = 200;
+  keys[0] = 0;
+  schema = createSchema(2, names, dt, sizes, 1, keys);
+  memset(longString, 'y', 199);
+  longString[199] = '\0';
+
+  // short strings take their length only: all records fit the first page,
+  // where 20 records of the full 204 bytes would
+  TEST_CHECK(initRecordManager(NULL));
+  TEST_CHECK(createTable("test_table_r",schema));
+  TEST_CHECK(openTable(table, "test_table_r"));
+  TEST_CHECK(createRecord(&r, schema));
+  for(i = 0; i < numInserts; i++)
+    {
+      MAKE_VALUE(val, DT_INT, i);
+      TEST_CHECK(setAttr(r, schema, 0, val));
+      freeVal(val);
+      MAKE_STRING_VALUE(val, "x");
+      TEST_CHECK(setAttr(r, schema, 1, val));
+      freeVal(val);
+      TEST_CHECK(insertRecord(table, r));
+      rids[i] = r->id;
+    }
+  ASSERT_EQUALS_INT(2, rids[numInserts - 1].page, "one page holds every short record");
+
+  // records that outgrow the page move to another one and keep their RID
+  for(i = 0; i < numLong; i++)
+    {
+      MAKE_VALUE(val, DT_INT, i);
+      TEST_CHECK(setAttr(r, schema, 0, val));
+      freeVal(val);
+      MAKE_STRING_VALUE(val, longString);
+      TEST_CHECK(setAttr(r, schema, 1, val));
+      freeVal(val);
+      r->id = rids[i];
+      TEST_CHECK(updateRecord(table, r));
+    }
+  TEST_CHECK(closeTable(table));
+  TEST_CHECK(openTable(table, "test_table_r"));
+  for(i = 0; i < numInserts; i++)
+    {
+      TEST_CHECK(getRecord(table, rids[i], r));
+      TEST_CHECK(getAttr(r, schema, 1, &val));
+      ASSERT_EQUALS_STRING(i < numLong ? longString : "x", val->v.stringV, "record read through its RID");
+      freeVal(val);
+    }
+
+  // deleting a moved record frees both of its tuples, shrinking one takes it home
+  for(i = 0; i < numLong; i += 4)
+    TEST_CHECK(deleteRecord(table, rids[i]));
+  MAKE_STRING_VALUE(val, "z");
+  TEST_CHECK(setAttr(r, schema, 1, val));
+  freeVal(val);
+  MAKE_VALUE(val, DT_INT, 1);
+  TEST_CHECK(setAttr(r, schema, 0, val));
+  freeVal(val);
+  r->id = rids[1];
+  TEST_CHECK(updateRecord(table, r));
+  ASSERT_EQUALS_INT(numInserts - numLong / 4, getNumTuples(table), "tuple count");
+
+  // a scan returns every record once, under its own RID
+  memset(found, 0, sizeof(found));
+  TEST_CHECK(startScan(table, sc, NULL));
+  for(seen = 0; (rc = next(sc, r)) == RC_OK; seen++)
+    {
+      TEST_CHECK(getAttr(r, schema, 0, &val));
+      i = val->v.intV;
+      freeVal(val);
+      ASSERT_TRUE(!found[i] && (i >= numLong || i % 4 != 0), "live record seen once");
+      ASSERT_TRUE(r->id.page == rids[i].page && r->id.slot == rids[i].slot, "scan returns the record's RID");
+      found[i] = true;
+      TEST_CHECK(getAttr(r, schema, 1, &val));
+      ASSERT_EQUALS_STRING(i == 1 ? "z" : i < numLong ? longString : "x", val->v.stringV, "scan decodes the record");
+      freeVal(val);
+    }
+  TEST_CHECK(closeScan(sc));
+  ASSERT_EQUALS_INT(numInserts - numLong / 4, seen, "scan sees every record");
+
+  freeRecord(r);
+  TEST_CHECK(closeTable(table));
+  TEST_CHECK(deleteTable("test_table_r"));
+
+  free(sc);
+  free(table);
+  freeSchema(schema);
+  TEST_DONE();
+}
+
+// ************************************************************
+void
+testLiveSlotBitmap (void)
+{
+  RM_TableData *table = (RM_TableData *) malloc(sizeof(RM_TableData));
+  RM_ScanHandle *sc = (RM_ScanHandle *) malloc(sizeof(RM_ScanHandle));
+  const int numInserts = 300;
+  int i, rc, seen, last;
+  Value *val;
+  Record *r;
+  RID rids[300];
+  Schema *schema;
+  testName = "test live slot bitmap of data pages";
+  schema = testSchema();
+
+  TEST_CHECK(initRecordManager(NULL));
+  TEST_CHECK(createTable("test_table_r",schema));
+  TEST_CHECK(openTable(table, "test_table_r"));
+  TEST_CHECK(createRecord(&r, schema));
+  for(i = 0; i < numInserts; i++)
+    {
+      MAKE_VALUE(val, DT_INT, i);
+      TEST_CHECK(setAttr(r, schema, 0, val));
+      TEST_CHECK(setAttr(r, schema, 2, val));
+      freeVal(val);
+      MAKE_STRING_VALUE(val, "abcd");
+      TEST_CHECK(setAttr(r, schema, 1, val));
+      freeVal(val);
+      TEST_CHECK(insertRecord(table, r));
+      rids[i] = r->id;
+    }
+
+  // a record whose bytes start like the old deletion marker is a record
+  TEST_CHECK(getRecord(table, rids[0], r));
+  memcpy(r->data, "~!@#$", 5);
+  TEST_CHECK(updateRecord(table, r));
+  TEST_CHECK(getRecord(table, rids[0], r));
+  ASSERT_TRUE(memcmp(r->data, "~!@#$", 5) == 0, "record like a marker is read");
+
+  // runs of deleted slots, across words of the bitmap, are skipped
+  for(i = 1; i < numInserts; i++)
+    if (i % 3 != 0 || (i > 100 && i < 200))
+      TEST_CHECK(deleteRecord(table, rids[i]));
+  TEST_CHECK(closeTable(table));
+  TEST_CHECK(openTable(table, "test_table_r"));
+
+  TEST_CHECK(startScan(table, sc, NULL));
+  last = -1;
+  for(seen = 0; (rc = next(sc, r)) == RC_OK; seen++)
+    {
+      TEST_CHECK(getAttr(r, schema, 2, &val));
+      i = val->v.intV;
+      freeVal(val);
+      ASSERT_TRUE(i > last && i % 3 == 0 && (i <= 100 || i >= 200), "only live records in RID order");
+      last = i;
+    }
+  TEST_CHECK(closeScan(sc));
+  ASSERT_EQUALS_INT(RC_RM_NO_MORE_TUPLES, rc, "scan ends");
+  ASSERT_EQUALS_INT(getNumTuples(table), seen, "scan sees every live record");
+  ASSERT_ERROR(getRecord(table, rids[1], r), "deleted record is gone");
+
+  freeRecord(r);
+  TEST_CHECK(closeTable(table));
+  TEST_CHECK(deleteTable("test_table_r"));
+
+  free(sc);
+  free(table);
+  freeSchema(schema);
+  TEST_DONE();
+}
+
+// ************************************************************
+void
+testWriteAheadLog (void)
+{
+  RM_TableData *table = (RM_TableData *) malloc(sizeof(RM_TableData));
+  RM_ScanHandle *sc = (RM_ScanHandle *) malloc(sizeof(RM_ScanHandle));
+  BM_PageHandle *h = MAKE_PAGE_HANDLE();
+  pthread_t threads[WAL_THREADS];
+  WalWorker workers[WAL_THREADS];
+  WalFlusher flushers[2];
+  int i, rc, seen, syncs, commits, fd;
+  int found[WAL_THREADS * WAL_INSERTS];
+  RM_TableMgmtData *mgmt;
+  WAL_Log *log;
+  WAL_Record record;
+  LSN end, lsn;
+  char old[1024];
+  char *buffer = NULL;
+  int bufferSize = 0;
+  ssize_t size, headerSize;
+  Record *r;
+  Schema *schema;
+  testName = "test write-ahead log of record changes";
+  schema = testSchema();
+
+  TEST_CHECK(initRecordManager(NULL));
+  TEST_CHECK(createTable("test_table_r",schema));
+  TEST_CHECK(openTable(table, "test_table_r"));
+  mgmt = (RM_TableMgmtData *) table->mgmtData;
+
+  // every change is durable in the log when its call returns
+  r = testRecord(schema, 1, "aaaa", 1);
+  TEST_CHECK(insertRecord(table, r));
+  ASSERT_TRUE(getDurableLSN(mgmt->log) == getEndLSN(mgmt->log), "insert is durable");
+  TEST_CHECK(updateRecord(table, r));
+  ASSERT_TRUE(getDurableLSN(mgmt->log) == getEndLSN(mgmt->log), "update is durable");
+  TEST_CHECK(deleteRecord(table, r->id));
+  ASSERT_TRUE(getDurableLSN(mgmt->log) == getEndLSN(mgmt->log), "delete is durable");
+  freeRecord(r);
+
+  // the data page carries the LSN of its last change, which is in the log
+  TEST_CHECK(pinPage(&mgmt->pool, h, 1));
+  ASSERT_TRUE(*(LSN *) h->data > 0, "data page has an LSN");
+  ASSERT_TRUE(*(LSN *) h->data < getDurableLSN(mgmt->log), "page LSN is durable");
+  TEST_CHECK(unpinPage(&mgmt->pool, h));
+
+  // commits of concurrent threads share syncs of the log
+  syncs = getNumLogSyncs(mgmt->log);
+  for(i = 0; i < WAL_THREADS; i++)
+    {
+      workers[i].table = table;
+      workers[i].schema = schema;
+      workers[i].id = i;
+      workers[i].errors = 0;
+      pthread_create(&threads[i], NULL, walInserter, &workers[i]);
+    }
+  for(i = 0; i < WAL_THREADS; i++)
+    {
+      pthread_join(threads[i], NULL);
+      ASSERT_EQUALS_INT(0, workers[i].errors, "inserts of a thread succeed");
+    }
+  commits = WAL_THREADS * WAL_INSERTS;
+  ASSERT_TRUE(getNumLogSyncs(mgmt->log) - syncs <= commits, "no more syncs than commits");
+  ASSERT_TRUE(getDurableLSN(mgmt->log) == getEndLSN(mgmt->log), "all inserts are durable");
+
+  memset(found, 0, sizeof(found));
+  TEST_CHECK(createRecord(&r, schema));
+  TEST_CHECK(startScan(table, sc, NULL));
+  for(seen = 0; (rc = next(sc, r)) == RC_OK; seen++)
+    {
+      Value *val;
+      TEST_CHECK(getAttr(r, schema, 0, &val));
+      if (val->v.intV >= 0 && val->v.intV < commits)
+	found[val->v.intV]++;
+      freeVal(val);
+    }
+  TEST_CHECK(closeScan(sc));
+  freeRecord(r);
+  ASSERT_EQUALS_INT(commits, seen, "scan sees every insert");
+  for(i = 0; i < commits && found[i] == 1; i++)
+    ;
+  ASSERT_EQUALS_INT(commits, i, "every insert is stored once");
+
+  // closing writes the pages and empties the log, whose LSNs keep growing
+  end = getEndLSN(mgmt->log);
+  TEST_CHECK(closeTable(table));
+  TEST_CHECK(openTable(table, "test_table_r"));
+  mgmt = (RM_TableMgmtData *) table->mgmtData;
+  ASSERT_TRUE(getEndLSN(mgmt->log) == end, "log continues at its old end");
+  ASSERT_EQUALS_INT(commits, getNumTuples(table), "inserts survive closing");
+
+  TEST_CHECK(closeTable(table));
+  TEST_CHECK(deleteTable("test_table_r"));
+
+  // a crash of truncateLog after the header moved on, before the records
+  // were cut off: the records left behind do not pass for new ones
+  TEST_CHECK(openLog(&log, "test_table_r.log"));
+  memset(&record, 0, sizeof(record));
+  record.length = sizeof(record);
+  record.type = WAL_COMMIT;
+  for(i = 0; i < 4; i++)
+    TEST_CHECK(appendLogRecord(log, &record, &lsn));
+  TEST_CHECK(flushLog(log, lsn));
+  end = getEndLSN(log);
+  fd = open("test_table_r.log", O_RDWR);
+  size = pread(fd, old, sizeof(old), 0);
+  TEST_CHECK(truncateLog(log));
+  headerSize = lseek(fd, 0, SEEK_END);
+  ASSERT_TRUE(pwrite(fd, old + headerSize, size - headerSize, headerSize) == size - headerSize, "old records put back");
+  close(fd);
+  closeLog(log);
+  TEST_CHECK(openLog(&log, "test_table_r.log"));
+  ASSERT_TRUE(getStartLSN(log) == end, "log starts at the end of the old one");
+  ASSERT_TRUE(getDurableLSN(log) == end, "old records are not taken");
+  ASSERT_ERROR(readLogRecord(log, end, &buffer, &bufferSize), "no record at the new start");
+  TEST_CHECK(appendLogRecord(log, &record, &lsn));
+  ASSERT_TRUE(lsn == end, "LSNs keep growing");
+  closeLog(log);
+  unlink("test_table_r.log");
+  free(buffer);
+
+  // a failed flush fails every thread waiting for its records, and the
+  // log takes no more records
+  TEST_CHECK(openLog(&log, "test_table_r.log"));
+  for(i = 0; i < 2; i++)
+    {
+      flushers[i].log = log;
+      TEST_CHECK(appendLogRecord(log, &record, &flushers[i].lsn));
+    }
+  fd = open("/dev/null", O_RDONLY);
+  dup2(fd, log->fd);
+  close(fd);
+  for(i = 0; i < 2; i++)
+    pthread_create(&threads[i], NULL, walFlusher, &flushers[i]);
+  for(i = 0; i < 2; i++)
+    {
+      pthread_join(threads[i], NULL);
+      ASSERT_TRUE(flushers[i].rc != RC_OK, "flush of a lost record fails");
+    }
+  ASSERT_TRUE(getDurableLSN(log) <= flushers[0].lsn, "lost records not durable");
+  ASSERT_ERROR(flushLog(log, flushers[1].lsn), "failure is kept");
+  ASSERT_ERROR(appendLogRecord(log, &record, &lsn), "no appends after a failure");
+  closeLog(log);
+  unlink("test_table_r.log");
+
+  free(h);
+  free(sc);
+  free(table);
+  freeSchema(schema);
+  TEST_DONE();
+}
+
+// ************************************************************
+void
+testCrashRecovery (void)
+{
+  RM_TableData *table = (RM_TableData *) malloc(sizeof(RM_TableData));
+  RM_ScanHandle *sc = (RM_ScanHandle *) malloc(sizeof(RM_ScanHandle));
+  const int numInserts = RECOVERY_INSERTS;
+  int *found = (int *) calloc(RECOVERY_INSERTS, sizeof(int));
+  int i, a, rc, seen, status;
+  RM_TableMgmtData *mgmt;
+  WAL_Log *log;
+  pid_t pid;
+  Expr *sel, *left, *right;
+  Value *val;
+  Record *r;
+  Schema *schema;
+  testName = "test crash recovery of tables";
+  schema = testSchema();
+
+  TEST_CHECK(initRecordManager(NULL));
+  TEST_CHECK(createTable("test_table_r",schema));
+
+  // a child process commits inserts, writes a page changed by a
+  // transaction that never commits, and dies without closing the table
+  fflush(stdout);
+  pid = fork();
+  if (pid == 0)
+    {
+      TEST_CHECK(openTable(table, "test_table_r"));
+      TEST_CHECK(createIndex(table, 0));
+      for(i = 0; i < numInserts; i++)
+	{
+	  r = testRecord(schema, i, "abcd", i % 7);
+	  TEST_CHECK(insertRecord(table, r));
+	  freeRecord(r);
+	}
+      writeUncommittedUpdate((RM_TableMgmtData *) table->mgmtData);
+      _exit(0);
+    }
+  waitpid(pid, &status, 0);
+  ASSERT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0, "child ran to its crash");
+
+  TEST_CHECK(openLog(&log, "test_table_r.log"));
+  ASSERT_TRUE(getDurableLSN(log) > getStartLSN(log), "crash leaves records in the log");
+  ASSERT_TRUE(getCheckpointLSN(log) > getStartLSN(log), "log has a checkpoint");
+  TEST_CHECK(closeLog(log));
+
+  // committed inserts are redone, the uncommitted update undone
+  TEST_CHECK(openTable(table, "test_table_r"));
+  mgmt = (RM_TableMgmtData *) table->mgmtData;
+  ASSERT_TRUE(getStartLSN(mgmt->log) == getEndLSN(mgmt->log), "recovery empties the log");
+  ASSERT_EQUALS_INT(numInserts, getNumTuples(table), "committed inserts are recovered");
+  TEST_CHECK(createRecord(&r, schema));
+  TEST_CHECK(startScan(table, sc, NULL));
+  for(seen = 0; (rc = next(sc, r)) == RC_OK; seen++)
+    {
+      TEST_CHECK(getAttr(r, schema, 0, &val));
+      a = val->v.intV;
+      freeVal(val);
+      TEST_CHECK(getAttr(r, schema, 1, &val));
+      ASSERT_TRUE(strcmp(val->v.stringV, "abcd") == 0, "string is recovered");
+      freeVal(val);
+      TEST_CHECK(getAttr(r, schema, 2, &val));
+      ASSERT_TRUE(a >= 0 && a < numInserts && val->v.intV == a % 7, "record is recovered");
+      freeVal(val);
+      found[a]++;
+    }
+  TEST_CHECK(closeScan(sc));
+  ASSERT_EQUALS_INT(numInserts, seen, "scan sees every committed insert");
+  for(i = 0; i < numInserts && found[i] == 1; i++)
+    ;
+  ASSERT_EQUALS_INT(numInserts, i, "every insert is recovered once");
+
+  // the index, never written by the child, is rebuilt
+  MAKE_CONS(left, stringToValue("i4321"));
+  MAKE_ATTRREF(right, 0);
+  MAKE_BINOP_EXPR(sel, right, left, OP_COMP_EQUAL);
+  TEST_CHECK(startScan(table, sc, sel));
+  TEST_CHECK(next(sc, r));
+  TEST_CHECK(getAttr(r, schema, 2, &val));
+  ASSERT_EQUALS_INT(4321 % 7, val->v.intV, "index lookup finds the record");
+  freeVal(val);
+  ASSERT_EQUALS_INT(RC_RM_NO_MORE_TUPLES, next(sc, r), "index lookup finds one record");
+  TEST_CHECK(closeScan(sc));
+  freeExpr(sel);
+
+  // the recovered table takes changes and closes cleanly
+  TEST_CHECK(deleteRecord(table, r->id));
+  freeRecord(r);
+  TEST_CHECK(closeTable(table));
+  TEST_CHECK(openTable(table, "test_table_r"));
+  ASSERT_EQUALS_INT(numInserts - 1, getNumTuples(table), "changes after recovery are kept");
+  TEST_CHECK(closeTable(table));
+  TEST_CHECK(deleteTable("test_table_r"));
+
+  free(found);
+  free(sc);
+  free(table);
+  freeSchema(schema);
+  TEST_DONE();
+}
+
+// ************************************************************
+void
+testTransactions (void)
+{
+  RM_TableData *table = (RM_TableData *) malloc(sizeof(RM_TableData));
+  RM_ScanHandle *sc = (RM_ScanHandle *) malloc(sizeof(RM_ScanHandle));
+  const int numCommitted = 100, numBatch = 2000;
+  RID rids[2000];
+  int i, rc, seen, syncs, status;
+  RM_TableMgmtData *mgmt;
+  RM_TxHandle *tx, *other;
+  TxOutsider outsider;
+  pthread_t thread;
+  pid_t pid;
+  Expr *sel, *left, *right;
+  Value *val;
+  Record *r, *old;
+  Schema *schema;
+  testName = "test transactions";
+  schema = testSchema();
+
+  TEST_CHECK(initRecordManager(NULL));
+  TEST_CHECK(createTable("test_table_r",schema));
+  TEST_CHECK(openTable(table, "test_table_r"));
+  TEST_CHECK(createIndex(table, 0));
+  mgmt = (RM_TableMgmtData *) table->mgmtData;
+  for(i = 0; i < numCommitted; i++)
+    {
+      r = testRecord(schema, i, "aaaa", i);
+      TEST_CHECK(insertRecord(table, r));
+      rids[i] = r->id;
+      freeRecord(r);
+    }
+
+  // a batch is flushed to the log once, at its commit
+  syncs = getNumLogSyncs(mgmt->log);
+  TEST_CHECK(beginTransaction(table, &tx));
+  ASSERT_EQUALS_INT(RC_RM_TRANSACTION_OPEN, beginTransaction(table, &other), "one transaction at a time");
+  ASSERT_EQUALS_INT(RC_RM_TRANSACTION_OPEN, createIndex(table, 2), "no index in a transaction");
+  for(i = numCommitted; i < numBatch; i++)
+    {
+      r = testRecord(schema, i, "bbbb", i);
+      TEST_CHECK(insertRecordInTx(tx, r));
+      rids[i] = r->id;
+      freeRecord(r);
+    }
+  ASSERT_EQUALS_INT(numBatch, getNumTuples(table), "transaction sees its inserts");
+  ASSERT_EQUALS_INT(syncs, getNumLogSyncs(mgmt->log), "no log flush before the commit");
+  TEST_CHECK(commitTransaction(tx));
+  ASSERT_TRUE(getNumLogSyncs(mgmt->log) - syncs <= 1, "one log flush for the batch");
+  ASSERT_TRUE(getDurableLSN(mgmt->log) == getEndLSN(mgmt->log), "commit is durable");
+
+  // abort restores every record and index entry the transaction changed,
+  // while another thread waits for it and never sees its changes
+  TEST_CHECK(beginTransaction(table, &tx));
+  outsider.table = table;
+  outsider.tx = tx;
+  outsider.triedTx = false;
+  pthread_create(&thread, NULL, txOutsider, &outsider);
+  for(i = 0; i < 50; i++)
+    {
+      r = testRecord(schema, i, "cccc", -i);
+      r->id = rids[i];
+      TEST_CHECK(updateRecordInTx(tx, r));
+      freeRecord(r);
+    }
+  for(i = 50; i < numBatch; i += 2)
+    TEST_CHECK(deleteRecordInTx(tx, rids[i]));
+  for(i = 0; i < 500; i++)
+    {
+      r = testRecord(schema, numBatch + i, "dddd", 0);
+      TEST_CHECK(insertRecordInTx(tx, r));
+      freeRecord(r);
+    }
+  TEST_CHECK(createRecord(&r, schema));
+  TEST_CHECK(startScanInTx(tx, sc, NULL));
+  for(seen = 0; (rc = next(sc, r)) == RC_OK; seen++)
+    ;
+  TEST_CHECK(closeScan(sc));
+  ASSERT_EQUALS_INT(numBatch - (numBatch - 50) / 2 + 500, seen, "scan in the transaction sees its changes");
+  TEST_CHECK(getRecordInTx(tx, rids[0], r));
+  TEST_CHECK(getAttr(r, schema, 1, &val));
+  ASSERT_EQUALS_STRING("cccc", val->v.stringV, "transaction reads its update");
+  freeVal(val);
+  while (!__atomic_load_n(&outsider.triedTx, __ATOMIC_ACQUIRE))
+    usleep(1000);
+  usleep(100000);
+  TEST_CHECK(abortTransaction(tx));
+  pthread_join(thread, NULL);
+  ASSERT_EQUALS_INT(RC_RM_NOT_IN_TRANSACTION, outsider.txRc, "transaction is its thread's");
+  ASSERT_EQUALS_INT(numBatch, outsider.numTuples, "other thread sees no uncommitted change");
+
+  ASSERT_EQUALS_INT(numBatch, getNumTuples(table), "abort restores the tuple count");
+  for(i = 0; i < numBatch; i++)
+    {
+      old = testRecord(schema, i, i < numCommitted ? "aaaa" : "bbbb", i);
+      TEST_CHECK(getRecord(table, rids[i], r));
+      ASSERT_TRUE(memcmp(r->data, old->data, getRecordSize(schema)) == 0, "abort restores the record");
+      freeRecord(old);
+    }
+  MAKE_CONS(left, stringToValue("i2100"));
+  MAKE_ATTRREF(right, 0);
+  MAKE_BINOP_EXPR(sel, right, left, OP_COMP_EQUAL);
+  TEST_CHECK(startScan(table, sc, sel));
+  ASSERT_EQUALS_INT(RC_RM_NO_MORE_TUPLES, next(sc, r), "abort removes index entries");
+  TEST_CHECK(closeScan(sc));
+  freeExpr(sel);
+  MAKE_CONS(left, stringToValue("i52"));
+  MAKE_ATTRREF(right, 0);
+  MAKE_BINOP_EXPR(sel, right, left, OP_COMP_EQUAL);
+  TEST_CHECK(startScan(table, sc, sel));
+  TEST_CHECK(next(sc, r));
+  ASSERT_TRUE(r->id.page == rids[52].page && r->id.slot == rids[52].slot, "abort restores index entries");
+  TEST_CHECK(closeScan(sc));
+  freeExpr(sel);
+
+  // closing the table rolls back a transaction left open
+  TEST_CHECK(beginTransaction(table, &tx));
+  TEST_CHECK(deleteRecordInTx(tx, rids[0]));
+  TEST_CHECK(closeTable(table));
+  TEST_CHECK(openTable(table, "test_table_r"));
+  ASSERT_EQUALS_INT(numBatch, getNumTuples(table), "close rolls back");
+  TEST_CHECK(closeTable(table));
+  freeRecord(r);
+
+  // recovery rolls back a transaction whose changes reached the disk
+  fflush(stdout);
+  pid = fork();
+  if (pid == 0)
+    {
+      TEST_CHECK(openTable(table, "test_table_r"));
+      TEST_CHECK(beginTransaction(table, &tx));
+      for(i = 0; i < numBatch; i += 3)
+	TEST_CHECK(deleteRecordInTx(tx, rids[i]));
+      TEST_CHECK(forceFlushPool(&((RM_TableMgmtData *) table->mgmtData)->pool));
+      _exit(0);
+    }
+  waitpid(pid, &status, 0);
+  ASSERT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0, "child ran to its crash");
+  TEST_CHECK(openTable(table, "test_table_r"));
+  ASSERT_EQUALS_INT(numBatch, getNumTuples(table), "recovery rolls back");
+  TEST_CHECK(createRecord(&r, schema));
+  TEST_CHECK(getRecord(table, rids[3], r));
+  TEST_CHECK(getAttr(r, schema, 2, &val));
+  ASSERT_EQUALS_INT(3, val->v.intV, "recovered record is intact");
+  freeVal(val);
+  freeRecord(r);
+
+  TEST_CHECK(closeTable(table));
+  TEST_CHECK(deleteTable("test_table_r"));
+
+  free(sc);
+  free(table);
+  freeSchema(schema);
+  TEST_DONE();
+}
+
+// ************************************************************
+void *
+txOutsider (void *arg)
+{
+  TxOutsider *o = (TxOutsider *) arg;
+  Record *r = testRecord(o->table->schema, -1, "eeee", 0);
+
+  o->txRc = insertRecordInTx(o->tx, r);
+  __atomic_store_n(&o->triedTx, true, __ATOMIC_RELEASE);
+  o->numTuples = getNumTuples(o->table);
+  freeRecord(r);
+  return NULL;
+}
+
+// ************************************************************
+// Log a change of page 2 by a transaction that does not commit, and write
+// the page with it
+void
+writeUncommittedUpdate (RM_TableMgmtData *mgmt)
+{
+  char buffer[sizeof(WAL_Record) + sizeof(WAL_PageUpdate) + sizeof(WAL_Run) + 2 * 16];
+  WAL_Record *record = (WAL_Record *) buffer;
+  WAL_PageUpdate *update = (WAL_PageUpdate *) (record + 1);
+  char *runs = (char *) (update + 1);
+  WAL_Run run = { PAGE_SIZE - 16, 16 };
+  BM_PageHandle h;
+  LSN lsn;
+
+  TEST_CHECK(pinPage(&mgmt->pool, &h, 2));
+  memset(record, 0, sizeof(*record));
+  record->length = sizeof(buffer);
+  record->type = WAL_UPDATE;
+  record->txId = 100000;
+  update->pageNum = 2;
+  update->numRuns = 1;
+  memcpy(runs, &run, sizeof(run));
+  memcpy(runs + sizeof(run), h.data + run.offset, run.length);
+  memset(runs + sizeof(run) + run.length, 'X', run.length);
+  TEST_CHECK(appendLogRecord(mgmt->log, record, &lsn));
+  TEST_CHECK(flushLog(mgmt->log, lsn));
+  memset(h.data + run.offset, 'X', run.length);
+  memcpy(h.data, &lsn, sizeof(lsn));
+  TEST_CHECK(markDirtyLSN(&mgmt->pool, &h, lsn));
+  TEST_CHECK(forcePage(&mgmt->pool, &h));
+  TEST_CHECK(unpinPage(&mgmt->pool, &h));
+}
+
+// ************************************************************
+void *
+walInserter (void *arg)
+{
+  WalWorker *w = (WalWorker *) arg;
+  Record *r;
+  int i;
+
+  for(i = 0; i < WAL_INSERTS; i++)
+    {
+      r = testRecord(w->schema, w->id * WAL_INSERTS + i, "wxyz", w->id);
+      if (insertRecord(w->table, r) != RC_OK)
+	w->errors++;
+      freeRecord(r);
+    }
+  return NULL;
+}
+
+// ************************************************************
+void *
+walFlusher (void *arg)
+{
+  WalFlusher *f = (WalFlusher *) arg;
+
+  f->rc = flushLog(f->log, f->lsn);
+  return NULL;
+}
+
+// ************************************************************
+void
+usePages (BM_BufferPool *bm, const int *pages, int numPages)
+{
+  BM_PageHandle *h = MAKE_PAGE_HANDLE();
+  int i;
+
+  for(i = 0; i < numPages; i++)
+    {
+      CHECK(pinPage(bm, h, pages[i]));
+      CHECK(unpinPage(bm, h));
+    }
+  free(h);
+}
+
+// ************************************************************
+Schema *
+testSchema (void)
+{
+  Schema *result;
+  char *names[] = { "a", "b", "c" };
+  DataType dt[] = { DT_INT, DT_STRING, DT_INT };
+  int sizes[] = { 0, 4, 0 };
+  int keys[] = {0};
+  int i;
+  char **cpNames = (char **) malloc(sizeof(char*) * 3);
+  DataType *cpDt = (DataType *) malloc(sizeof(DataType) * 3);
+  int *cpSizes = (int *) malloc(sizeof(int) * 3);
+  int *cpKeys = (int *) malloc(sizeof(int));
+
+  for(i = 0; i < 3; i++)
+    {
+      cpNames[i] = (char *) malloc(2);
+      strcpy(cpNames[i], names[i]);
+    }
+  memcpy(cpDt, dt, sizeof(DataType) * 3);
+  memcpy(cpSizes, sizes, sizeof(int) * 3);
+  memcpy(cpKeys, keys, sizeof(int));
+
+  result = createSchema(3, cpNames, cpDt, cpSizes, 1, cpKeys);
+
+  return result;
+}
+
+// ************************************************************
+Record *
+fromTestRecord (Schema *schema, TestRecord in)
+{
+  return testRecord(schema, in.a, in.b, in.c);
+}
+
+// ************************************************************
+Record *
+testRecord(Schema *schema, int a, char *b, int c)
+{
+  Record *result;
+  Value *value;
+
+  TEST_CHECK(createRecord(&result, schema));
+
+  MAKE_VALUE(value, DT_INT, a);
+  TEST_CHECK(setAttr(result, schema, 0, value));
+  freeVal(value);
+
+  MAKE_STRING_VALUE(value, b);
+  TEST_CHECK(setAttr(result, schema, 1, value));
+  freeVal(value);
+
+  MAKE_VALUE(value, DT_INT, c);
+  TEST_CHECK(setAttr(result, schema, 2, value));
+  freeVal(value);
+
+  return result;
+}
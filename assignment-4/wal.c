@@ -0,0 +1,360 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "wal.h"
+
+// The log file starts with this header, the records follow one after the
+// other: the record with LSN l is at offset sizeof(WAL_FileHeader) + l -
+// startLSN. truncateLog moves startLSN to the end of the log, so the LSNs
+// of later records keep growing. Every record also carries its LSN, so
+// records left behind from before a truncation never pass for new ones.
+#define WAL_MAGIC "WAL1"
+#define WAL_VERSION 2
+
+typedef struct WAL_FileHeader {
+    char magic[4];
+    int version;
+    LSN startLSN;
+    LSN checkpointLSN;
+} WAL_FileHeader;
+
+// Bytes the append buffer starts with; it doubles when a record does not fit
+#define WAL_BUFFER_SIZE (64 * 1024)
+
+static off_t fileOffset(WAL_Log *log, LSN lsn) {
+    return (off_t)(sizeof(WAL_FileHeader) + (lsn - log->startLSN));
+}
+
+// FNV-1a over a record, its checksum and lsn fields taken as 0
+static unsigned int bodyChecksum(const WAL_Record *record) {
+    const unsigned char *bytes = (const unsigned char *)record;
+    unsigned int hash = 2166136261u;
+    for (int i = 0; i < record->length; i++) {
+        unsigned char byte = bytes[i];
+        if (i >= (int)offsetof(WAL_Record, checksum) && i < (int)(offsetof(WAL_Record, lsn) + sizeof(LSN))) {
+            byte = 0;
+        }
+        hash = (hash ^ byte) * 16777619u;
+    }
+    return hash;
+}
+
+// The body's checksum continued over the LSN: the body is hashed before
+// appendLogRecord takes the log's mutex, the LSN once it is known
+static unsigned int recordChecksum(unsigned int bodyHash, LSN lsn) {
+    const unsigned char *bytes = (const unsigned char *)&lsn;
+    for (size_t i = 0; i < sizeof(lsn); i++) {
+        bodyHash = (bodyHash ^ bytes[i]) * 16777619u;
+    }
+    return bodyHash;
+}
+
+// Write and read exactly count bytes at offset, retrying after signals
+// and partial transfers. A transfer that moves nothing fails.
+static RC writeFully(int fd, const char *buffer, size_t count, off_t offset) {
+    while (count > 0) {
+        ssize_t n = pwrite(fd, buffer, count, offset);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return RC_WRITE_FAILED;
+        buffer += n;
+        count -= n;
+        offset += n;
+    }
+    return RC_OK;
+}
+
+static bool readFully(int fd, char *buffer, size_t count, off_t offset) {
+    while (count > 0) {
+        ssize_t n = pread(fd, buffer, count, offset);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        buffer += n;
+        count -= n;
+        offset += n;
+    }
+    return true;
+}
+
+static RC writeHeader(WAL_Log *log) {
+    WAL_FileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, WAL_MAGIC, sizeof(header.magic));
+    header.version = WAL_VERSION;
+    header.startLSN = log->startLSN;
+    header.checkpointLSN = log->checkpointLSN;
+    RC rc = writeFully(log->fd, (char *)&header, sizeof(header), 0);
+    if (rc == RC_OK && fdatasync(log->fd) != 0) {
+        rc = RC_WRITE_FAILED;
+    }
+    return rc;
+}
+
+// Whether a whole record with a valid checksum starts at lsn. A crash may
+// leave a record half written at the end of the file.
+static bool validRecordAt(WAL_Log *log, LSN lsn, off_t fileSize, char **scratch, int *scratchSize) {
+    WAL_Record header;
+    off_t offset = fileOffset(log, lsn);
+    if (offset + (off_t)sizeof(header) > fileSize || !readFully(log->fd, (char *)&header, sizeof(header), offset)) {
+        return false;
+    }
+    if (header.length < (int)sizeof(WAL_Record) || offset + header.length > fileSize) {
+        return false;
+    }
+    if (header.length > *scratchSize) {
+        char *grown = realloc(*scratch, header.length);
+        if (grown == NULL)
+            return false;
+        *scratch = grown;
+        *scratchSize = header.length;
+    }
+    if (!readFully(log->fd, *scratch, header.length, offset)) {
+        return false;
+    }
+    return header.lsn == lsn && recordChecksum(bodyChecksum((WAL_Record *)*scratch), lsn) == header.checksum;
+}
+
+RC openLog(WAL_Log **log, char *fileName) {
+    WAL_Log *wal = (WAL_Log *)calloc(1, sizeof(WAL_Log));
+    if (wal == NULL) return RC_MEMORY_ALLOCATION_FAIL;
+    wal->fd = open(fileName, O_RDWR | O_CREAT, 0644);
+    if (wal->fd < 0) {
+        free(wal);
+        return RC_FILE_NOT_FOUND;
+    }
+
+    // A new log, or the end of the records that were written completely
+    struct stat st;
+    WAL_FileHeader header;
+    RC rc = RC_OK;
+    if (fstat(wal->fd, &st) != 0) {
+        rc = RC_READ_FAILED;
+    } else if (st.st_size < (off_t)sizeof(header)) {
+        wal->startLSN = sizeof(header);
+        wal->durableLSN = wal->startLSN;
+        rc = writeHeader(wal);
+    } else if (!readFully(wal->fd, (char *)&header, sizeof(header), 0)
+               || memcmp(header.magic, WAL_MAGIC, sizeof(header.magic)) != 0
+               || header.version != WAL_VERSION) {
+        rc = RC_LOG_CORRUPT;
+    } else {
+        char *scratch = NULL;
+        int scratchSize = 0;
+        wal->startLSN = header.startLSN;
+        wal->checkpointLSN = header.checkpointLSN;
+        wal->durableLSN = wal->startLSN;
+        while (validRecordAt(wal, wal->durableLSN, st.st_size, &scratch, &scratchSize)) {
+            wal->durableLSN += ((WAL_Record *)scratch)->length;
+        }
+        free(scratch);
+        if (wal->checkpointLSN >= wal->durableLSN) {
+            wal->checkpointLSN = 0; // never made durable
+        }
+        if (fileOffset(wal, wal->durableLSN) < st.st_size && ftruncate(wal->fd, fileOffset(wal, wal->durableLSN)) != 0) {
+            rc = RC_WRITE_FAILED;
+        }
+    }
+    if (rc != RC_OK) {
+        close(wal->fd);
+        free(wal);
+        return rc;
+    }
+
+    wal->bufferLSN = wal->durableLSN;
+    wal->bufferSize = wal->flushBufferSize = WAL_BUFFER_SIZE;
+    wal->buffer = (char *)malloc(wal->bufferSize);
+    wal->flushBuffer = (char *)malloc(wal->flushBufferSize);
+    wal->nextTxId = 1;
+    pthread_mutex_init(&wal->mutex, NULL);
+    pthread_cond_init(&wal->flushDone, NULL);
+    *log = wal;
+    return RC_OK;
+}
+
+RC closeLog(WAL_Log *log) {
+    RC rc = flushLog(log, getEndLSN(log) - 1);
+    close(log->fd);
+    pthread_mutex_destroy(&log->mutex);
+    pthread_cond_destroy(&log->flushDone);
+    free(log->buffer);
+    free(log->flushBuffer);
+    free(log);
+    return rc;
+}
+
+RC appendLogRecord(WAL_Log *log, WAL_Record *record, LSN *lsn) {
+    unsigned int bodyHash = bodyChecksum(record);
+    pthread_mutex_lock(&log->mutex);
+    if (log->failed != RC_OK) {
+        RC rc = log->failed;
+        pthread_mutex_unlock(&log->mutex);
+        return rc;
+    }
+    if (log->bufferUsed + record->length > log->bufferSize) {
+        int size = log->bufferSize;
+        while (log->bufferUsed + record->length > size) {
+            size *= 2;
+        }
+        char *grown = realloc(log->buffer, size);
+        if (grown == NULL) {
+            pthread_mutex_unlock(&log->mutex);
+            return RC_MEMORY_ALLOCATION_FAIL;
+        }
+        log->buffer = grown;
+        log->bufferSize = size;
+    }
+    *lsn = log->bufferLSN + log->bufferUsed;
+    record->lsn = *lsn;
+    record->checksum = recordChecksum(bodyHash, *lsn);
+    memcpy(log->buffer + log->bufferUsed, record, record->length);
+    log->bufferUsed += record->length;
+    pthread_mutex_unlock(&log->mutex);
+    return RC_OK;
+}
+
+int newTransactionId(WAL_Log *log) {
+    return __atomic_fetch_add(&log->nextTxId, 1, __ATOMIC_RELAXED);
+}
+
+// Group commit. The first thread to find no flush running takes every
+// record appended so far, writes and syncs them with the log unlocked and
+// wakes the threads that waited meanwhile: those whose records it wrote
+// return, the others elect the next flush among themselves. The records of
+// a failed flush are no longer in memory, so the failure is kept and
+// returned to every thread waiting for them or for later records.
+RC flushLog(WAL_Log *log, LSN lsn) {
+    RC rc = RC_OK;
+    pthread_mutex_lock(&log->mutex);
+    while (log->durableLSN <= lsn) {
+        if (log->failed != RC_OK) {
+            rc = log->failed;
+            break;
+        }
+        if (log->flushing) {
+            pthread_cond_wait(&log->flushDone, &log->mutex);
+            continue;
+        }
+        if (log->bufferUsed == 0) {
+            break; // lsn is past the last record
+        }
+
+        char *records = log->buffer;
+        int length = log->bufferUsed;
+        LSN start = log->bufferLSN;
+        log->buffer = log->flushBuffer;
+        log->flushBuffer = records;
+        int size = log->bufferSize;
+        log->bufferSize = log->flushBufferSize;
+        log->flushBufferSize = size;
+        log->bufferLSN += length;
+        log->bufferUsed = 0;
+        log->flushing = true;
+        pthread_mutex_unlock(&log->mutex);
+
+        rc = writeFully(log->fd, records, length, fileOffset(log, start));
+        if (rc == RC_OK && fdatasync(log->fd) != 0) {
+            rc = RC_WRITE_FAILED;
+        }
+
+        pthread_mutex_lock(&log->mutex);
+        log->flushing = false;
+        if (rc == RC_OK) {
+            log->durableLSN = start + length;
+            log->numSyncs++;
+        } else {
+            log->failed = rc;
+        }
+        pthread_cond_broadcast(&log->flushDone);
+    }
+    pthread_mutex_unlock(&log->mutex);
+    return rc;
+}
+
+RC truncateLog(WAL_Log *log) {
+    RC rc = flushLog(log, getEndLSN(log) - 1);
+    if (rc != RC_OK) return rc;
+    // The header moves on before the records go, so that a crash in
+    // between leaves a log that starts at the end of the old one: the old
+    // records still in the file carry other LSNs and end the log
+    pthread_mutex_lock(&log->mutex);
+    LSN startLSN = log->startLSN;
+    LSN checkpointLSN = log->checkpointLSN;
+    log->startLSN = log->durableLSN;
+    log->checkpointLSN = 0;
+    rc = writeHeader(log);
+    if (rc != RC_OK) {
+        log->startLSN = startLSN;
+        log->checkpointLSN = checkpointLSN;
+    } else if (ftruncate(log->fd, sizeof(WAL_FileHeader)) != 0) {
+        rc = RC_WRITE_FAILED;
+    }
+    pthread_mutex_unlock(&log->mutex);
+    return rc;
+}
+
+RC readLogRecord(WAL_Log *log, LSN lsn, char **buffer, int *bufferSize) {
+    LSN durableLSN = getDurableLSN(log);
+    if (lsn < getStartLSN(log) || lsn >= durableLSN) {
+        return RC_LOG_CORRUPT;
+    }
+    off_t durableEnd = fileOffset(log, durableLSN);
+    return validRecordAt(log, lsn, durableEnd, buffer, bufferSize) ? RC_OK : RC_LOG_CORRUPT;
+}
+
+LSN getStartLSN(WAL_Log *log) {
+    pthread_mutex_lock(&log->mutex);
+    LSN lsn = log->startLSN;
+    pthread_mutex_unlock(&log->mutex);
+    return lsn;
+}
+
+// The checkpoint record is durable before the header names it; a crash in
+// between leaves the header at the previous checkpoint
+RC setCheckpoint(WAL_Log *log, LSN lsn) {
+    RC rc = flushLog(log, lsn);
+    if (rc != RC_OK) return rc;
+    pthread_mutex_lock(&log->mutex);
+    if (lsn > log->checkpointLSN && lsn >= log->startLSN) {
+        log->checkpointLSN = lsn;
+        rc = writeHeader(log);
+    }
+    pthread_mutex_unlock(&log->mutex);
+    return rc;
+}
+
+LSN getCheckpointLSN(WAL_Log *log) {
+    pthread_mutex_lock(&log->mutex);
+    LSN lsn = log->checkpointLSN;
+    pthread_mutex_unlock(&log->mutex);
+    return lsn;
+}
+
+LSN getDurableLSN(WAL_Log *log) {
+    pthread_mutex_lock(&log->mutex);
+    LSN lsn = log->durableLSN;
+    pthread_mutex_unlock(&log->mutex);
+    return lsn;
+}
+
+// LSN the next record will get
+LSN getEndLSN(WAL_Log *log) {
+    pthread_mutex_lock(&log->mutex);
+    LSN lsn = log->bufferLSN + log->bufferUsed;
+    pthread_mutex_unlock(&log->mutex);
+    return lsn;
+}
+
+int getNumLogSyncs(WAL_Log *log) {
+    pthread_mutex_lock(&log->mutex);
+    int numSyncs = log->numSyncs;
+    pthread_mutex_unlock(&log->mutex);
+    return numSyncs;
+}
@@ -0,0 +1,122 @@
+#ifndef WAL_H
+#define WAL_H
+
+#include <pthread.h>
+
+#include "dberror.h"
+#include "dt.h"
+
+// Write-ahead log. Records are appended to a buffer in memory and reach
+// the log file when flushLog is asked to make one of them durable. A
+// record is named by its LSN, its position in the log: LSNs only grow,
+// also across truncateLog, so a page stamped with the LSN of the last
+// change it got can always be compared with the records of the log.
+typedef long long LSN;
+
+// Kinds of records
+typedef enum WAL_RecordType {
+	WAL_UPDATE = 1, // bytes of one page changed, see WAL_PageUpdate
+	WAL_COMMIT = 2, // the changes of a transaction are complete
+	WAL_COMPENSATION = 3, // an update undone, see WAL_Compensation
+	WAL_ABORT = 4, // the changes of a transaction are all undone
+	WAL_CHECKPOINT = 5 // the pages dirty at the time, see WAL_Checkpoint
+} WAL_RecordType;
+
+// Every record starts with this header; length counts the record's bytes,
+// the header's included. lsn and checksum are set by appendLogRecord.
+typedef struct WAL_Record {
+	int length;
+	unsigned int checksum; // of the record and its LSN, see recordChecksum
+	LSN lsn; // where the record belongs, so a stale one is never taken for it
+	LSN prevLSN; // previous record of the same transaction, 0 for its first
+	int txId;
+	int type;
+} WAL_Record;
+
+// Body of a WAL_UPDATE: the page and the runs of bytes of it that changed,
+// each a WAL_Run followed by the run's bytes before and after the change
+typedef struct WAL_PageUpdate {
+	int pageNum;
+	int numRuns;
+} WAL_PageUpdate;
+
+typedef struct WAL_Run {
+	short offset;
+	short length;
+} WAL_Run;
+
+// Body of a WAL_COMPENSATION: the record of the transaction to undo next,
+// followed by the WAL_PageUpdate that undid an update, its runs going from
+// the bytes after the update back to the bytes before it
+typedef struct WAL_Compensation {
+	LSN undoNextLSN;
+} WAL_Compensation;
+
+// Body of a WAL_CHECKPOINT: the dirty pages, each with the LSN of the
+// first change it got since it was last written back
+typedef struct WAL_Checkpoint {
+	int numDirtyPages;
+	int padding; // aligns the entries that follow
+} WAL_Checkpoint;
+
+typedef struct WAL_DirtyPage {
+	int pageNum;
+	LSN recLSN;
+} WAL_DirtyPage;
+
+// An open log. Appends go to buffer while a flush writes flushBuffer, so
+// a thread waiting for the disk does not hold up the others; commits that
+// arrive during a flush are all made durable by the next one.
+typedef struct WAL_Log {
+	int fd;
+	LSN startLSN; // LSN of the first record in the file
+	LSN checkpointLSN; // last checkpoint record, 0 if none
+	char *buffer; // records not written yet, the first at bufferLSN
+	int bufferSize;
+	int bufferUsed;
+	LSN bufferLSN;
+	char *flushBuffer; // records a flush is writing
+	int flushBufferSize;
+	bool flushing;
+	LSN durableLSN; // records before it are in the file and synced
+	RC failed; // error of a failed flush, RC_OK until one fails
+	int nextTxId;
+	int numSyncs;
+	pthread_mutex_t mutex;
+	pthread_cond_t flushDone;
+} WAL_Log;
+
+// opening and closing; the log file is created when it does not exist
+extern RC openLog (WAL_Log **log, char *fileName);
+extern RC closeLog (WAL_Log *log);
+
+// appending records, record->length bytes; their LSN is returned in lsn
+extern RC appendLogRecord (WAL_Log *log, WAL_Record *record, LSN *lsn);
+extern int newTransactionId (WAL_Log *log);
+
+// make every record up to the one at lsn durable, with one write and sync
+// for the records of all threads waiting at the time. A failed write or
+// sync is final: the log then refuses appends and every flush of a record
+// that is not durable returns the error.
+extern RC flushLog (WAL_Log *log, LSN lsn);
+
+// drop every record, once the pages they changed are durable themselves
+extern RC truncateLog (WAL_Log *log);
+
+// reading the durable records, e.g. after a crash: the record at lsn is
+// read into *buffer, grown to fit; the next record follows at lsn +
+// length. RC_LOG_CORRUPT when no whole record starts at lsn.
+extern RC readLogRecord (WAL_Log *log, LSN lsn, char **buffer, int *bufferSize);
+extern LSN getStartLSN (WAL_Log *log);
+
+// checkpoints: recovery starts at the last checkpoint record made durable
+// and named in the log file's header by setCheckpoint
+extern RC setCheckpoint (WAL_Log *log, LSN lsn);
+extern LSN getCheckpointLSN (WAL_Log *log);
+
+// statistics
+extern LSN getDurableLSN (WAL_Log *log);
+extern LSN getEndLSN (WAL_Log *log);
+extern int getNumLogSyncs (WAL_Log *log);
+
+#endif // WAL_H